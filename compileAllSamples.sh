@@ -4,12 +4,8 @@ do
   echo "Compiling $entry"
   base=$(basename $entry)
   name=$(echo "$base" | cut -f 1 -d '.')
-  bitcode="$search_dir"/OutBitcode/"$base"
-  object="$search_dir"/OutObjects/"$base"
   execute="$search_dir"/OutExecutables/"$name"
-  ./compiler $entry $bitcode 
-  llc -relocation-model=pic -filetype=obj "$bitcode".bc -o "$object".o
-  gcc "$object".o -o $execute
+  ./compiler $entry $execute
   #echo "$search_dir"/OutBitcode/"$base"
 done
 
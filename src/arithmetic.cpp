@@ -0,0 +1,71 @@
+#include "arithmetic.h"
+
+static bool signedArithmetic = false;
+
+void SetSignedArithmetic(bool enabled){
+    signedArithmetic = enabled;
+}
+
+bool SignedArithmetic(){
+    return signedArithmetic;
+}
+
+/************************/
+/*       Unsigned       */
+/************************/
+
+static bool ComputeUnsigned(LexicalTokenType op, uint64_t l, uint64_t r, uint64_t &result){
+    switch(op){
+        case PLUS: result = l + r; return true;
+        case MINUS: result = l - r; return true;
+        case TIMES: result = l * r; return true;
+        case DIV: if(!r) return false; result = l / r; return true;
+        case MOD: if(!r) return false; result = l % r; return true;
+        case AND: result = l & r; return true;
+        case OR: result = l | r; return true;
+        case LESSTHAN: result = l < r; return true;
+        case LESSTHANEQ: result = l <= r; return true;
+        case GREATERTHAN: result = l > r; return true;
+        case GREATERTHANEQ: result = l >= r; return true;
+        case NOTEQUAL: result = l != r; return true;
+        case EQUAL: result = l == r; return true;
+        default: return false;
+    }
+}
+
+/************************/
+/*        Signed        */
+/************************/
+
+static bool ComputeSigned(LexicalTokenType op, int64_t l, int64_t r, uint64_t &result){
+    int64_t value;
+    switch(op){
+        case PLUS: if(__builtin_add_overflow(l, r, &value)) return false; break;
+        case MINUS: if(__builtin_sub_overflow(l, r, &value)) return false; break;
+        case TIMES: if(__builtin_mul_overflow(l, r, &value)) return false; break;
+        // sdiv and srem of minint by -1 are undefined like division by zero
+        case DIV: if(!r || (l == INT64_MIN && r == -1)) return false; value = l / r; break;
+        case MOD: if(!r || (l == INT64_MIN && r == -1)) return false; value = l % r; break;
+        case LESSTHAN: value = l < r; break;
+        case LESSTHANEQ: value = l <= r; break;
+        case GREATERTHAN: value = l > r; break;
+        case GREATERTHANEQ: value = l >= r; break;
+        default: return ComputeUnsigned(op, l, r, result);
+    }
+    result = value;
+    return true;
+}
+
+bool ComputeBinary(LexicalTokenType op, uint64_t l, uint64_t r, uint64_t &result){
+    if(signedArithmetic)
+        return ComputeSigned(op, l, r, result);
+    return ComputeUnsigned(op, l, r, result);
+}
+
+bool ComputeNegation(uint64_t value, uint64_t &result){
+    if(!signedArithmetic){
+        result = value;
+        return true;
+    }
+    return ComputeSigned(MINUS, 0, value, result);
+}
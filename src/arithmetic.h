@@ -0,0 +1,36 @@
+#ifndef ARITHMETIC_H
+#define ARITHMETIC_H
+
+#include <stdint.h>
+
+#include "lexar.h"
+
+/*
+ * What integer expressions mean, shared by codegen, FoldConstants and
+ * EvaluateConstantCalls so the three always agree on a program's result.
+ *
+ * By default integers are 64 bit and unsigned: + - * wrap, div and mod are
+ * udiv and urem, comparisons are unsigned and a leading minus does nothing.
+ *
+ * compiler --signed gives them Pascal's meaning instead: div and mod round
+ * toward zero, comparisons are signed and -x negates. Overflowing + - * (and
+ * minint div -1) is an error the program must not make, which codegen tells
+ * LLVM with nsw (and exact for divisions it can prove leave no remainder).
+ * That's what lets the optimizer reason about loop counters, e.g. that
+ * i := i + 2 while i < n runs (n - i + 1) div 2 times. Folding and evaluation
+ * leave anything that would overflow for runtime.
+ */
+
+void SetSignedArithmetic(bool enabled);
+bool SignedArithmetic();
+
+// l op r for the arithmetic, and/or and comparison operators. Returns false
+// if it has no value known at compile time (division by zero, or in signed
+// mode an overflow).
+bool ComputeBinary(LexicalTokenType op, uint64_t l, uint64_t r, uint64_t &result);
+
+// -value, which is value itself unless integers are signed. Returns false
+// for an overflow (negating minint).
+bool ComputeNegation(uint64_t value, uint64_t &result);
+
+#endif
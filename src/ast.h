@@ -8,8 +8,12 @@
 #include <stdlib.h>
 #include "llvm/IR/Value.h"
 #include "llvm/IR/Instructions.h"
+#include "llvm/IR/LLVMContext.h"
 #include "llvm/IR/Module.h"
+#include "llvm/IR/ValueHandle.h"
+#include "llvm/Support/Casting.h"
 
+#include "builtins.h"
 #include "lexar.h"
 
 
@@ -25,12 +29,39 @@ struct ValueNamePair{
 
 #define PRINTDPETH(depth, format, ...) {printf("|"); for(int i = 0; i<depth; i++) printf("---"); printf(" "); printf(format, ##__VA_ARGS__);}
 
+// Every node gets a kind so we can dispatch with a switch and use
+// llvm::isa/cast/dyn_cast (through classof) instead of virtuals and RTTI.
+enum ASTKind{
+#define AST_NODE(KIND, CLASS) AST_##KIND,
+#include "ast_nodes.def"
+    AST_FIRST_DECLARATION = AST_VARIABLE_DECLARATIONS_OF_TYPE,
+    AST_LAST_DECLARATION = AST_FUNCTION
+};
+
 class AST {
+    private:
+        const ASTKind kind;
+        // Where in the source the node came from. Resolve through a LineTable
+        // when a line/column is needed.
+        uint32_t offset = 0;
+        uint32_t length = 0;
+        // Same for structurally identical pure expressions, 0 if not numbered.
+        // See expression_table.h
+        uint32_t valueNumber = 0;
     public:
+        AST(ASTKind kind): kind(kind){};
         virtual ~AST(){};
-        virtual void PrintNode(int depth){};
-        virtual llvm::Value* codegen() = 0;
-        
+
+        ASTKind GetKind() const {return kind;};
+        uint32_t GetOffset() const {return offset;};
+        uint32_t GetLength() const {return length;};
+        void SetLocation(uint32_t offset, uint32_t length){ this->offset = offset; this->length = length; };
+        uint32_t GetValueNumber() const {return valueNumber;};
+        void SetValueNumber(uint32_t number){ valueNumber = number; };
+
+        // These switch on the kind and forward to the concrete node
+        void PrintNode(int depth);
+        llvm::Value* codegen();
 };
 
 // Main Parts
@@ -42,31 +73,53 @@ class MainBlockAST: public AST {
     public:
         MainBlockAST(std::vector<std::unique_ptr<AST>> declarations,
                      std::unique_ptr<AST> statementSequence)
-            : declarations(std::move(declarations)), 
+            : AST(AST_MAIN_BLOCK),
+              declarations(std::move(declarations)), 
               statementSequence(std::move(statementSequence)) {};
 
-        void PrintNode(int depth) override;
-        llvm::Value* codegen() override;
+        std::vector<std::unique_ptr<AST>> &GetDeclarations(){return declarations;};
+        std::unique_ptr<AST> &GetStatementSequence(){return statementSequence;};
+
+        void PrintNode(int depth);
+        llvm::Value* codegen();
+        static bool classof(const AST *node){return node->GetKind() == AST_MAIN_BLOCK;};
 };
 
+// Codegen keeps variables in SSA values (building the phis itself) instead of
+// allocas when enabled, see the variable storage section of codegen_ast.cpp
+void SetSSACodegen(bool enabled);
+
+// The CPU and features (as -mcpu and -mattr take them) stamped on every
+// function codegen creates, nothing is stamped for empty ones
+void SetTargetAttributes(const std::string &cpu, const std::string &features);
+
 class ProgramAST: public AST{
     private:
         std::string programName;
         std::vector<std::unique_ptr<AST>> declarations;
         std::unique_ptr<AST> statementSequence;
+        // The module's context, declared first so the module goes before it
+        std::unique_ptr<llvm::LLVMContext> llvmContext;
         std::unique_ptr<llvm::Module> llvmModule;
 
     public:
         std::unique_ptr<llvm::Module> GetModule(){return std::move(llvmModule);};
+        std::unique_ptr<llvm::LLVMContext> GetLLVMContext(){return std::move(llvmContext);};
         ProgramAST(const std::string &name,
                    std::vector<std::unique_ptr<AST>> declarations,
                      std::unique_ptr<AST> statementSequence)
-            : programName(name), 
+            : AST(AST_PROGRAM),
+              programName(name), 
               declarations(std::move(declarations)), 
               statementSequence(std::move(statementSequence)){};
 
-        void PrintNode(int depth) override;
-        llvm::Value* codegen() override;
+        const std::string &GetName() const {return programName;};
+        std::vector<std::unique_ptr<AST>> &GetDeclarations(){return declarations;};
+        std::unique_ptr<AST> &GetStatementSequence(){return statementSequence;};
+
+        void PrintNode(int depth);
+        llvm::Value* codegen();
+        static bool classof(const AST *node){return node->GetKind() == AST_PROGRAM;};
 };
 
 class StatementSequenceAST: public AST{
@@ -74,10 +127,13 @@ class StatementSequenceAST: public AST{
         std::vector<std::unique_ptr<AST>> statements;
     public:
         StatementSequenceAST(std::vector<std::unique_ptr<AST>> statements)
-            : statements(std::move(statements)){};
+            : AST(AST_STATEMENT_SEQUENCE), statements(std::move(statements)){};
 
-        void PrintNode(int depth) override;
-        llvm::Value* codegen() override;
+        std::vector<std::unique_ptr<AST>> &GetStatements(){return statements;};
+
+        void PrintNode(int depth);
+        llvm::Value* codegen();
+        static bool classof(const AST *node){return node->GetKind() == AST_STATEMENT_SEQUENCE;};
 };
 
 // Numbers and Identifiers
@@ -87,22 +143,30 @@ class NumberAST: public AST {
         int value;
 
     public:
-        NumberAST(int number): value(number){};
+        NumberAST(int number): AST(AST_NUMBER), value(number){};
+
+        int GetValue() const {return value;};
 
-        void PrintNode(int depth) override;
-        llvm::Value* codegen() override;
+        void PrintNode(int depth);
+        llvm::Value* codegen();
+        static bool classof(const AST *node){return node->GetKind() == AST_NUMBER;};
 };
 
 class VariableIdentifierAST: public AST {
     private:
         std::string name;
+        // Storage slot given by ResolveNames, 0 if it didn't resolve
+        uint32_t slot = 0;
 
     public:
-        VariableIdentifierAST(const std::string &name): name(name){}
+        VariableIdentifierAST(const std::string &name): AST(AST_VARIABLE_IDENTIFIER), name(name){}
 
         std::string GetName(){return name;};
-        void PrintNode(int depth) override;
-        llvm::Value* codegen() override;
+        uint32_t GetSlot() const {return slot;};
+        void SetSlot(uint32_t slot){ this->slot = slot; };
+        void PrintNode(int depth);
+        llvm::Value* codegen();
+        static bool classof(const AST *node){return node->GetKind() == AST_VARIABLE_IDENTIFIER;};
 };
 
 // Operators
@@ -115,10 +179,14 @@ class UnaryOpAST: public AST {
     public:
         UnaryOpAST(LexicalTokenType op,
                    std::unique_ptr<AST> expression )
-            : op(op), expression(std::move(expression)){};
+            : AST(AST_UNARY_OP), op(op), expression(std::move(expression)){};
 
-        void PrintNode(int depth) override;
-        llvm::Value* codegen() override;
+        LexicalTokenType GetOp() const {return op;};
+        std::unique_ptr<AST> &GetExpression(){return expression;};
+
+        void PrintNode(int depth);
+        llvm::Value* codegen();
+        static bool classof(const AST *node){return node->GetKind() == AST_UNARY_OP;};
 };
 
 class BinaryOpAST: public AST {
@@ -129,10 +197,15 @@ class BinaryOpAST: public AST {
     public:
         BinaryOpAST(LexicalTokenType op,
                     std::unique_ptr<AST> LHS,
-                    std::unique_ptr<AST> RHS): op(op), LHS(std::move(LHS)), RHS(std::move(RHS)){};
+                    std::unique_ptr<AST> RHS): AST(AST_BINARY_OP), op(op), LHS(std::move(LHS)), RHS(std::move(RHS)){};
+
+        LexicalTokenType GetOp() const {return op;};
+        std::unique_ptr<AST> &GetLHS(){return LHS;};
+        std::unique_ptr<AST> &GetRHS(){return RHS;};
 
-        void PrintNode(int depth) override;
-        llvm::Value* codegen() override;
+        void PrintNode(int depth);
+        llvm::Value* codegen();
+        static bool classof(const AST *node){return node->GetKind() == AST_BINARY_OP;};
 };
 
 class ComparisonOpAST: public AST {
@@ -143,27 +216,60 @@ class ComparisonOpAST: public AST {
     public:
         ComparisonOpAST(LexicalTokenType op,
                     std::unique_ptr<AST> LHS,
-                    std::unique_ptr<AST> RHS): op(op), LHS(std::move(LHS)), RHS(std::move(RHS)){};
+                    std::unique_ptr<AST> RHS): AST(AST_COMPARISON_OP), op(op), LHS(std::move(LHS)), RHS(std::move(RHS)){};
 
-        void PrintNode(int depth) override;
-        llvm::Value* codegen() override;
+        LexicalTokenType GetOp() const {return op;};
+        std::unique_ptr<AST> &GetLHS(){return LHS;};
+        std::unique_ptr<AST> &GetRHS(){return RHS;};
+
+        void PrintNode(int depth);
+        llvm::Value* codegen();
+        static bool classof(const AST *node){return node->GetKind() == AST_COMPARISON_OP;};
 };
 
+// Comparisons are the language's booleans (i1 in codegen) and so are and/or
+// of two booleans, which only evaluate their right side when they have to.
+// and/or of integers stay bitwise.
+inline bool IsBoolean(AST *node){
+    if(llvm::isa<ComparisonOpAST>(node))
+        return true;
+    auto binary = llvm::dyn_cast<BinaryOpAST>(node);
+    return binary && (binary->GetOp() == AND || binary->GetOp() == OR) && binary->GetLHS() && binary->GetRHS() &&
+           IsBoolean(binary->GetLHS().get()) && IsBoolean(binary->GetRHS().get());
+}
+
 class ExitBreakStatementAST: public AST{
     private:
         LexicalTokenType exitOrBreak;
 
     public:
-        ExitBreakStatementAST(LexicalTokenType exitOrBreak): exitOrBreak(exitOrBreak){};
-        void PrintNode(int depth) override;
-        llvm::Value* codegen() override;
+        ExitBreakStatementAST(LexicalTokenType exitOrBreak): AST(AST_EXIT_BREAK), exitOrBreak(exitOrBreak){};
+
+        LexicalTokenType GetExitOrBreak() const {return exitOrBreak;};
+
+        void PrintNode(int depth);
+        llvm::Value* codegen();
+        static bool classof(const AST *node){return node->GetKind() == AST_EXIT_BREAK;};
 };
 
 // Declarations
 
 class DeclarationAST : public AST{
+    private:
+        // Cleared by MarkReachableProcedures on procedures nothing calls
+        bool reachable = true;
     public:
-        virtual std::vector<llvm::AllocaInst*> DoAllocations() = 0;
+        DeclarationAST(ASTKind kind): AST(kind){};
+
+        bool IsReachable() const {return reachable;};
+        void SetReachable(bool reachable){ this->reachable = reachable; };
+
+        // Switches on the kind like AST::codegen does
+        void DoAllocations();
+        static bool classof(const AST *node){
+            return node->GetKind() >= AST_FIRST_DECLARATION &&
+                   node->GetKind() <= AST_LAST_DECLARATION;
+        };
 };
 
 class VariableDeclarationsOfTypeAST: public DeclarationAST {
@@ -173,52 +279,81 @@ class VariableDeclarationsOfTypeAST: public DeclarationAST {
     public:
         VariableDeclarationsOfTypeAST(std::vector<std::unique_ptr<VariableIdentifierAST>> list,
                                 LexicalTokenType type)
-            : identifiers(std::move(list)){ this->type = type; };
+            : DeclarationAST(AST_VARIABLE_DECLARATIONS_OF_TYPE), identifiers(std::move(list)){ this->type = type; };
+
+        LexicalTokenType GetType() const {return type;};
+        std::vector<std::unique_ptr<VariableIdentifierAST>> &GetIdentifiers(){return identifiers;};
 
-        void PrintNode(int depth) override;
-        llvm::Value* codegen() override {return nullptr;};
-        std::vector<llvm::AllocaInst*> DoAllocations() override;
+        void PrintNode(int depth);
+        llvm::Value* codegen() {return nullptr;};
+        void DoAllocations();
+        static bool classof(const AST *node){return node->GetKind() == AST_VARIABLE_DECLARATIONS_OF_TYPE;};
 };
 
 class VariableDeclarationsAST: public DeclarationAST {
     private:
         std::vector<std::unique_ptr<AST>> declarations;
     public:
-        VariableDeclarationsAST(std::vector<std::unique_ptr<AST>> declarations):declarations(std::move(declarations)){};
+        VariableDeclarationsAST(std::vector<std::unique_ptr<AST>> declarations)
+            : DeclarationAST(AST_VARIABLE_DECLARATIONS), declarations(std::move(declarations)){};
 
-        void PrintNode(int depth) override;
-        llvm::Value* codegen() override {return nullptr;};
-        std::vector<llvm::AllocaInst*> DoAllocations() override;
+        std::vector<std::unique_ptr<AST>> &GetDeclarations(){return declarations;};
+
+        void PrintNode(int depth);
+        llvm::Value* codegen() {return nullptr;};
+        void DoAllocations();
+        static bool classof(const AST *node){return node->GetKind() == AST_VARIABLE_DECLARATIONS;};
 };
 
 
 class ConstantDeclarationsAST: public DeclarationAST {
     private:
         std::vector<ValueNamePair> constants;
+        // The constants get consecutive slots starting here
+        uint32_t firstSlot = 0;
     public:
-        ConstantDeclarationsAST(std::vector<ValueNamePair> constants): constants(constants){};
+        ConstantDeclarationsAST(std::vector<ValueNamePair> constants)
+            : DeclarationAST(AST_CONSTANT_DECLARATIONS), constants(constants){};
+
+        const std::vector<ValueNamePair> &GetConstants() const {return constants;};
+        uint32_t GetFirstSlot() const {return firstSlot;};
+        void SetFirstSlot(uint32_t slot){ firstSlot = slot; };
 
-        void PrintNode(int depth) override;
-        llvm::Value* codegen() override {return nullptr;};
-        std::vector<llvm::AllocaInst*> DoAllocations() override;
+        void PrintNode(int depth);
+        llvm::Value* codegen() {return nullptr;};
+        void DoAllocations();
+        static bool classof(const AST *node){return node->GetKind() == AST_CONSTANT_DECLARATIONS;};
 };
 
 // Expressions
 
+class PrototypeAST;
+
 class CallExpessionsAst: public AST {
     private:
         std::string Callee;
         std::vector<std::unique_ptr<AST>> Args;
+        // What ResolveNames bound the callee to, a builtin or a user declaration
+        BuiltinID builtin = BUILTIN_NONE;
+        PrototypeAST *declaration = nullptr;
     public:
         CallExpessionsAst(const std::string &callee,
                           std::vector<std::unique_ptr<AST>> Args)
-            : Callee(callee), Args(std::move(Args)){}
+            : AST(AST_CALL), Callee(callee), Args(std::move(Args)){}
 
         CallExpessionsAst(const std::string &callee)
-            : Callee(callee){}
-
-        void PrintNode(int depth) override;
-        llvm::Value* codegen() override;
+            : AST(AST_CALL), Callee(callee){}
+
+        const std::string &GetCallee() const {return Callee;};
+        std::vector<std::unique_ptr<AST>> &GetArgs(){return Args;};
+        BuiltinID GetBuiltin() const {return builtin;};
+        void SetBuiltin(BuiltinID builtin){ this->builtin = builtin; };
+        PrototypeAST *GetDeclaration() const {return declaration;};
+        void SetDeclaration(PrototypeAST *declaration){ this->declaration = declaration; };
+
+        void PrintNode(int depth);
+        llvm::Value* codegen();
+        static bool classof(const AST *node){return node->GetKind() == AST_CALL;};
 };
 
 class IfExpressionAST: public AST{
@@ -228,10 +363,15 @@ class IfExpressionAST: public AST{
         IfExpressionAST(std::unique_ptr<AST> cond,
                         std::unique_ptr<AST> thenPart,
                         std::unique_ptr<AST> elsePart)
-            :cond(std::move(cond)), thenPart(std::move(thenPart)), elsePart(std::move(elsePart)) {}
+            : AST(AST_IF), cond(std::move(cond)), thenPart(std::move(thenPart)), elsePart(std::move(elsePart)) {}
 
-        void PrintNode(int depth) override;
-        llvm::Value* codegen() override;
+        std::unique_ptr<AST> &GetCond(){return cond;};
+        std::unique_ptr<AST> &GetThen(){return thenPart;};
+        std::unique_ptr<AST> &GetElse(){return elsePart;};
+
+        void PrintNode(int depth);
+        llvm::Value* codegen();
+        static bool classof(const AST *node){return node->GetKind() == AST_IF;};
 };
 
 class ForExpressionAST: public AST{
@@ -239,6 +379,7 @@ class ForExpressionAST: public AST{
         std::string loopVarName;
         LexicalTokenType direction; //IE: TO or DOWNTO
         std::unique_ptr<AST> start, end, step, body;
+        uint32_t loopVarSlot = 0;
     public:
         ForExpressionAST(std::string loopVarName,
                          LexicalTokenType direction,
@@ -246,10 +387,20 @@ class ForExpressionAST: public AST{
                          std::unique_ptr<AST> end,
                          std::unique_ptr<AST> step,
                          std::unique_ptr<AST> body)
-            :loopVarName(std::move(loopVarName)), start(std::move(start)), end(std::move(end)),step(std::move(step)), body(std::move(body)){ this->direction = direction; }
-
-        void PrintNode(int depth) override;
-        llvm::Value* codegen() override;
+            : AST(AST_FOR), loopVarName(std::move(loopVarName)), start(std::move(start)), end(std::move(end)),step(std::move(step)), body(std::move(body)){ this->direction = direction; }
+
+        const std::string &GetLoopVarName() const {return loopVarName;};
+        uint32_t GetLoopVarSlot() const {return loopVarSlot;};
+        void SetLoopVarSlot(uint32_t slot){ loopVarSlot = slot; };
+        LexicalTokenType GetDirection() const {return direction;};
+        std::unique_ptr<AST> &GetStart(){return start;};
+        std::unique_ptr<AST> &GetEnd(){return end;};
+        std::unique_ptr<AST> &GetStep(){return step;};
+        std::unique_ptr<AST> &GetBody(){return body;};
+
+        void PrintNode(int depth);
+        llvm::Value* codegen();
+        static bool classof(const AST *node){return node->GetKind() == AST_FOR;};
 };
 
 class WhileExpressionAST: public AST{
@@ -258,10 +409,14 @@ class WhileExpressionAST: public AST{
     public:
         WhileExpressionAST(std::unique_ptr<AST> cond,
                            std::unique_ptr<AST> body)
-            :cond(std::move(cond)), body(std::move(body)){}
+            : AST(AST_WHILE), cond(std::move(cond)), body(std::move(body)){}
 
-        void PrintNode(int depth) override;
-        llvm::Value* codegen() override;
+        std::unique_ptr<AST> &GetCond(){return cond;};
+        std::unique_ptr<AST> &GetBody(){return body;};
+
+        void PrintNode(int depth);
+        llvm::Value* codegen();
+        static bool classof(const AST *node){return node->GetKind() == AST_WHILE;};
 };
 
 // Functions, Prototypes, and Procedures
@@ -271,33 +426,45 @@ class PrototypeAST: public DeclarationAST{
         std::string name;
         std::vector<TypeNamePair> Args;
         LexicalTokenType returnType;
+        // Set once codegen has made the function, back to null if it gets erased
+        llvm::WeakVH function;
 
     public:
         PrototypeAST(const std::string &name, std::vector<TypeNamePair> Args, LexicalTokenType returnType)
-            : name(name), Args(std::move(Args)){ this->returnType = returnType; };
+            : DeclarationAST(AST_PROTOTYPE), name(name), Args(std::move(Args)){ this->returnType = returnType; };
 
         const std::string &GetName() const {return name;}
+        const std::vector<TypeNamePair> &GetArgs() const {return Args;}
         const LexicalTokenType GetReturnType() const {return returnType;}
+        llvm::Function *GetFunction() const {return llvm::cast_or_null<llvm::Function>(function);}
+        void SetFunction(llvm::Function *function){ this->function = function; }
 
-        void PrintNode(int depth) override;
-        llvm::Value* codegen() override;
-        std::vector<llvm::AllocaInst*> DoAllocations() override {return{};};
+        void PrintNode(int depth);
+        llvm::Value* codegen();
+        void DoAllocations() {};
+        static bool classof(const AST *node){return node->GetKind() == AST_PROTOTYPE;};
 };
 
 class FunctionAST: public DeclarationAST {
     private:
         std::unique_ptr<AST> prototype;
         std::unique_ptr<AST> body;
+        // Parameters get consecutive slots starting here, the result variable the one after
+        uint32_t firstSlot = 0;
     
     public:
         FunctionAST(std::unique_ptr<AST> prototype, std::unique_ptr<AST> body)
-            : prototype(std::move(prototype)), body(std::move(body)){};
+            : DeclarationAST(AST_FUNCTION), prototype(std::move(prototype)), body(std::move(body)){};
+
+        PrototypeAST *GetPrototype(){return llvm::cast<PrototypeAST>(prototype.get());};
+        std::unique_ptr<AST> &GetBody(){return body;};
+        uint32_t GetFirstSlot() const {return firstSlot;};
+        void SetFirstSlot(uint32_t slot){ firstSlot = slot; };
 
-        void PrintNode(int depth) override;
-        llvm::Value* codegen() override { return nullptr; };
-        std::vector<llvm::AllocaInst*> DoAllocations() override;
+        void PrintNode(int depth);
+        llvm::Value* codegen() { return nullptr; };
+        void DoAllocations();
+        static bool classof(const AST *node){return node->GetKind() == AST_FUNCTION;};
 };
 
 #endif
-
-
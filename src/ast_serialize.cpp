@@ -0,0 +1,475 @@
+#include "ast_serialize.h"
+#include "ast_visitor.h"
+
+#include <limits.h>
+
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Support/EndianStream.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/LEB128.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Support/xxhash.h"
+
+using namespace llvm;
+
+static const char ASTFileMagic[4] = {'P', 'A', 'S', 'T'};
+static const uint8_t AST_FILE_NULL_NODE = 0xFF;
+
+// Deeper than any tree the parser makes from a real program, so a corrupted
+// file can't run the reader (or the passes after it) out of stack. Trees
+// deeper than this aren't written either, the reader would only reject them.
+static const unsigned MaxASTFileDepth = 1000;
+
+uint64_t HashSource(StringRef source){
+    return xxHash64(source);
+}
+
+/************************/
+/*        Writing       */
+/************************/
+
+class ASTWriter: public ASTVisitor<ASTWriter>{
+    private:
+        raw_ostream &out;
+        StringMap<uint32_t> stringIds;
+        unsigned depth = 0;
+
+    public:
+        std::vector<StringRef> strings;
+        bool tooDeep = false;
+
+        ASTWriter(raw_ostream &out): out(out){};
+
+        void WriteU(uint64_t value){ encodeULEB128(value, out); }
+        void WriteS(int64_t value){ encodeSLEB128(value, out); }
+        void WriteString(StringRef str){
+            auto inserted = stringIds.insert({str, (uint32_t) strings.size()});
+            if(inserted.second)
+                strings.push_back(inserted.first->getKey());
+            WriteU(inserted.first->getValue());
+        }
+        void WriteNode(AST *node){
+            if(!node){
+                out << (char) AST_FILE_NULL_NODE;
+                return;
+            }
+            if(tooDeep || ++depth > MaxASTFileDepth){
+                tooDeep = true;
+                return;
+            }
+            out << (char) node->GetKind();
+            WriteU(node->GetOffset());
+            WriteU(node->GetLength());
+            Visit(node);
+            depth--;
+        }
+        void WriteNodes(std::vector<std::unique_ptr<AST>> &nodes){
+            WriteU(nodes.size());
+            for(auto &node : nodes)
+                WriteNode(node.get());
+        }
+
+        void VisitMainBlockAST(MainBlockAST *node){
+            WriteNodes(node->GetDeclarations());
+            WriteNode(node->GetStatementSequence().get());
+        }
+        void VisitProgramAST(ProgramAST *node){
+            WriteString(node->GetName());
+            WriteNodes(node->GetDeclarations());
+            WriteNode(node->GetStatementSequence().get());
+        }
+        void VisitStatementSequenceAST(StatementSequenceAST *node){
+            WriteNodes(node->GetStatements());
+        }
+        void VisitNumberAST(NumberAST *node){
+            WriteS(node->GetValue());
+        }
+        void VisitVariableIdentifierAST(VariableIdentifierAST *node){
+            WriteString(node->GetName());
+        }
+        void VisitUnaryOpAST(UnaryOpAST *node){
+            WriteU(node->GetOp());
+            WriteNode(node->GetExpression().get());
+        }
+        void VisitBinaryOpAST(BinaryOpAST *node){
+            WriteU(node->GetOp());
+            WriteNode(node->GetLHS().get());
+            WriteNode(node->GetRHS().get());
+        }
+        void VisitComparisonOpAST(ComparisonOpAST *node){
+            WriteU(node->GetOp());
+            WriteNode(node->GetLHS().get());
+            WriteNode(node->GetRHS().get());
+        }
+        void VisitExitBreakStatementAST(ExitBreakStatementAST *node){
+            WriteU(node->GetExitOrBreak());
+        }
+        void VisitCallExpessionsAst(CallExpessionsAst *node){
+            WriteString(node->GetCallee());
+            WriteNodes(node->GetArgs());
+        }
+        void VisitIfExpressionAST(IfExpressionAST *node){
+            WriteNode(node->GetCond().get());
+            WriteNode(node->GetThen().get());
+            WriteNode(node->GetElse().get());
+        }
+        void VisitForExpressionAST(ForExpressionAST *node){
+            WriteString(node->GetLoopVarName());
+            WriteU(node->GetDirection());
+            WriteNode(node->GetStart().get());
+            WriteNode(node->GetEnd().get());
+            WriteNode(node->GetStep().get());
+            WriteNode(node->GetBody().get());
+        }
+        void VisitWhileExpressionAST(WhileExpressionAST *node){
+            WriteNode(node->GetCond().get());
+            WriteNode(node->GetBody().get());
+        }
+        void VisitVariableDeclarationsOfTypeAST(VariableDeclarationsOfTypeAST *node){
+            WriteU(node->GetType());
+            WriteU(node->GetIdentifiers().size());
+            for(auto &ident : node->GetIdentifiers()){
+                WriteString(ident->GetName());
+                WriteU(ident->GetOffset());
+                WriteU(ident->GetLength());
+            }
+        }
+        void VisitVariableDeclarationsAST(VariableDeclarationsAST *node){
+            WriteNodes(node->GetDeclarations());
+        }
+        void VisitConstantDeclarationsAST(ConstantDeclarationsAST *node){
+            WriteU(node->GetConstants().size());
+            for(auto &constant : node->GetConstants()){
+                WriteString(constant.name);
+                WriteS(constant.value);
+            }
+        }
+        void VisitPrototypeAST(PrototypeAST *node){
+            WriteString(node->GetName());
+            WriteU(node->GetArgs().size());
+            for(auto &arg : node->GetArgs()){
+                WriteString(arg.name);
+                WriteU(arg.type);
+            }
+            WriteU(node->GetReturnType());
+        }
+        void VisitFunctionAST(FunctionAST *node){
+            WriteNode(node->GetPrototype());
+            WriteNode(node->GetBody().get());
+        }
+};
+
+bool WriteASTFile(AST *tree, uint64_t sourceHash, const std::string &fileName){
+    std::string nodeStream;
+    raw_string_ostream nodeOut(nodeStream);
+    ASTWriter writer(nodeOut);
+    writer.WriteNode(tree);
+    nodeOut.flush();
+    if(writer.tooDeep)
+        return true;
+
+    std::error_code error_code;
+    raw_fd_ostream out(fileName, error_code, sys::fs::OF_None);
+    if(error_code){
+        printf("Could not open %s: %s\n", fileName.c_str(), error_code.message().c_str());
+        return false;
+    }
+
+    support::endian::Writer header(out, support::little);
+    out.write(ASTFileMagic, sizeof(ASTFileMagic));
+    header.write<uint32_t>(AST_FILE_VERSION);
+    header.write<uint64_t>(sourceHash);
+    header.write<uint32_t>(writer.strings.size());
+    for(auto str : writer.strings){
+        encodeULEB128(str.size(), out);
+        out << str;
+    }
+    out << nodeStream;
+    return !out.has_error();
+}
+
+/************************/
+/*        Reading       */
+/************************/
+
+class ASTReader{
+    private:
+        const uint8_t *cur;
+        const uint8_t *end;
+        std::vector<StringRef> strings;
+        unsigned depth = 0;
+
+        // A statement or expression, null only where the parser leaves one out
+        std::unique_ptr<AST> ReadChild(bool required){
+            auto node = ReadNode();
+            if(node ? isa<DeclarationAST>(node.get()) || isa<ProgramAST>(node.get()) ||
+                      isa<MainBlockAST>(node.get())
+                    : required)
+                failed = true;
+            return node;
+        }
+        std::vector<std::unique_ptr<AST>> ReadChildren(){
+            auto nodes = ReadNodes();
+            for(auto &node : nodes){
+                if(!node || isa<DeclarationAST>(node.get()) || isa<ProgramAST>(node.get()) ||
+                   isa<MainBlockAST>(node.get()))
+                    failed = true;
+            }
+            return nodes;
+        }
+        std::vector<std::unique_ptr<AST>> ReadDeclarations(){
+            auto nodes = ReadNodes();
+            for(auto &node : nodes){
+                if(!node || !isa<DeclarationAST>(node.get()))
+                    failed = true;
+            }
+            return nodes;
+        }
+
+    public:
+        bool failed = false;
+
+        ASTReader(const uint8_t *start, const uint8_t *end): cur(start), end(end){};
+
+        uint64_t ReadU(){
+            unsigned length;
+            const char *error = nullptr;
+            uint64_t value = decodeULEB128(cur, &length, end, &error);
+            if(error){ failed = true; return 0; }
+            cur += length;
+            return value;
+        }
+        int64_t ReadS(){
+            unsigned length;
+            const char *error = nullptr;
+            int64_t value = decodeSLEB128(cur, &length, end, &error);
+            if(error){ failed = true; return 0; }
+            cur += length;
+            return value;
+        }
+        // Source offsets and lengths
+        uint32_t ReadU32(){
+            uint64_t value = ReadU();
+            if(value > UINT32_MAX){ failed = true; return 0; }
+            return value;
+        }
+        // NumberAST and constant values
+        int ReadInt(){
+            int64_t value = ReadS();
+            if(value < INT_MIN || value > INT_MAX){ failed = true; return 0; }
+            return value;
+        }
+        template<typename T> T ReadFixed(){
+            if(end - cur < (ptrdiff_t) sizeof(T)){ failed = true; return 0; }
+            T value = support::endian::read<T, support::little, support::unaligned>(cur);
+            cur += sizeof(T);
+            return value;
+        }
+        LexicalTokenType ReadToken(){
+            uint64_t token = ReadU();
+            if(token > ERR){ failed = true; return ERR; }
+            return (LexicalTokenType) token;
+        }
+        std::string ReadString(){
+            uint64_t id = ReadU();
+            if(id >= strings.size()){ failed = true; return ""; }
+            return strings[id].str();
+        }
+
+        bool ReadHeader(uint64_t expectedSourceHash){
+            if(end - cur < (ptrdiff_t) sizeof(ASTFileMagic) ||
+               memcmp(cur, ASTFileMagic, sizeof(ASTFileMagic)) != 0)
+                return false;
+            cur += sizeof(ASTFileMagic);
+            if(ReadFixed<uint32_t>() != AST_FILE_VERSION)
+                return false;
+            uint64_t sourceHash = ReadFixed<uint64_t>();
+            if(expectedSourceHash && sourceHash != expectedSourceHash)
+                return false;
+            uint32_t stringCount = ReadFixed<uint32_t>();
+            for(uint32_t i = 0; i<stringCount && !failed; i++){
+                uint64_t length = ReadU();
+                if((uint64_t)(end - cur) < length){ failed = true; break; }
+                strings.push_back(StringRef((const char*) cur, length));
+                cur += length;
+            }
+            return !failed;
+        }
+
+        std::vector<std::unique_ptr<AST>> ReadNodes(){
+            std::vector<std::unique_ptr<AST>> nodes;
+            uint64_t count = ReadU();
+            for(uint64_t i = 0; i<count && !failed; i++)
+                nodes.push_back(ReadNode());
+            return nodes;
+        }
+
+        std::unique_ptr<AST> ReadNode(){
+            if(failed || cur >= end){ failed = true; return nullptr; }
+            uint8_t kind = *cur++;
+            if(kind == AST_FILE_NULL_NODE)
+                return nullptr;
+
+            if(++depth > MaxASTFileDepth){
+                failed = true;
+                return nullptr;
+            }
+            uint32_t offset = ReadU32();
+            uint32_t length = ReadU32();
+            auto node = ReadNodeFields((ASTKind) kind);
+            depth--;
+            if(node)
+                node->SetLocation(offset, length);
+            return node;
+        }
+
+        std::unique_ptr<AST> ReadNodeFields(ASTKind kind){
+            switch(kind){
+                case AST_MAIN_BLOCK:
+                    {
+                        auto declarations = ReadDeclarations();
+                        auto statements = ReadChild(true);
+                        return std::make_unique<MainBlockAST>(std::move(declarations), std::move(statements));
+                    }
+                case AST_PROGRAM:
+                    {
+                        auto name = ReadString();
+                        auto declarations = ReadDeclarations();
+                        auto statements = ReadChild(true);
+                        return std::make_unique<ProgramAST>(name, std::move(declarations), std::move(statements));
+                    }
+                case AST_STATEMENT_SEQUENCE:
+                    return std::make_unique<StatementSequenceAST>(ReadChildren());
+                case AST_NUMBER:
+                    return std::make_unique<NumberAST>(ReadInt());
+                case AST_VARIABLE_IDENTIFIER:
+                    return std::make_unique<VariableIdentifierAST>(ReadString());
+                case AST_UNARY_OP:
+                    {
+                        auto op = ReadToken();
+                        return std::make_unique<UnaryOpAST>(op, ReadChild(true));
+                    }
+                case AST_BINARY_OP:
+                    {
+                        auto op = ReadToken();
+                        auto LHS = ReadChild(true);
+                        auto RHS = ReadChild(true);
+                        return std::make_unique<BinaryOpAST>(op, std::move(LHS), std::move(RHS));
+                    }
+                case AST_COMPARISON_OP:
+                    {
+                        auto op = ReadToken();
+                        auto LHS = ReadChild(true);
+                        auto RHS = ReadChild(true);
+                        return std::make_unique<ComparisonOpAST>(op, std::move(LHS), std::move(RHS));
+                    }
+                case AST_EXIT_BREAK:
+                    return std::make_unique<ExitBreakStatementAST>(ReadToken());
+                case AST_CALL:
+                    {
+                        auto callee = ReadString();
+                        return std::make_unique<CallExpessionsAst>(callee, ReadChildren());
+                    }
+                case AST_IF:
+                    {
+                        auto cond = ReadChild(true);
+                        auto thenPart = ReadChild(true);
+                        auto elsePart = ReadChild(false);
+                        return std::make_unique<IfExpressionAST>(std::move(cond), std::move(thenPart), std::move(elsePart));
+                    }
+                case AST_FOR:
+                    {
+                        auto name = ReadString();
+                        auto direction = ReadToken();
+                        auto start = ReadChild(true);
+                        auto end = ReadChild(true);
+                        auto step = ReadChild(false);
+                        auto body = ReadChild(true);
+                        return std::make_unique<ForExpressionAST>(name, direction, std::move(start), std::move(end), std::move(step), std::move(body));
+                    }
+                case AST_WHILE:
+                    {
+                        auto cond = ReadChild(true);
+                        auto body = ReadChild(true);
+                        return std::make_unique<WhileExpressionAST>(std::move(cond), std::move(body));
+                    }
+                case AST_VARIABLE_DECLARATIONS_OF_TYPE:
+                    {
+                        auto type = ReadToken();
+                        std::vector<std::unique_ptr<VariableIdentifierAST>> identifiers;
+                        uint64_t count = ReadU();
+                        for(uint64_t i = 0; i<count && !failed; i++){
+                            identifiers.push_back(std::make_unique<VariableIdentifierAST>(ReadString()));
+                            uint32_t offset = ReadU32();
+                            identifiers.back()->SetLocation(offset, ReadU32());
+                        }
+                        return std::make_unique<VariableDeclarationsOfTypeAST>(std::move(identifiers), type);
+                    }
+                case AST_VARIABLE_DECLARATIONS:
+                    {
+                        auto declarations = ReadNodes();
+                        for(auto &decl : declarations){
+                            if(!decl || !isa<VariableDeclarationsOfTypeAST>(decl.get()))
+                                failed = true;
+                        }
+                        return std::make_unique<VariableDeclarationsAST>(std::move(declarations));
+                    }
+                case AST_CONSTANT_DECLARATIONS:
+                    {
+                        std::vector<ValueNamePair> constants;
+                        uint64_t count = ReadU();
+                        for(uint64_t i = 0; i<count && !failed; i++){
+                            auto name = ReadString();
+                            int value = ReadInt();
+                            constants.push_back({value, name});
+                        }
+                        return std::make_unique<ConstantDeclarationsAST>(std::move(constants));
+                    }
+                case AST_PROTOTYPE:
+                    {
+                        auto name = ReadString();
+                        std::vector<TypeNamePair> args;
+                        uint64_t count = ReadU();
+                        for(uint64_t i = 0; i<count && !failed; i++){
+                            auto argName = ReadString();
+                            args.push_back({ReadToken(), argName});
+                        }
+                        return std::make_unique<PrototypeAST>(name, std::move(args), ReadToken());
+                    }
+                case AST_FUNCTION:
+                    {
+                        auto prototype = ReadNode();
+                        if(!prototype || !isa<PrototypeAST>(prototype.get())){
+                            failed = true;
+                            return nullptr;
+                        }
+                        auto body = ReadNode();
+                        if(!body || !isa<MainBlockAST>(body.get()))
+                            failed = true;
+                        return std::make_unique<FunctionAST>(std::move(prototype), std::move(body));
+                    }
+            }
+            failed = true;
+            return nullptr;
+        }
+};
+
+std::unique_ptr<AST> ReadASTFile(const std::string &fileName, uint64_t expectedSourceHash){
+    // MemoryBuffer maps the file when it is big enough to be worth it
+    auto buffer = MemoryBuffer::getFile(fileName, /*IsText*/ false, /*RequiresNullTerminator*/ false);
+    if(!buffer)
+        return nullptr;
+
+    auto start = (const uint8_t*) (*buffer)->getBufferStart();
+    ASTReader reader(start, start + (*buffer)->getBufferSize());
+    if(!reader.ReadHeader(expectedSourceHash))
+        return nullptr;
+
+    auto tree = reader.ReadNode();
+    if(reader.failed || !tree || !isa<ProgramAST>(tree.get())){
+        printf("Malformed AST file %s\n", fileName.c_str());
+        return nullptr;
+    }
+    return tree;
+}
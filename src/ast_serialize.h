@@ -0,0 +1,47 @@
+#ifndef AST_SERIALIZE_H
+#define AST_SERIALIZE_H
+
+#include <memory>
+#include <string>
+#include <stdint.h>
+
+#include "llvm/ADT/StringRef.h"
+
+#include "ast.h"
+
+/*
+ * Binary AST files
+ *
+ * Layout (all fixed width fields are little endian):
+ *
+ *  magic           4 bytes "PAST"
+ *  version         uint32
+ *  source hash     uint64 xxHash64 of the source text the tree came from
+ *  string count    uint32
+ *  strings         ULEB128 length followed by the bytes, once per interned string
+ *  nodes           pre-order, each node is its kind, source offset and length
+ *                  followed by its fields
+ *
+ * Names are written as indexes into the string table, numbers and enums as
+ * (S)LEB128, lists as a count followed by the entries and optional children
+ * as AST_FILE_NULL_NODE when missing. The file is memory mapped when loading
+ * and the string table is read in place, so loading is just one pass over the
+ * node stream without any lexing or parsing.
+ */
+
+#define AST_FILE_VERSION 5
+
+uint64_t HashSource(llvm::StringRef source);
+
+// Returns false and prints an error if the file can't be written. A tree
+// nested deeper than ReadASTFile accepts isn't written at all.
+bool WriteASTFile(AST *tree, uint64_t sourceHash, const std::string &fileName);
+
+// Returns nullptr if the file is missing, from another version, was made from
+// different source (when expectedSourceHash isn't 0), or is malformed: cut
+// short, nested deeper than any parsed program, not a program at the root,
+// missing a child (or holding one of the wrong kind) the parser always makes,
+// or holding a number or source location too big for the tree
+std::unique_ptr<AST> ReadASTFile(const std::string &fileName, uint64_t expectedSourceHash);
+
+#endif
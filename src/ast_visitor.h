@@ -0,0 +1,114 @@
+#ifndef AST_VISITOR_H
+#define AST_VISITOR_H
+
+#include "llvm/Support/ErrorHandling.h"
+
+#include "ast.h"
+
+/*
+ * Base for passes over the AST. Derive from it using CRTP and only define
+ * the Visit functions you care about:
+ *
+ *  class CountNumbers: public ASTVisitor<CountNumbers, int>{
+ *      public:
+ *          int VisitNumberAST(NumberAST *node){ return 1; }
+ *  };
+ *
+ * Visit() switches on the node kind and calls the matching Visit<Class>
+ * directly, so there are no virtual calls or RTTI involved. Anything not
+ * handled falls through to VisitDeclarationAST (for declarations) and then
+ * VisitAST, which returns a default constructed RetTy. Extra arguments
+ * (like a print depth) are passed along to every Visit function.
+ */
+template<typename Derived, typename RetTy = void, typename... ArgTys>
+class ASTVisitor{
+    public:
+        RetTy Visit(AST *node, ArgTys... args){
+            switch(node->GetKind()){
+#define AST_NODE(KIND, CLASS) \
+                case AST_##KIND: \
+                    return static_cast<Derived*>(this)->Visit##CLASS(llvm::cast<CLASS>(node), args...);
+#include "ast_nodes.def"
+            }
+            llvm_unreachable("Unknown AST kind");
+        }
+
+        // Defaults, override these in the derived pass
+#define AST_NODE(KIND, CLASS) \
+        RetTy Visit##CLASS(CLASS *node, ArgTys... args){ \
+            return static_cast<Derived*>(this)->VisitAST(node, args...); \
+        }
+#define DECL_NODE(KIND, CLASS) \
+        RetTy Visit##CLASS(CLASS *node, ArgTys... args){ \
+            return static_cast<Derived*>(this)->VisitDeclarationAST(node, args...); \
+        }
+#include "ast_nodes.def"
+
+        RetTy VisitDeclarationAST(DeclarationAST *node, ArgTys... args){
+            return static_cast<Derived*>(this)->VisitAST(node, args...);
+        }
+        RetTy VisitAST(AST *node, ArgTys... args){ return RetTy(); }
+};
+
+// Calls fn on every direct child of node that's there, in source order
+template<typename Fn>
+void ForEachChild(AST *node, Fn fn){
+    auto each = [&](std::unique_ptr<AST> &child){ if(child) fn(child.get()); };
+    switch(node->GetKind()){
+        case AST_MAIN_BLOCK:
+            for(auto &decl : llvm::cast<MainBlockAST>(node)->GetDeclarations()) each(decl);
+            each(llvm::cast<MainBlockAST>(node)->GetStatementSequence());
+            break;
+        case AST_PROGRAM:
+            for(auto &decl : llvm::cast<ProgramAST>(node)->GetDeclarations()) each(decl);
+            each(llvm::cast<ProgramAST>(node)->GetStatementSequence());
+            break;
+        case AST_STATEMENT_SEQUENCE:
+            for(auto &statement : llvm::cast<StatementSequenceAST>(node)->GetStatements()) each(statement);
+            break;
+        case AST_UNARY_OP:
+            each(llvm::cast<UnaryOpAST>(node)->GetExpression());
+            break;
+        case AST_BINARY_OP:
+            each(llvm::cast<BinaryOpAST>(node)->GetLHS());
+            each(llvm::cast<BinaryOpAST>(node)->GetRHS());
+            break;
+        case AST_COMPARISON_OP:
+            each(llvm::cast<ComparisonOpAST>(node)->GetLHS());
+            each(llvm::cast<ComparisonOpAST>(node)->GetRHS());
+            break;
+        case AST_CALL:
+            for(auto &arg : llvm::cast<CallExpessionsAst>(node)->GetArgs()) each(arg);
+            break;
+        case AST_IF:
+            each(llvm::cast<IfExpressionAST>(node)->GetCond());
+            each(llvm::cast<IfExpressionAST>(node)->GetThen());
+            each(llvm::cast<IfExpressionAST>(node)->GetElse());
+            break;
+        case AST_FOR:
+            each(llvm::cast<ForExpressionAST>(node)->GetStart());
+            each(llvm::cast<ForExpressionAST>(node)->GetEnd());
+            each(llvm::cast<ForExpressionAST>(node)->GetStep());
+            each(llvm::cast<ForExpressionAST>(node)->GetBody());
+            break;
+        case AST_WHILE:
+            each(llvm::cast<WhileExpressionAST>(node)->GetCond());
+            each(llvm::cast<WhileExpressionAST>(node)->GetBody());
+            break;
+        case AST_VARIABLE_DECLARATIONS_OF_TYPE:
+            for(auto &ident : llvm::cast<VariableDeclarationsOfTypeAST>(node)->GetIdentifiers())
+                if(ident) fn(ident.get());
+            break;
+        case AST_VARIABLE_DECLARATIONS:
+            for(auto &decl : llvm::cast<VariableDeclarationsAST>(node)->GetDeclarations()) each(decl);
+            break;
+        case AST_FUNCTION:
+            fn(llvm::cast<FunctionAST>(node)->GetPrototype());
+            each(llvm::cast<FunctionAST>(node)->GetBody());
+            break;
+        default:
+            break;
+    }
+}
+
+#endif
@@ -0,0 +1,211 @@
+#include "backend.h"
+
+#include <stdio.h>
+
+#include "llvm/ADT/StringSwitch.h"
+#include "llvm/Analysis/CGSCCPassManager.h"
+#include "llvm/Analysis/LoopAnalysisManager.h"
+#include "llvm/IR/LegacyPassManager.h"
+#include "llvm/IR/PassManager.h"
+#include "llvm/IR/Verifier.h"
+#include "llvm/MC/MCSubtargetInfo.h"
+#include "llvm/MC/TargetRegistry.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/FileUtilities.h"
+#include "llvm/Support/Host.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/Program.h"
+#include "llvm/Support/TargetSelect.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace llvm;
+
+bool ParseOptimizationLevel(const char *flag, OptimizationLevel &level){
+    const OptimizationLevel *found = StringSwitch<const OptimizationLevel*>(flag)
+        .Case("-O0", &OptimizationLevel::O0)
+        .Case("-O1", &OptimizationLevel::O1)
+        .Case("-O2", &OptimizationLevel::O2)
+        .Case("-O3", &OptimizationLevel::O3)
+        .Case("-Os", &OptimizationLevel::Os)
+        .Case("-Oz", &OptimizationLevel::Oz)
+        .Default(nullptr);
+    if(!found)
+        return false;
+    level = *found;
+    return true;
+}
+
+/************************/
+/*        Target        */
+/************************/
+
+static void AddFeatures(std::string &features, StringRef more){
+    if(more.empty())
+        return;
+    if(!features.empty())
+        features += ",";
+    features += more.str();
+}
+
+static void SelectCPU(TargetSelection &target, StringRef cpu){
+    if(cpu != "native"){
+        target.cpu = cpu.str();
+        return;
+    }
+    target.cpu = sys::getHostCPUName().str();
+    StringMap<bool> hostFeatures;
+    if(!sys::getHostCPUFeatures(hostFeatures))
+        return;
+    for(auto &feature : hostFeatures)
+        AddFeatures(target.features, (feature.second ? "+" : "-") + feature.first().str());
+}
+
+bool ParseTargetFlag(const char *flag, TargetSelection &target){
+    StringRef argument(flag);
+    if(argument.consume_front("-march=") || argument.consume_front("-mcpu="))
+        SelectCPU(target, argument);
+    else if(argument.consume_front("-mattr="))
+        AddFeatures(target.features, argument);
+    else
+        return false;
+    return true;
+}
+
+// -Os and -Oz optimize the IR for size but still want the default code generator
+CodeGenOpt::Level CodeGenLevel(OptimizationLevel level){
+    switch(level.getSpeedupLevel()){
+        case 0: return CodeGenOpt::None;
+        case 1: return CodeGenOpt::Less;
+        case 3: return CodeGenOpt::Aggressive;
+        default: return CodeGenOpt::Default;
+    }
+}
+
+std::unique_ptr<TargetMachine> CreateTargetMachine(Module &module, OptimizationLevel level,
+                                                   const TargetSelection &selection){
+    InitializeNativeTarget();
+    InitializeNativeTargetAsmPrinter();
+    // Inline assembly (the cpuid checks --multiversion emits) goes through the assembler
+    InitializeNativeTargetAsmParser();
+
+    std::string triple = sys::getDefaultTargetTriple();
+    std::string error;
+    const Target *target = TargetRegistry::lookupTarget(triple, error);
+    if(!target){
+        printf("Could not set up the target %s: %s\n", triple.c_str(), error.c_str());
+        return nullptr;
+    }
+
+    // LLVM only warns about a CPU it doesn't know and falls back to the baseline
+    std::string cpu = selection.cpu.empty() ? "generic" : selection.cpu;
+    std::unique_ptr<MCSubtargetInfo> baseline(target->createMCSubtargetInfo(triple, "", ""));
+    if(!baseline || !baseline->isCPUStringValid(cpu)){
+        printf("Unknown CPU %s for %s\n", cpu.c_str(), triple.c_str());
+        return nullptr;
+    }
+
+    // Position independent, as the system linker makes PIE executables by default
+    TargetOptions options;
+    std::unique_ptr<TargetMachine> machine(target->createTargetMachine(triple, cpu, selection.features, options,
+                                                                       Reloc::PIC_, None, CodeGenLevel(level)));
+    if(!machine){
+        printf("Could not create a target machine for %s\n", triple.c_str());
+        return nullptr;
+    }
+
+    module.setTargetTriple(triple);
+    module.setDataLayout(machine->createDataLayout());
+    return machine;
+}
+
+/************************/
+/*     Optimization     */
+/************************/
+
+bool OptimizeModule(Module &module, TargetMachine &machine, OptimizationLevel level){
+    if(verifyModule(module, &errs())){
+        printf("Generated code is broken, not optimizing it\n");
+        return false;
+    }
+
+    LoopAnalysisManager loopAnalyses;
+    FunctionAnalysisManager functionAnalyses;
+    CGSCCAnalysisManager sccAnalyses;
+    ModuleAnalysisManager moduleAnalyses;
+
+    // Handing it the target machine registers TargetIRAnalysis, so the
+    // inliner, unroller and vectorizers use the host's costs
+    PassBuilder builder(&machine);
+    builder.registerModuleAnalyses(moduleAnalyses);
+    builder.registerCGSCCAnalyses(sccAnalyses);
+    builder.registerFunctionAnalyses(functionAnalyses);
+    builder.registerLoopAnalyses(loopAnalyses);
+    builder.crossRegisterProxies(loopAnalyses, functionAnalyses, sccAnalyses, moduleAnalyses);
+
+    ModulePassManager passes = level == OptimizationLevel::O0 ?
+        builder.buildO0DefaultPipeline(level) : builder.buildPerModuleDefaultPipeline(level);
+    passes.run(module, moduleAnalyses);
+    return true;
+}
+
+/************************/
+/*       Emission       */
+/************************/
+
+bool EmitObjectFile(Module &module, TargetMachine &machine, StringRef path){
+    std::error_code error;
+    raw_fd_ostream dest(path, error, sys::fs::OF_None);
+    if(error){
+        printf("Could not open %s: %s\n", path.str().c_str(), error.message().c_str());
+        return false;
+    }
+
+    // Code generation still only exists for the legacy pass manager
+    legacy::PassManager passes;
+    if(machine.addPassesToEmitFile(passes, dest, nullptr, CGFT_ObjectFile)){
+        printf("The target can't emit object files\n");
+        return false;
+    }
+    passes.run(module);
+    dest.flush();
+    return true;
+}
+
+// libpascal_runtime.a next to the compiler, where it was built otherwise
+static std::string RuntimeLibrary(){
+    SmallString<128> path(sys::path::parent_path(sys::fs::getMainExecutable(nullptr, (void*) &RuntimeLibrary)));
+    sys::path::append(path, "libpascal_runtime.a");
+    return sys::fs::exists(path) ? path.str().str() : PASCAL_RUNTIME_LIBRARY;
+}
+
+bool EmitExecutable(Module &module, TargetMachine &machine, StringRef path){
+    SmallString<128> object;
+    std::error_code error = sys::fs::createTemporaryFile("pascal", "o", object);
+    if(error){
+        printf("Could not create a temporary object file: %s\n", error.message().c_str());
+        return false;
+    }
+    FileRemover removeObject(object);
+    if(!EmitObjectFile(module, machine, object))
+        return false;
+
+    // The driver knows where crt1.o and libc are, ld on its own doesn't
+    auto driver = sys::findProgramByName("cc");
+    if(!driver)
+        driver = sys::findProgramByName("gcc");
+    if(!driver){
+        printf("Could not find cc or gcc to link with\n");
+        return false;
+    }
+
+    std::string runtime = RuntimeLibrary();
+    StringRef args[] = {*driver, object, runtime, "-o", path};
+    std::string message;
+    int result = sys::ExecuteAndWait(*driver, args, None, {}, 0, 0, &message);
+    if(result != 0){
+        printf("Linking %s failed%s%s\n", path.str().c_str(), message.empty() ? "" : ": ", message.c_str());
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,55 @@
+#ifndef BACKEND_H
+#define BACKEND_H
+
+#include <memory>
+#include <string>
+
+#include "llvm/IR/Module.h"
+#include "llvm/Passes/OptimizationLevel.h"
+#include "llvm/Target/TargetMachine.h"
+
+/*
+ * Everything after codegen that happens in process: setting up the target
+ * machine for the host, running LLVM's standard optimization pipelines (the
+ * new pass manager's, the same ones opt -O2 etc. use) over the module, and
+ * emitting the object file. Only linking runs another program, the system's
+ * cc driver, once per executable.
+ */
+
+// Parses -O0, -O1, -O2, -O3, -Os and -Oz, returns false for anything else
+bool ParseOptimizationLevel(const char *flag, llvm::OptimizationLevel &level);
+
+// What -march, -mcpu and -mattr asked for. An empty cpu is LLVM's generic
+// baseline for the host's architecture, features are "+avx2,-sse4a" style.
+struct TargetSelection{
+    std::string cpu;
+    std::string features;
+};
+
+// Parses -march=<cpu>, -mcpu=<cpu> and -mattr=<features> into target,
+// returns false for anything else. native (for either cpu flag) is the
+// host's CPU together with every feature it has.
+bool ParseTargetFlag(const char *flag, TargetSelection &target);
+
+// The code generator's level for an optimization level
+llvm::CodeGenOpt::Level CodeGenLevel(llvm::OptimizationLevel level);
+
+// A TargetMachine for the host's triple and the selected CPU, nullptr (after
+// printing why) if LLVM can't generate code for it or doesn't know the CPU.
+// Also gives the module its triple and data layout.
+std::unique_ptr<llvm::TargetMachine> CreateTargetMachine(llvm::Module &module, llvm::OptimizationLevel level,
+                                                         const TargetSelection &target);
+
+// Runs the default pipeline for level, with the target's cost models. Returns
+// false (after printing why) if the module doesn't verify, it's left untouched then.
+bool OptimizeModule(llvm::Module &module, llvm::TargetMachine &machine, llvm::OptimizationLevel level);
+
+// Writes the module's machine code to an object file at path. Returns false
+// (after printing why) if it couldn't.
+bool EmitObjectFile(llvm::Module &module, llvm::TargetMachine &machine, llvm::StringRef path);
+
+// Emits the module to a temporary object file and links it, with the runtime
+// library (see runtime.h) and the C library, into an executable at path
+bool EmitExecutable(llvm::Module &module, llvm::TargetMachine &machine, llvm::StringRef path);
+
+#endif
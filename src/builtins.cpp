@@ -0,0 +1,16 @@
+#include "builtins.h"
+
+#include "llvm/ADT/StringSwitch.h"
+
+const BuiltinInfo builtinInfo[BUILTIN_COUNT] = {
+    {"", 0},
+#define BUILTIN(KIND, NAME, ARITY, LOWERING) {NAME, ARITY},
+#include "builtins.def"
+};
+
+BuiltinID LookupBuiltin(llvm::StringRef name){
+    return llvm::StringSwitch<BuiltinID>(name)
+#define BUILTIN(KIND, NAME, ARITY, LOWERING) .Case(NAME, BUILTIN_##KIND)
+#include "builtins.def"
+        .Default(BUILTIN_NONE);
+}
@@ -0,0 +1,28 @@
+#ifndef BUILTINS_H
+#define BUILTINS_H
+
+#include <stdint.h>
+
+#include "llvm/ADT/StringRef.h"
+
+// Builtin procedures, see builtins.def. Calls are bound to one of these (or
+// to a user declaration) by ResolveNames, codegen dispatches on the ID.
+enum BuiltinID: uint8_t{
+    BUILTIN_NONE,
+#define BUILTIN(KIND, NAME, ARITY, LOWERING) BUILTIN_##KIND,
+#include "builtins.def"
+    BUILTIN_COUNT
+};
+
+struct BuiltinInfo{
+    const char *name;
+    unsigned arity;
+};
+
+// Indexed by BuiltinID
+extern const BuiltinInfo builtinInfo[BUILTIN_COUNT];
+
+// BUILTIN_NONE if name isn't a builtin
+BuiltinID LookupBuiltin(llvm::StringRef name);
+
+#endif
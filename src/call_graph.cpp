@@ -0,0 +1,107 @@
+#include "call_graph.h"
+#include "ast_visitor.h"
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/StringMap.h"
+
+#include <algorithm>
+
+using namespace llvm;
+
+static void CollectDefinitionsInto(std::vector<std::unique_ptr<AST>> &declarations, DefinitionMap &definitions){
+    StringMap<PrototypeAST*> forwards;
+    for(auto &decl : declarations){
+        if(auto proto = dyn_cast<PrototypeAST>(decl.get())){
+            forwards[proto->GetName()] = proto;
+        }
+        else if(auto function = dyn_cast<FunctionAST>(decl.get())){
+            definitions[function->GetPrototype()] = function;
+            auto forward = forwards.find(function->GetPrototype()->GetName());
+            if(forward != forwards.end())
+                definitions[forward->second] = function;
+            if(auto block = dyn_cast_or_null<MainBlockAST>(function->GetBody().get()))
+                CollectDefinitionsInto(block->GetDeclarations(), definitions);
+        }
+    }
+}
+
+DefinitionMap CollectDefinitions(std::vector<std::unique_ptr<AST>> &declarations){
+    DefinitionMap definitions;
+    CollectDefinitionsInto(declarations, definitions);
+    return definitions;
+}
+
+namespace{
+
+class CallGraph{
+    private:
+        DefinitionMap definitions;
+        std::vector<FunctionAST*> functions;
+        std::vector<FunctionAST*> worklist;
+
+        void Reach(PrototypeAST *proto){
+            proto->SetReachable(true);
+            auto definition = definitions.find(proto);
+            if(definition == definitions.end() || definition->second->IsReachable())
+                return;
+            definition->second->SetReachable(true);
+            worklist.push_back(definition->second);
+        }
+
+        // Calls in node, not counting ones inside nested declarations
+        void FollowCalls(AST *node){
+            if(auto call = dyn_cast<CallExpessionsAst>(node)){
+                if(call->GetDeclaration())
+                    Reach(call->GetDeclaration());
+            }
+            if(auto block = dyn_cast<MainBlockAST>(node)){
+                if(block->GetStatementSequence())
+                    FollowCalls(block->GetStatementSequence().get());
+                return;
+            }
+            ForEachChild(node, [&](AST *child){ FollowCalls(child); });
+        }
+
+        // Starts out with every procedure unreachable
+        void Unmark(std::vector<std::unique_ptr<AST>> &declarations){
+            for(auto &decl : declarations){
+                if(auto proto = dyn_cast<PrototypeAST>(decl.get())){
+                    proto->SetReachable(false);
+                }
+                else if(auto function = dyn_cast<FunctionAST>(decl.get())){
+                    function->SetReachable(false);
+                    functions.push_back(function);
+                    if(auto block = dyn_cast_or_null<MainBlockAST>(function->GetBody().get()))
+                        Unmark(block->GetDeclarations());
+                }
+            }
+        }
+
+    public:
+        CallGraph(std::vector<std::unique_ptr<AST>> &declarations): definitions(CollectDefinitions(declarations)){
+            Unmark(declarations);
+        }
+
+        unsigned Run(AST *root){
+            FollowCalls(root);
+            while(!worklist.empty()){
+                auto function = worklist.back();
+                worklist.pop_back();
+                if(function->GetBody())
+                    FollowCalls(function->GetBody().get());
+            }
+            return std::count_if(functions.begin(), functions.end(),
+                    [](FunctionAST *function){ return !function->IsReachable(); });
+        }
+};
+
+}
+
+unsigned MarkReachableProcedures(AST *tree){
+    auto program = dyn_cast<ProgramAST>(tree);
+    if(!program || !program->GetStatementSequence())
+        return 0;
+    CallGraph graph(program->GetDeclarations());
+    // Only the main statement sequence runs, the declarations are just followed from it
+    return graph.Run(program->GetStatementSequence().get());
+}
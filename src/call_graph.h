@@ -0,0 +1,27 @@
+#ifndef CALL_GRAPH_H
+#define CALL_GRAPH_H
+
+#include "llvm/ADT/DenseMap.h"
+
+#include "ast.h"
+
+/*
+ * Dead procedure elimination
+ *
+ * Runs after ResolveNames (which binds every call to the PrototypeAST it
+ * calls). Starting from the main statement sequence, follows calls into the
+ * procedures and functions they reach, and from their bodies into the ones
+ * those call, and so on. A call to a forward declaration reaches the body
+ * declared later. Every procedure, function and forward declaration that
+ * isn't reached is marked unreachable and codegen leaves it out.
+ *
+ * Returns how many procedures and functions were found unreachable.
+ */
+unsigned MarkReachableProcedures(AST *tree);
+
+// The FunctionAST holding the body of every prototype a call can be bound to,
+// which is each function's own prototype and any forward declaration of it
+typedef llvm::DenseMap<PrototypeAST*, FunctionAST*> DefinitionMap;
+DefinitionMap CollectDefinitions(std::vector<std::unique_ptr<AST>> &declarations);
+
+#endif
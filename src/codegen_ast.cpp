@@ -20,34 +20,74 @@
  *  inc()
  */
 #include "ast.h"
+#include "arithmetic.h"
+#include "source_location.h"
 
 #include "llvm/ADT/APSInt.h"
 #include "llvm/ADT/APFloat.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/DenseSet.h"
 #include "llvm/ADT/STLExtras.h"
 #include "llvm/IR/BasicBlock.h"
+#include "llvm/IR/CFG.h"
 #include "llvm/IR/Constants.h"
 #include "llvm/IR/DerivedTypes.h"
 #include "llvm/IR/Function.h"
+#include "llvm/IR/GlobalVariable.h"
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/LLVMContext.h"
 #include "llvm/IR/Module.h"
 #include "llvm/IR/Type.h"
 #include "llvm/IR/Verifier.h"
 #include "llvm/IR/Value.h"
+#include "llvm/IR/ValueHandle.h"
+
+#include <unordered_map>
 
 using namespace llvm;
 
-static llvm::LLVMContext theContext;
-static llvm::IRBuilder<> builder(theContext);
+// Made on first use, so runs that stop before codegen (--syntax-only) never set up LLVM.
+// Owned here until ProgramAST::codegen hands it over along with the module.
+static std::unique_ptr<llvm::LLVMContext> &ContextOwner(){
+    static std::unique_ptr<llvm::LLVMContext> context = std::make_unique<llvm::LLVMContext>();
+    return context;
+}
+
+static llvm::LLVMContext &GetContext(){
+    static llvm::LLVMContext &context = *ContextOwner();
+    return context;
+}
+
+static llvm::IRBuilder<> &GetBuilder(){
+    static llvm::IRBuilder<> builder(GetContext());
+    return builder;
+}
+
 static std::unique_ptr<llvm::Module> theModule;
-static std::map<std::string, AllocaInst*> namedValues;
-static std::vector<std::string> globalConstants;
+// Address of each slot given out by ResolveNames (see name_resolution.h), an
+// alloca or, for program level variables, a global
+static std::vector<Value*> slotValues;
+// Constants aren't stored anywhere, uses that FoldConstants didn't replace
+// (or every use if it didn't run) get the value as an immediate
+static DenseMap<uint32_t, int> constantValues;
+
+static void BindSlot(uint32_t slot, Value *address){
+    if(!slot)
+        return;
+    if(slot >= slotValues.size())
+        slotValues.resize(slot + 1);
+    slotValues[slot] = address;
+}
+
+static Value *SlotValue(uint32_t slot){
+    return slot && slot < slotValues.size() ? slotValues[slot] : nullptr;
+}
 
 static AllocaInst *CreateEntryBlockAlloca(Function *theFunction,
         const std::string &VarName){
     IRBuilder<> TmpB(&theFunction->getEntryBlock(),
             theFunction->getEntryBlock().begin());
-    return TmpB.CreateAlloca(Type::getInt64Ty(theContext), 0, VarName.c_str());
+    return TmpB.CreateAlloca(Type::getInt64Ty(GetContext()), 0, VarName.c_str());
 }
 
 //This is a really shitty way to do this.
@@ -58,74 +98,352 @@ static bool hasBrokeFromFunctionInBlock;
 static BasicBlock* lastLoopEndBlock;
 static bool hasBrokeFromLoopInBlock;
 
+// Values of numbered expressions (see expression_table.h) already emitted in
+// valueCacheBlock. Moving to another block, assigning or calling anything
+// (which may store to a variable) empties it.
+static BasicBlock* valueCacheBlock;
+static std::unordered_map<uint32_t, Value*> valueCache;
+
+// target-cpu and target-features for every function, so the optimizer's cost
+// models and the code generator agree on what the function may use
+static std::string targetCPU;
+static std::string targetFeatures;
+
+void SetTargetAttributes(const std::string &cpu, const std::string &features){
+    targetCPU = cpu;
+    targetFeatures = features;
+}
+
+static void StampTarget(Function *F){
+    if(!targetCPU.empty())
+        F->addFnAttr("target-cpu", targetCPU);
+    if(!targetFeatures.empty())
+        F->addFnAttr("target-features", targetFeatures);
+}
+
+/************************/
+/*   Variable storage   */
+/************************/
+
+// By default every variable of a procedure or function (and main's loop
+// counters) lives in an entry block alloca and each use is a load or store,
+// which mem2reg cleans up later. Program level variables are globals (see
+// DefineGlobals). With SetSSACodegen(true) the values of the rest are
+// tracked per block instead and phis are placed while generating,
+// following Braun et al., "Simple and Efficient Construction of Static Single
+// Assignment Form" (CC 2013). A block is sealed once all of its predecessors
+// have branched to it, reads in blocks that aren't sealed yet get a phi whose
+// operands are filled in when it is.
+static bool buildSSA = false;
+
+void SetSSACodegen(bool enabled){
+    buildSSA = enabled;
+}
+
+// The name of each slot declared in SSA mode, used for its phis
+static DenseMap<uint32_t, std::string> ssaSlotNames;
+// The value each slot has at the end of a block, as far as generated. Tracking
+// handles follow phis that turn out trivial and are replaced.
+static DenseMap<std::pair<BasicBlock*, uint32_t>, WeakTrackingVH> currentDef;
+static DenseSet<BasicBlock*> sealedBlocks;
+static DenseMap<BasicBlock*, std::vector<std::pair<uint32_t, PHINode*>>> incompletePhis;
+// Phis whose operands are being read right now, reading them can make a phi
+// they use trivial, and removing that mustn't look at the half built ones
+static DenseSet<PHINode*> phisBeingFilled;
+
+static Value *ReadVariable(uint32_t slot, BasicBlock *block);
+
+static void WriteVariable(uint32_t slot, BasicBlock *block, Value *value){
+    currentDef[{block, slot}] = value;
+}
+
+static PHINode *CreatePhi(uint32_t slot, BasicBlock *block){
+    IRBuilder<> builder(block, block->getFirstInsertionPt());
+    return builder.CreatePHI(Type::getInt64Ty(GetContext()), 0, ssaSlotNames.lookup(slot));
+}
+
+// A phi whose operands are all the same value (or itself) is that value
+static Value *TryRemoveTrivialPhi(PHINode *phi){
+    // Operands of phis in unsealed blocks aren't all there yet
+    if(!sealedBlocks.count(phi->getParent()) || phisBeingFilled.count(phi))
+        return phi;
+    Value *same = nullptr;
+    for(Value *operand : phi->incoming_values()){
+        if(operand == same || operand == phi)
+            continue;
+        if(same)
+            return phi;
+        same = operand;
+    }
+    // Unreachable, or only reads itself around a loop
+    if(!same)
+        same = UndefValue::get(phi->getType());
+
+    SmallVector<WeakVH, 8> users;
+    for(User *user : phi->users()){
+        if(user != phi && isa<PHINode>(user))
+            users.push_back(user);
+    }
+    phi->replaceAllUsesWith(same);
+    phi->eraseFromParent();
+    valueCache.clear();
+    // Removing it may have made the phis using it trivial too, same among
+    // them, so follow it to whatever replaces it
+    WeakTrackingVH replacement(same);
+    for(auto &user : users){
+        if(auto userPhi = dyn_cast_or_null<PHINode>(user))
+            TryRemoveTrivialPhi(userPhi);
+    }
+    return replacement;
+}
+
+static void AddPhiOperands(uint32_t slot, PHINode *phi){
+    phisBeingFilled.insert(phi);
+    for(BasicBlock *pred : predecessors(phi->getParent()))
+        phi->addIncoming(ReadVariable(slot, pred), pred);
+    phisBeingFilled.erase(phi);
+}
+
+static Value *ReadVariableRecursive(uint32_t slot, BasicBlock *block){
+    Value *value;
+    if(!sealedBlocks.count(block)){
+        PHINode *phi = CreatePhi(slot, block);
+        incompletePhis[block].push_back({slot, phi});
+        value = phi;
+    }
+    else if(BasicBlock *pred = block->getSinglePredecessor()){
+        value = ReadVariable(slot, pred);
+    }
+    else if(pred_empty(block)){
+        // Nothing assigned it on the way here (or nothing jumps here at all)
+        value = UndefValue::get(Type::getInt64Ty(GetContext()));
+    }
+    else{
+        // Recorded before the operands are read so loops find it and stop
+        PHINode *phi = CreatePhi(slot, block);
+        WriteVariable(slot, block, phi);
+        AddPhiOperands(slot, phi);
+        value = TryRemoveTrivialPhi(phi);
+    }
+    WriteVariable(slot, block, value);
+    return value;
+}
+
+static Value *ReadVariable(uint32_t slot, BasicBlock *block){
+    auto found = currentDef.find({block, slot});
+    if(found != currentDef.end() && found->second)
+        return found->second;
+    return ReadVariableRecursive(slot, block);
+}
+
+// Called once every branch into block has been generated
+static void SealBlock(BasicBlock *block){
+    if(!buildSSA)
+        return;
+    // Filling in operands can read more variables in block, which still get
+    // incomplete phis until it's marked sealed, so go until there are none left
+    SmallVector<WeakVH, 8> completed;
+    while(true){
+        auto pending = incompletePhis.find(block);
+        if(pending == incompletePhis.end())
+            break;
+        auto phis = std::move(pending->second);
+        incompletePhis.erase(pending);
+        for(auto &incomplete : phis){
+            AddPhiOperands(incomplete.first, incomplete.second);
+            completed.push_back(incomplete.second);
+        }
+    }
+    sealedBlocks.insert(block);
+    for(auto &phi : completed){
+        if(auto complete = dyn_cast_or_null<PHINode>(phi))
+            TryRemoveTrivialPhi(complete);
+    }
+}
+
+// Before a function that failed to generate is erased, so its blocks' addresses
+// can be reused without picking up their state
+static void ForgetBlocks(Function *function){
+    for(BasicBlock &block : *function){
+        sealedBlocks.erase(&block);
+        incompletePhis.erase(&block);
+    }
+    for(auto it = currentDef.begin(); it != currentDef.end(); ++it){
+        if(it->first.first->getParent() == function)
+            currentDef.erase(it);
+    }
+}
+
+// A new variable (or parameter, result or loop counter) starting out as initial
+static void DefineSlot(uint32_t slot, const std::string &name, Value *initial){
+    if(buildSSA){
+        if(!slot)
+            return;
+        ssaSlotNames[slot] = name;
+        WriteVariable(slot, GetBuilder().GetInsertBlock(), initial);
+        return;
+    }
+    AllocaInst *alloca = CreateEntryBlockAlloca(GetBuilder().GetInsertBlock()->getParent(), name);
+    GetBuilder().CreateStore(initial, alloca);
+    BindSlot(slot, alloca);
+}
+
+// Program level variables are internal globals, zero initialized so they go
+// in .bss. main and every procedure load and store them directly, in SSA mode
+// too, since no one function's phis can track them.
+static void DefineGlobals(VariableDeclarationsAST *variables){
+    for(auto &decl : variables->GetDeclarations()){
+        for(auto &identifier : cast<VariableDeclarationsOfTypeAST>(decl.get())->GetIdentifiers()){
+            if(!identifier->GetSlot())
+                continue;
+            Type *int64 = Type::getInt64Ty(GetContext());
+            auto global = new GlobalVariable(*theModule, int64, false, GlobalValue::InternalLinkage,
+                                             Constant::getNullValue(int64), identifier->GetName());
+            BindSlot(identifier->GetSlot(), global);
+        }
+    }
+}
+
+// Only globals have an address in SSA mode
+static bool IsDefined(uint32_t slot){
+    return SlotValue(slot) != nullptr || (buildSSA && ssaSlotNames.count(slot));
+}
+
+// The slot's current value, nullptr if it was never defined
+static Value *ReadSlot(uint32_t slot, const std::string &name){
+    Value *address = SlotValue(slot);
+    if(buildSSA && !address)
+        return IsDefined(slot) ? ReadVariable(slot, GetBuilder().GetInsertBlock()) : nullptr;
+    if(!address)
+        return nullptr;
+    return GetBuilder().CreateLoad(Type::getInt64Ty(GetContext()), address, name.c_str());
+}
+
+static void WriteSlot(uint32_t slot, Value *value){
+    Value *address = SlotValue(slot);
+    if(buildSSA && !address)
+        WriteVariable(slot, GetBuilder().GetInsertBlock(), value);
+    else
+        GetBuilder().CreateStore(value, address);
+}
+
+
 Value* LogErrorV(const char *str){
     fprintf(stderr, "Error: %s\n", str);
     return nullptr;
 }
 
+// "file:line:col: " for the start of the node, resolved only when an error is printed
+static std::string Where(AST *node){
+    auto loc = DescribeLocation(node->GetOffset());
+    return loc.empty() ? loc : loc + ": ";
+}
+
+
+static Value* CodegenNode(AST *node){
+    switch(node->GetKind()){
+#define AST_NODE(KIND, CLASS) \
+        case AST_##KIND: return cast<CLASS>(node)->codegen();
+#include "ast_nodes.def"
+    }
+    llvm_unreachable("Unknown AST kind");
+}
+
+Value* AST::codegen(){
+    if(!valueNumber){
+        Value *value = CodegenNode(this);
+        auto binary = dyn_cast<BinaryOpAST>(this);
+        if(isa<CallExpessionsAst>(this) || (binary && binary->GetOp() == ASSIGN))
+            valueCache.clear();
+        return value;
+    }
+
+    auto block = GetBuilder().GetInsertBlock();
+    if(block != valueCacheBlock){
+        valueCache.clear();
+        valueCacheBlock = block;
+    }
+    auto cached = valueCache.find(valueNumber);
+    if(cached != valueCache.end())
+        return cached->second;
+
+    Value *value = CodegenNode(this);
+    if(value && GetBuilder().GetInsertBlock() == valueCacheBlock)
+        valueCache[valueNumber] = value;
+    return value;
+}
+
+void DeclarationAST::DoAllocations(){
+    switch(GetKind()){
+#define DECL_NODE(KIND, CLASS) \
+        case AST_##KIND: return cast<CLASS>(this)->DoAllocations();
+#include "ast_nodes.def"
+        default: llvm_unreachable("Not a declaration");
+    }
+}
 
 Value* MainBlockAST::codegen(){
     //Remember I want to call the DoAllocations on the declarations not code gen. will need to cast
-    std::vector<AllocaInst *> OldBindings;
     for(int i = 0; i<declarations.size(); i++){
-        auto decl = dynamic_cast<DeclarationAST*>(declarations[i].get());
+        auto decl = dyn_cast<DeclarationAST>(declarations[i].get());
         if(!decl){
             printf("DeclarationAST cast failed");
             return nullptr;
         }
-        if(PrototypeAST *proto = dynamic_cast<PrototypeAST*>(decl)){
+        if(!decl->IsReachable())
+            continue;
+        if(PrototypeAST *proto = dyn_cast<PrototypeAST>(decl)){
             proto->codegen();
         }
         else{
-            auto oldBind = decl->DoAllocations();
-            OldBindings.insert(OldBindings.end(), oldBind.begin(), oldBind.end());
+            decl->DoAllocations();
         }
     }
    
-    Value* BodyVal = statementSequence->codegen();
-    if(!BodyVal)
-        return nullptr;
-
-    for(int i = 0; i<OldBindings.size();i++){
-        //This won't work cuz it allows for vars to be accessed from an already deleted scope
-        if(OldBindings[i])
-            namedValues[OldBindings[i]->getName()] = OldBindings[i];
-    }
-
-    return BodyVal;
+    return statementSequence->codegen();
 }
 
 Value* ProgramAST::codegen(){
-    theModule = llvm::make_unique<Module>(programName, theContext);
+    theModule = std::make_unique<Module>(programName, GetContext());
 
-    FunctionType *FT = FunctionType::get(Type::getVoidTy(theContext), false);
+    FunctionType *FT = FunctionType::get(Type::getVoidTy(GetContext()), false);
     Function *F = Function::Create(FT, Function::ExternalLinkage, "main", theModule.get());
-    BasicBlock *BB = BasicBlock::Create(theContext, "entry", F);
-    builder.SetInsertPoint(BB);
+    StampTarget(F);
+    BasicBlock *BB = BasicBlock::Create(GetContext(), "entry", F);
+    GetBuilder().SetInsertPoint(BB);
+    SealBlock(BB);
 
     for(int i = 0; i<declarations.size(); i++){
-        auto decl = dynamic_cast<DeclarationAST*>(declarations[i].get());
+        auto decl = dyn_cast<DeclarationAST>(declarations[i].get());
         if(!decl){
             printf("DeclarationAST cast failed");
             return nullptr;
         }
-        if(PrototypeAST *proto = dynamic_cast<PrototypeAST*>(decl)){
+        if(!decl->IsReachable())
+            continue;
+        if(PrototypeAST *proto = dyn_cast<PrototypeAST>(decl)){
             proto->codegen();
         }
+        else if(auto variables = dyn_cast<VariableDeclarationsAST>(decl)){
+            DefineGlobals(variables);
+        }
         else{
-            auto oldBind = decl->DoAllocations();
+            decl->DoAllocations();
         }
-        builder.SetInsertPoint(BB);
+        GetBuilder().SetInsertPoint(BB);
     }
     Value* BodyVal = statementSequence->codegen();
+    // The handles in it can't outlive the context
+    currentDef.clear();
     if(!BodyVal)
         return nullptr;
 
-    builder.CreateRetVoid();
+    GetBuilder().CreateRetVoid();
     verifyFunction(*F);
 
     theModule->print(errs(), nullptr);
     llvmModule = std::move(theModule);
+    llvmContext = std::move(ContextOwner());
     return BodyVal;
 }
 
@@ -135,67 +453,144 @@ Value* StatementSequenceAST::codegen(){
             statements[i]->codegen();
         }
     }
-    return Constant::getNullValue(Type::getInt64Ty(theContext));
+    return Constant::getNullValue(Type::getInt64Ty(GetContext()));
 }
 
 Value* NumberAST::codegen(){
-    return ConstantInt::get(theContext, APInt(64, value));
+    return ConstantInt::get(GetContext(), APInt(64, value));
 }
 
 Value* VariableIdentifierAST::codegen(){
-    Value* v = namedValues[name];
+    auto constant = constantValues.find(slot);
+    if(constant != constantValues.end())
+        return ConstantInt::get(GetContext(), APInt(64, constant->second));
+
+    Value *v = ReadSlot(slot, name);
     if(!v){
-        printf("Unknown variable name %s\n", name.c_str());
+        printf("%sUnknown variable name %s\n", Where(this).c_str(), name.c_str());
         return nullptr;
     }
-
-    return builder.CreateLoad(v, name.c_str());
+    return v;
 }
 
 Value* UnaryOpAST::codegen(){
-    return expression->codegen();
+    Value *value = expression->codegen();
+    if(!value || !SignedArithmetic())
+        return value;
+    return GetBuilder().CreateNSWNeg(value, "negtmp");
 }
 
 // So I think what I should do instead is create a variable with the same name as the function
 // So assignment still works, and everything. then when returning, we just return what is currently
 // assigned to that variable and remove the variable from the named values list.
 
+// left and right, or left or right, of booleans:
+//
+//   entry:    br left, andrhs, andend    (or: br left, andend, andrhs)
+//   andrhs:   br andend
+//   andend:   phi [left's value, entry], [right, andrhs]
+static Value *LowerShortCircuit(BinaryOpAST *node){
+    bool isAnd = node->GetOp() == AND;
+    Value *L = node->GetLHS()->codegen();
+    if(!L)
+        return nullptr;
+
+    Function *theFunction = GetBuilder().GetInsertBlock()->getParent();
+    BasicBlock *leftBB = GetBuilder().GetInsertBlock();
+    BasicBlock *rightBB = BasicBlock::Create(GetContext(), isAnd ? "andrhs" : "orrhs", theFunction);
+    BasicBlock *mergeBB = BasicBlock::Create(GetContext(), isAnd ? "andend" : "orend", theFunction);
+    if(isAnd)
+        GetBuilder().CreateCondBr(L, rightBB, mergeBB);
+    else
+        GetBuilder().CreateCondBr(L, mergeBB, rightBB);
+
+    GetBuilder().SetInsertPoint(rightBB);
+    SealBlock(rightBB);
+    Value *R = node->GetRHS()->codegen();
+    if(!R)
+        return nullptr;
+    rightBB = GetBuilder().GetInsertBlock();
+    GetBuilder().CreateBr(mergeBB);
+
+    GetBuilder().SetInsertPoint(mergeBB);
+    SealBlock(mergeBB);
+    PHINode *result = GetBuilder().CreatePHI(Type::getInt1Ty(GetContext()), 2, isAnd ? "andtmp" : "ortmp");
+    result->addIncoming(ConstantInt::get(Type::getInt1Ty(GetContext()), !isAnd), leftBB);
+    result->addIncoming(R, rightBB);
+    return result;
+}
+
+// What if and while branch on, integers are true when they aren't 0
+static Value *CodegenCondition(AST *cond, const char *name){
+    Value *value = cond->codegen();
+    if(!value || value->getType()->isIntegerTy(1))
+        return value;
+    return GetBuilder().CreateICmpNE(value, Constant::getNullValue(value->getType()), name);
+}
+
+// x * c div d with d dividing c leaves no remainder, the division is exact
+static bool IsExactDivision(AST *LHS, AST *RHS){
+    auto divisor = dyn_cast<NumberAST>(RHS);
+    auto product = dyn_cast<BinaryOpAST>(LHS);
+    if(!divisor || divisor->GetValue() == 0 || !product || product->GetOp() != TIMES)
+        return false;
+    for(AST *factor : {product->GetLHS().get(), product->GetRHS().get()}){
+        auto number = dyn_cast_or_null<NumberAST>(factor);
+        if(number && (int64_t) number->GetValue() % divisor->GetValue() == 0)
+            return true;
+    }
+    return false;
+}
+
 Value* BinaryOpAST::codegen(){
+    // CheckTypes made sure nothing else mixes booleans and integers
+    if((op == AND || op == OR) && IsBoolean(this))
+        return LowerShortCircuit(this);
+
     Value* L = LHS->codegen();
     Value* R = RHS->codegen();
     if(!L || !R)
         return nullptr;
 
+    // Signed overflow is the program's error (see arithmetic.h), so it's nsw
+    bool isSigned = SignedArithmetic();
     switch(op){
-        case PLUS: return builder.CreateAdd(L, R, "addtmp");
-        case MINUS: return builder.CreateSub(L, R, "subtmp");
-        case TIMES: return builder.CreateMul(L, R, "multmp");
-        case DIV: return builder.CreateUDiv(L, R, "divtmp");
-        case AND: return builder.CreateAnd(L, R, "andtmp");
-        case OR: return builder.CreateOr(L, R, "ortmp");                   
-        case MOD: return builder.CreateURem(L, R, "modtmp");
+        case PLUS: return GetBuilder().CreateAdd(L, R, "addtmp", false, isSigned);
+        case MINUS: return GetBuilder().CreateSub(L, R, "subtmp", false, isSigned);
+        case TIMES: return GetBuilder().CreateMul(L, R, "multmp", false, isSigned);
+        case DIV:
+            if(!isSigned)
+                return GetBuilder().CreateUDiv(L, R, "divtmp");
+            return GetBuilder().CreateSDiv(L, R, "divtmp", IsExactDivision(LHS.get(), RHS.get()));
+        case AND: return GetBuilder().CreateAnd(L, R, "andtmp");
+        case OR: return GetBuilder().CreateOr(L, R, "ortmp");                   
+        case MOD: return isSigned ? GetBuilder().CreateSRem(L, R, "modtmp") : GetBuilder().CreateURem(L, R, "modtmp");
         case ASSIGN:
             {
                 printf("ASSIGNMENT\n");
-                VariableIdentifierAST *LHSE = dynamic_cast<VariableIdentifierAST*>(LHS.get());
+                VariableIdentifierAST *LHSE = dyn_cast<VariableIdentifierAST>(LHS.get());
                 if(!LHSE)
-                    return LogErrorV("left hand side of assignment must be a varaible");
-                if(std::find(globalConstants.begin(), globalConstants.end(), LHSE->GetName()) !=globalConstants.end())
-                    return LogErrorV("Cannot assign to a constant!");
+                    return LogErrorV((Where(this) + "left hand side of assignment must be a varaible").c_str());
+                if(constantValues.count(LHSE->GetSlot()))
+                    return LogErrorV((Where(this) + "Cannot assign to a constant!").c_str());
                 
-                Value *Variable = namedValues[LHSE->GetName()];
-                if(!Variable){
-                    printf("Unknown variable name %s\n", LHSE->GetName().c_str()); 
+                if(!IsDefined(LHSE->GetSlot())){
+                    printf("%sUnknown variable name %s\n", Where(LHSE).c_str(), LHSE->GetName().c_str()); 
                     return nullptr;
                 }
 
-                builder.CreateStore(R, Variable);
+                WriteSlot(LHSE->GetSlot(), R);
                 return R;
             }
         default:{printf("Invalid operator %s\n", lexicalTokenNames[op]); return nullptr; } 
     }
 }
 
+// An unsigned predicate, or its signed twin when integers are signed
+static CmpInst::Predicate Predicate(CmpInst::Predicate unsignedPredicate){
+    return SignedArithmetic() ? ICmpInst::getSignedPredicate(unsignedPredicate) : unsignedPredicate;
+}
+
 Value* ComparisonOpAST::codegen(){
     Value* L = LHS->codegen();
     Value* R = RHS->codegen();
@@ -205,172 +600,166 @@ Value* ComparisonOpAST::codegen(){
     switch(op){    
             //L = Builder.CreateFCmpULT(L, R, "cmptmp");
             //return Builder.CreateUIToFP(L, Type::getDoubleTy(TheContext), "booltmp");
-        case LESSTHAN: return builder.CreateICmpULT(L, R, "cmptmp");
-        case LESSTHANEQ: return builder.CreateICmpULE(L, R, "cmptmp");
-        case GREATERTHAN: return builder.CreateICmpUGT(L, R, "cmptmp");
-        case GREATERTHANEQ: return builder.CreateICmpUGE(L, R, "cmptmp");
-        case NOTEQUAL: return builder.CreateICmpNE(L, R, "cmptmp");
-        case EQUAL: return builder.CreateICmpEQ(L, R, "cmptmp");
+        case LESSTHAN: return GetBuilder().CreateICmp(Predicate(ICmpInst::ICMP_ULT), L, R, "cmptmp");
+        case LESSTHANEQ: return GetBuilder().CreateICmp(Predicate(ICmpInst::ICMP_ULE), L, R, "cmptmp");
+        case GREATERTHAN: return GetBuilder().CreateICmp(Predicate(ICmpInst::ICMP_UGT), L, R, "cmptmp");
+        case GREATERTHANEQ: return GetBuilder().CreateICmp(Predicate(ICmpInst::ICMP_UGE), L, R, "cmptmp");
+        case NOTEQUAL: return GetBuilder().CreateICmpNE(L, R, "cmptmp");
+        case EQUAL: return GetBuilder().CreateICmpEQ(L, R, "cmptmp");
         default:{printf("Invalid comparison operator %s\n", lexicalTokenNames[op]); return nullptr; } 
     }
 }
 
 Value* ExitBreakStatementAST::codegen(){
     if(exitOrBreak == KW_EXIT){
-        builder.CreateBr(lastFunctionReturnBlock);
+        GetBuilder().CreateBr(lastFunctionReturnBlock);
         hasBrokeFromFunctionInBlock = true;
-        return Constant::getNullValue(Type::getInt64Ty(theContext));
+        return Constant::getNullValue(Type::getInt64Ty(GetContext()));
     }
     else{
-        builder.CreateBr(lastLoopEndBlock);
+        GetBuilder().CreateBr(lastLoopEndBlock);
         hasBrokeFromLoopInBlock = true;
-        return Constant::getNullValue(Type::getInt64Ty(theContext));
+        return Constant::getNullValue(Type::getInt64Ty(GetContext()));
     }
 }
 
-std::vector<AllocaInst*> VariableDeclarationsOfTypeAST::DoAllocations(){
-    std::vector<AllocaInst *> OldBindings;
+void VariableDeclarationsOfTypeAST::DoAllocations(){
+    for(int i = 0; i<this->identifiers.size(); i++){
+        Value *InitVal = ConstantInt::get(GetContext(), APSInt(64, 0));
+        DefineSlot(identifiers[i]->GetSlot(), identifiers[i]->GetName(), InitVal);
+    }
+}
 
-    Function *TheFunction = builder.GetInsertBlock()->getParent();
+void VariableDeclarationsAST::DoAllocations(){
+    for(auto &Decl : this->declarations)
+        cast<DeclarationAST>(Decl.get())->DoAllocations();
+}
 
-    for(int i = 0; i<this->identifiers.size(); i++){
-        const std::string &VarName = identifiers[i]->GetName();
-        Value *InitVal = ConstantInt::get(theContext, APSInt(64, 0));
+void ConstantDeclarationsAST::DoAllocations(){
+    uint32_t slot = firstSlot;
+    for(auto Decl : this->constants){
+        if(slot)
+            constantValues[slot++] = Decl.value;
+    }
+}
 
-        AllocaInst *Alloca = CreateEntryBlockAlloca(TheFunction, VarName);
-        builder.CreateStore(InitVal, Alloca);
+/************************/
+/*       Builtins       */
+/************************/
 
-        OldBindings.push_back(namedValues[VarName]);
+// The runtime library's functions, see runtime.h
+static FunctionCallee GetRuntimeFunction(const char *name, Type *result, ArrayRef<Type*> params){
+    return theModule->getOrInsertFunction(name, FunctionType::get(result, params, false));
+}
 
-        namedValues[VarName] = Alloca;
-    }
-    return OldBindings;
+static Value *LowerWriteln(CallExpessionsAst *call){
+    Value *value = call->GetArgs()[0]->codegen();
+    if(!value)
+        return nullptr;
+    Type *int64 = Type::getInt64Ty(GetContext());
+    auto writeln = GetRuntimeFunction("pascal_writeln", Type::getVoidTy(GetContext()), {int64});
+    // Comparisons are i1, they print as 0 or 1
+    return GetBuilder().CreateCall(writeln, {GetBuilder().CreateIntCast(value, int64, false)});
 }
 
-std::vector<AllocaInst *> VariableDeclarationsAST::DoAllocations(){
-    std::vector<AllocaInst *> OldBindings;
-    for(auto &Decl : this->declarations){
-        auto old = dynamic_cast<DeclarationAST*>(Decl.get())->DoAllocations();
-        OldBindings.insert(OldBindings.end(), old.begin(), old.end());
+static Value *LowerReadln(CallExpessionsAst *call){
+    auto arg = dyn_cast<VariableIdentifierAST>(call->GetArgs()[0].get());
+    if(!arg){
+        printf("%sImproper call to readln. Expected identifier\n", Where(call).c_str());
+        return nullptr;
     }
-    return OldBindings;
+    if(constantValues.count(arg->GetSlot()))
+        return LogErrorV((Where(arg) + "Cannot assign to a constant!").c_str());
+    if(!IsDefined(arg->GetSlot())){
+        printf("%sUnknown variable name %s\n", Where(arg).c_str(), arg->GetName().c_str());
+        return nullptr;
+    }
+
+    // The variable keeps its value when there's no number to read
+    Type *int64 = Type::getInt64Ty(GetContext());
+    auto readln = GetRuntimeFunction("pascal_readln", int64, {int64});
+    Value *current = ReadSlot(arg->GetSlot(), arg->GetName());
+    Value *value = GetBuilder().CreateCall(readln, {current}, "readtmp");
+    WriteSlot(arg->GetSlot(), value);
+    return value;
 }
 
-std::vector<AllocaInst *> ConstantDeclarationsAST::DoAllocations(){
-    std::vector<AllocaInst *> OldBindings;
-    Function *TheFunction = builder.GetInsertBlock()->getParent();
-    for(auto Decl : this->constants){
-        globalConstants.push_back(Decl.name);
-        auto InitVal = ConstantInt::get(theContext, APInt(64, Decl.value));
-        
-        AllocaInst *Alloca = CreateEntryBlockAlloca(TheFunction, Decl.name);
-        builder.CreateStore(InitVal, Alloca);
-        OldBindings.push_back(namedValues[Decl.name]);
-        namedValues[Decl.name] = Alloca;
+static Value *LowerIncDec(CallExpessionsAst *call){
+    auto var = dyn_cast<VariableIdentifierAST>(call->GetArgs()[0].get());
+    if(!var)
+        return LogErrorV((Where(call) + "DEC must be called with a variable identifier").c_str());
+    if(constantValues.count(var->GetSlot()))
+        return LogErrorV((Where(var) + "Cannot assign to a constant!").c_str());
+    
+    if(!IsDefined(var->GetSlot())){
+        printf("%sUnknown variable name %s\n", Where(var).c_str(), var->GetName().c_str()); 
+        return nullptr;
     }
-    return OldBindings;
+    Value* StepVal;
+    if(call->GetBuiltin() == BUILTIN_DEC) StepVal = ConstantInt::get(GetContext(), APInt(64, -1));
+    else StepVal = ConstantInt::get(GetContext(), APInt(64, 1));
+    
+    Value *CurVar = ReadSlot(var->GetSlot(), var->GetName());
+    Value *NextVar = GetBuilder().CreateAdd(CurVar, StepVal, "nextvar", false, SignedArithmetic());
+    WriteSlot(var->GetSlot(), NextVar);
+    return NextVar;
 }
 
+// Indexed by BuiltinID, see builtins.def
+static Value *(*const builtinLowerings[BUILTIN_COUNT])(CallExpessionsAst*) = {
+    nullptr,
+#define BUILTIN(KIND, NAME, ARITY, LOWERING) LOWERING,
+#include "builtins.def"
+};
+
 Value* CallExpessionsAst::codegen(){
-    Function* CalleeF;
-
-    if(Callee == "writeln"){
-        auto constFunc = theModule->getOrInsertFunction("printf", FunctionType::get(IntegerType::getInt32Ty(theContext), PointerType::get(Type::getInt8Ty(theContext), 0), true /* this is var arg func type*/));
-        CalleeF = static_cast<Function*>(constFunc);
-    }
-    else if(Callee == "readln"){
-        auto constFunc = theModule->getOrInsertFunction("__isoc99_scanf", FunctionType::get(IntegerType::getInt32Ty(theContext), PointerType::get(Type::getInt8Ty(theContext), 0), true /* this is var arg func type*/));
-        CalleeF = static_cast<Function*>(constFunc);
-    }
-    else if(Callee == "dec" || Callee=="inc"){
-        auto var = dynamic_cast<VariableIdentifierAST*>(Args[0].get());
-        if(!var)
-            return LogErrorV("DEC must be called with a variable identifier");
-        
-        Value *Variable = namedValues[var->GetName()];
-        if(!Variable){
-            printf("Unknown variable name %s\n", var->GetName().c_str()); 
-            return nullptr;
+    if(builtin != BUILTIN_NONE){
+        if(Args.size() != builtinInfo[builtin].arity){
+            printf("%s%s: %d wanted %d\n", Where(this).c_str(), Callee.c_str(), (int) Args.size(), (int) builtinInfo[builtin].arity);
+            return LogErrorV("Incorrect # arguments passed");
         }
-        Value* StepVal;
-        if(Callee == "dec") StepVal = ConstantInt::get(theContext, APInt(64, -1));
-        else StepVal = ConstantInt::get(theContext, APInt(64, 1));
-        
-        Value *CurVar = builder.CreateLoad(Variable, var->GetName().c_str());
-        Value *NextVar = builder.CreateAdd(CurVar, StepVal, "nextvar");
-        return builder.CreateStore(NextVar, Variable);
-    }
-    /*
-    else if(Callee == "exit"){
-        auto constFunc = theModule->getOrInsertFunction("exit", FunctionType::get(Type::getVoidTy(theContext), Type::getInt32Ty(theContext), false));
-        CalleeF = static_cast<Function*>(constFunc);
-    }*/
-    else{
-        CalleeF = theModule->getFunction(Callee);
+        return builtinLowerings[builtin](this);
     }
+
+    Function* CalleeF = declaration ? declaration->GetFunction() : nullptr;
     if(!CalleeF){
-        printf("Unknown function referenced: %s\n", Callee.c_str());
+        printf("%sUnknown function referenced: %s\n", Where(this).c_str(), Callee.c_str());
         return nullptr;
     }
 
-
     std::vector<Value*> ArgsV;
-
-    if(Callee == "writeln"){
-        ArgsV.push_back(builder.CreateGlobalStringPtr("%d\n", "strtmp"));
-    }
-    else if(Callee == "readln"){
-        ArgsV.push_back(builder.CreateGlobalStringPtr("%d", "strtmp"));
-    }
-    /*
-    else if(Callee == "exit"){
-        ArgsV.push_back(ConstantInt::get(theContext, APInt(32, 0)));
-    }*/
-    if(Callee == "readln"){
-        auto arg = dynamic_cast<VariableIdentifierAST*>(Args[0].get());
-        if(!arg){
-            printf("Improper call to readln. Expected identifier\n");
+    for(int i = 0; i<Args.size(); i++){
+        ArgsV.push_back(Args[i]->codegen());
+        if(!ArgsV.back())
             return nullptr;
-        }
-        Value* v = namedValues[arg->GetName()];
-        ArgsV.push_back(v);
-        //auto val = Args[i]
-    }
-    else{
-        for(int i = 0; i<Args.size(); i++){
-            ArgsV.push_back(Args[i]->codegen());
-            if(!ArgsV.back())
-                return nullptr;
-        }
     }
 
-    if(CalleeF->arg_size() != ArgsV.size() && CalleeF->arg_size() != Args.size()){
-        printf("%s: %d wanted %d\n", Callee.c_str(), (int) ArgsV.size(),(int) CalleeF->arg_size());
+    if(CalleeF->arg_size() != ArgsV.size()){
+        printf("%s%s: %d wanted %d\n", Where(this).c_str(), Callee.c_str(), (int) ArgsV.size(),(int) CalleeF->arg_size());
         return LogErrorV("Incorrect # arguments passed");
     }
 
-    if(CalleeF->getReturnType() == Type::getVoidTy(theContext)){
-        return builder.CreateCall(CalleeF, ArgsV);
+    if(CalleeF->getReturnType() == Type::getVoidTy(GetContext())){
+        return GetBuilder().CreateCall(CalleeF, ArgsV);
     }
     else{
-        return builder.CreateCall(CalleeF, ArgsV, "calltmp");
+        return GetBuilder().CreateCall(CalleeF, ArgsV, "calltmp");
     }
 }
 
 Value* IfExpressionAST::codegen(){
-    Value *CondV = cond->codegen();
+    Value *CondV = CodegenCondition(cond.get(), "ifcond");
     if(!CondV)
         return nullptr;
+    Function *theFunction = GetBuilder().GetInsertBlock()->getParent();
+    BasicBlock *thenBB = BasicBlock::Create(GetContext(), "then", theFunction);
+    BasicBlock *elseBB = BasicBlock::Create(GetContext(), "else");
+    BasicBlock *mergeBB = BasicBlock::Create(GetContext(), "ifcont");
 
-    CondV = builder.CreateICmpNE(CondV, ConstantInt::get(theContext, APInt(1, 0)), "ifcond");
-    Function *theFunction = builder.GetInsertBlock()->getParent();
-    BasicBlock *thenBB = BasicBlock::Create(theContext, "then", theFunction);
-    BasicBlock *elseBB = BasicBlock::Create(theContext, "else");
-    BasicBlock *mergeBB = BasicBlock::Create(theContext, "ifcont");
+    GetBuilder().CreateCondBr(CondV, thenBB, elseBB);
 
-    builder.CreateCondBr(CondV, thenBB, elseBB);
-
-    builder.SetInsertPoint(thenBB);
+    GetBuilder().SetInsertPoint(thenBB);
+    SealBlock(thenBB);
 
     //Im sorry for this...
     bool oldHasBrokeFunction = hasBrokeFromFunctionInBlock;
@@ -379,18 +768,19 @@ Value* IfExpressionAST::codegen(){
     thenPart->codegen();
 
     if(!hasBrokeFromLoopInBlock && !hasBrokeFromFunctionInBlock){
-        builder.CreateBr(mergeBB);
+        GetBuilder().CreateBr(mergeBB);
     }
     hasBrokeFromFunctionInBlock = oldHasBrokeFunction;
     hasBrokeFromLoopInBlock = oldHasBrokeLoop;
 
-    thenBB = builder.GetInsertBlock();
+    thenBB = GetBuilder().GetInsertBlock();
 
     theFunction->getBasicBlockList().push_back(elseBB);
-    builder.SetInsertPoint(elseBB);
+    GetBuilder().SetInsertPoint(elseBB);
+    SealBlock(elseBB);
 
-    //Value *ThenV = Constant::getNullValue(Type::getInt64Ty(theContext));
-    //Value *ElseV = Constant::getNullValue(Type::getInt64Ty(theContext));
+    //Value *ThenV = Constant::getNullValue(Type::getInt64Ty(GetContext()));
+    //Value *ElseV = Constant::getNullValue(Type::getInt64Ty(GetContext()));
 
     //Im sorry for this again...
     oldHasBrokeFunction = hasBrokeFromFunctionInBlock;
@@ -399,46 +789,82 @@ Value* IfExpressionAST::codegen(){
     if(elsePart) elsePart->codegen();
 
     if(!hasBrokeFromLoopInBlock && !hasBrokeFromFunctionInBlock){
-        builder.CreateBr(mergeBB);
+        GetBuilder().CreateBr(mergeBB);
     }
 
     hasBrokeFromFunctionInBlock = oldHasBrokeFunction;
     hasBrokeFromLoopInBlock = oldHasBrokeLoop;
 
-    elseBB = builder.GetInsertBlock();
+    elseBB = GetBuilder().GetInsertBlock();
     
     theFunction->getBasicBlockList().push_back(mergeBB);
-    builder.SetInsertPoint(mergeBB);
-    //PHINode *PN = builder.CreatePHI(Type::getInt64Ty(theContext), 2, "iftmp");
+    GetBuilder().SetInsertPoint(mergeBB);
+    SealBlock(mergeBB);
+    //PHINode *PN = GetBuilder().CreatePHI(Type::getInt64Ty(GetContext()), 2, "iftmp");
 
     //PN->addIncoming(ThenV, thenBB);
     //PN->addIncoming(ElseV, elseBB);
 
-    return Constant::getNullValue(Type::getInt64Ty(theContext));
+    return Constant::getNullValue(Type::getInt64Ty(GetContext()));
 }
 
+// Lowered to the counted loop shape LLVM's loop passes expect: start, end and
+// step are evaluated once, a guard skips the loop when it runs zero times and
+// the latch steps the variable with nsw and compares it to the end
+//
+//   guard:      var = start; br var <= end, preheader, afterloop
+//   preheader:  br loop
+//   loop:       body; br latch
+//   latch:      var = var + step; br var <= end, loop, afterloop
+//
+// with >= and a subtracted step for downto.
 Value* ForExpressionAST::codegen(){
     Value *StartVal = start->codegen();
     if(!StartVal)
         return nullptr;
+    Value *EndVal = end->codegen();
+    if(!EndVal)
+        return nullptr;
 
-    Function *TheFunction = builder.GetInsertBlock()->getParent();
+    Value *StepVal = ConstantInt::get(GetContext(), APInt(64, 1));
+    bool constantStep = true;
+    if(step){
+        auto stepNumber = dyn_cast<NumberAST>(step.get());
+        if(stepNumber && stepNumber->GetValue() <= 0)
+            return LogErrorV((Where(step.get()) + "The step of a for loop must be positive").c_str());
+        constantStep = stepNumber != nullptr;
+        StepVal = step->codegen();
+        if(!StepVal)
+            return nullptr;
+    }
 
-    AllocaInst *Alloca = CreateEntryBlockAlloca(TheFunction, loopVarName);
+    bool upwards = direction == KW_TO;
+    auto InBounds = [&](Value *var, const char *name){
+        return upwards ? GetBuilder().CreateICmpSLE(var, EndVal, name) : GetBuilder().CreateICmpSGE(var, EndVal, name);
+    };
 
-    builder.CreateStore(StartVal, Alloca);
+    Function *TheFunction = GetBuilder().GetInsertBlock()->getParent();
 
-    BasicBlock *LoopBB = BasicBlock::Create(theContext, "loop", TheFunction);
+    DefineSlot(loopVarSlot, loopVarName, StartVal);
 
-    builder.CreateBr(LoopBB);
+    BasicBlock *PreheaderBB = BasicBlock::Create(GetContext(), "preheader", TheFunction);
+    BasicBlock *LoopBB = BasicBlock::Create(GetContext(), "loop", TheFunction);
+    BasicBlock *LatchBB = BasicBlock::Create(GetContext(), "latch", TheFunction);
+    BasicBlock *NextBB = BasicBlock::Create(GetContext(), "nextiter", TheFunction);
+    BasicBlock *AfterBB = BasicBlock::Create(GetContext(), "afterloop", TheFunction);
 
-    builder.SetInsertPoint(LoopBB);
+    // A step that isn't positive runs the loop zero times
+    Value *Guard = InBounds(StartVal, "guard");
+    if(!constantStep)
+        Guard = GetBuilder().CreateAnd(Guard, GetBuilder().CreateICmpSGT(StepVal, ConstantInt::get(StepVal->getType(), 0), "steppositive"), "guard");
+    GetBuilder().CreateCondBr(Guard, PreheaderBB, AfterBB);
 
-    AllocaInst *OldVal = namedValues[loopVarName];
-    namedValues[loopVarName] = Alloca;
+    GetBuilder().SetInsertPoint(PreheaderBB);
+    SealBlock(PreheaderBB);
+    GetBuilder().CreateBr(LoopBB);
 
+    GetBuilder().SetInsertPoint(LoopBB);
 
-    BasicBlock *AfterBB = BasicBlock::Create(theContext, "afterloop", TheFunction);
     auto oldLastLoopEndBlock = lastLoopEndBlock;
     lastLoopEndBlock = AfterBB;
 
@@ -447,61 +873,53 @@ Value* ForExpressionAST::codegen(){
 
     lastLoopEndBlock = oldLastLoopEndBlock;
 
-    Value *StepVal = nullptr;
-    /*if(step){
-        StepVal = step->codegen();
-        if(!StepVal)
-            return nullptr;
-    }
-    else{*/
-    if(direction == KW_TO){
-        StepVal = ConstantInt::get(theContext, APInt(64, 1));
-    }
-    else{
-        StepVal = ConstantInt::get(theContext, APInt(64, -1));
-    }
-    //}
-    Value *CurVar = builder.CreateLoad(Alloca, loopVarName.c_str());
-    Value *NextVar = builder.CreateAdd(CurVar, StepVal, "nextvar");
-    builder.CreateStore(NextVar, Alloca);
-
-    Value *EndCond = end->codegen();
-    if(!EndCond)
-        return nullptr;
-
-    auto EndCondV = builder.CreateICmpNE(EndCond, CurVar, "loopcond");
-
-    builder.CreateCondBr(EndCondV, LoopBB, AfterBB);
-    builder.SetInsertPoint(AfterBB);
-
-    if(OldVal)
-        namedValues[loopVarName] = OldVal;
-    else
-        namedValues.erase(loopVarName);
-
-    return Constant::getNullValue(Type::getInt64Ty(theContext));
+    GetBuilder().CreateBr(LatchBB);
+    GetBuilder().SetInsertPoint(LatchBB);
+    SealBlock(LatchBB);
+
+    // Leave before stepping past the end rather than after, so the nsw step
+    // can't overflow for an end near maxint or minint. With the loop variable
+    // in bounds, its distance to the end fits in 64 unsigned bits.
+    Value *CurVar = ReadSlot(loopVarSlot, loopVarName);
+    Value *Left = upwards ? GetBuilder().CreateSub(EndVal, CurVar, "left")
+                          : GetBuilder().CreateSub(CurVar, EndVal, "left");
+    Value *Again = GetBuilder().CreateAnd(InBounds(CurVar, "inbounds"),
+                                          GetBuilder().CreateICmpUGE(Left, StepVal, "roomforstep"), "loopcond");
+    GetBuilder().CreateCondBr(Again, NextBB, AfterBB);
+
+    GetBuilder().SetInsertPoint(NextBB);
+    SealBlock(NextBB);
+    Value *NextVar = upwards ? GetBuilder().CreateNSWAdd(CurVar, StepVal, "nextvar")
+                             : GetBuilder().CreateNSWSub(CurVar, StepVal, "nextvar");
+    WriteSlot(loopVarSlot, NextVar);
+    GetBuilder().CreateBr(LoopBB);
+    SealBlock(LoopBB);
+    GetBuilder().SetInsertPoint(AfterBB);
+    SealBlock(AfterBB);
+
+    return Constant::getNullValue(Type::getInt64Ty(GetContext()));
 }
 
 Value* WhileExpressionAST::codegen(){
 
-    Function *TheFunction = builder.GetInsertBlock()->getParent();
+    Function *TheFunction = GetBuilder().GetInsertBlock()->getParent();
 
-    BasicBlock *CondBB = BasicBlock::Create(theContext, "loopCondBB", TheFunction);
-    BasicBlock *LoopBB = BasicBlock::Create(theContext, "loop", TheFunction);
+    BasicBlock *CondBB = BasicBlock::Create(GetContext(), "loopCondBB", TheFunction);
+    BasicBlock *LoopBB = BasicBlock::Create(GetContext(), "loop", TheFunction);
 
-    builder.CreateBr(CondBB);
+    GetBuilder().CreateBr(CondBB);
 
-    builder.SetInsertPoint(CondBB);
+    GetBuilder().SetInsertPoint(CondBB);
 
-    Value *StartCond = cond->codegen();
+    Value *StartCond = CodegenCondition(cond.get(), "loopcond");
     if(!StartCond)
         return nullptr;
 
-    BasicBlock *AfterBB = BasicBlock::Create(theContext, "afterloop", TheFunction);
-    auto StartCondV = builder.CreateICmpNE(StartCond, ConstantInt::get(theContext, APInt(1,0)), "loopcond");
-    builder.CreateCondBr(StartCondV, LoopBB, AfterBB);
+    BasicBlock *AfterBB = BasicBlock::Create(GetContext(), "afterloop", TheFunction);
+    GetBuilder().CreateCondBr(StartCond, LoopBB, AfterBB);
 
-    builder.SetInsertPoint(LoopBB);
+    GetBuilder().SetInsertPoint(LoopBB);
+    SealBlock(LoopBB);
     auto oldLastLoopEndBlock = lastLoopEndBlock;
     lastLoopEndBlock = AfterBB;
 
@@ -510,21 +928,25 @@ Value* WhileExpressionAST::codegen(){
 
     lastLoopEndBlock = oldLastLoopEndBlock;
 
-    builder.CreateBr(CondBB);
+    GetBuilder().CreateBr(CondBB);
+    SealBlock(CondBB);
 
-    builder.SetInsertPoint(AfterBB);
+    GetBuilder().SetInsertPoint(AfterBB);
+    SealBlock(AfterBB);
 
-    return Constant::getNullValue(Type::getInt64Ty(theContext));
+    return Constant::getNullValue(Type::getInt64Ty(GetContext()));
 }
 
 Value* PrototypeAST::codegen(){
-    std::vector<Type*> Ints(Args.size(), Type::getInt64Ty(theContext));
+    std::vector<Type*> Ints(Args.size(), Type::getInt64Ty(GetContext()));
 
     FunctionType *FT;
-    if(returnType == EOI) FT = FunctionType::get(Type::getVoidTy(theContext), Ints, false);
-    else FT = FunctionType::get(Type::getInt64Ty(theContext), Ints, false);
+    if(returnType == EOI) FT = FunctionType::get(Type::getVoidTy(GetContext()), Ints, false);
+    else FT = FunctionType::get(Type::getInt64Ty(GetContext()), Ints, false);
 
     Function *F = Function::Create(FT, Function::ExternalLinkage, name, theModule.get());
+    StampTarget(F);
+    function = F;
 
     unsigned Idx = 0;
     for(auto &Arg : F->args()){
@@ -534,70 +956,66 @@ Value* PrototypeAST::codegen(){
     return F;
 }
 
-std::vector<AllocaInst*> FunctionAST::DoAllocations(){
-    PrototypeAST *proto = dynamic_cast<PrototypeAST*>(prototype.get());
+void FunctionAST::DoAllocations(){
+    PrototypeAST *proto = GetPrototype();
     Function *theFunction = theModule->getFunction((proto->GetName()));
 
     if(!theFunction)
-        theFunction = static_cast<Function*>(proto->codegen());
+        theFunction = cast_or_null<Function>(proto->codegen());
 
     if(!theFunction)
-        return {};
+        return;
+    proto->SetFunction(theFunction);
 
     if(!theFunction->empty()){
-        printf("Function %s cannot be redefined\n", proto->GetName().c_str());
-        return {};
+        printf("%sFunction %s cannot be redefined\n", Where(this).c_str(), proto->GetName().c_str());
+        return;
     }
 
-    BasicBlock *BB = BasicBlock::Create(theContext, "entry", theFunction);
+    BasicBlock *BB = BasicBlock::Create(GetContext(), "entry", theFunction);
 
     //Create return point
-    BasicBlock *RetBlock = BasicBlock::Create(theContext, "return", theFunction);
+    BasicBlock *RetBlock = BasicBlock::Create(GetContext(), "return", theFunction);
 
-    builder.SetInsertPoint(BB);
+    GetBuilder().SetInsertPoint(BB);
+    SealBlock(BB);
 
-    std::vector<AllocaInst *> OldBindings;
-    //namedValues.clear();
-    for(auto &Arg : theFunction->args()){
-        AllocaInst *Alloca = CreateEntryBlockAlloca(theFunction, Arg.getName());
-
-        builder.CreateStore(&Arg, Alloca);
-
-        OldBindings.push_back(namedValues[Arg.getName()]);
-        namedValues[Arg.getName()] = Alloca;
-    }
+    uint32_t slot = firstSlot;
+    for(auto &Arg : theFunction->args())
+        DefineSlot(slot++, Arg.getName().str(), &Arg);
     //Create the return variable
-    AllocaInst *FunctionRetVal = CreateEntryBlockAlloca(theFunction, proto->GetName());
-
-    //return ConstantInt::get(theContext, APInt(64, value));
-    builder.CreateStore(ConstantInt::get(theContext, APInt(64, 0)), FunctionRetVal);
-    OldBindings.push_back(namedValues[proto->GetName()]);
-    namedValues[proto->GetName()] = FunctionRetVal;
-
-    builder.SetInsertPoint(RetBlock);
-    if(proto->GetReturnType() != EOI){
-        auto loadedRetVal = builder.CreateLoad(namedValues[proto->GetName()], proto->GetName());
-        builder.CreateRet(loadedRetVal);
-    }
-    else{
-        builder.CreateRetVoid();
-    }
+    DefineSlot(slot, proto->GetName(), ConstantInt::get(GetContext(), APInt(64, 0)));
+
+    auto emitReturn = [&](){
+        GetBuilder().SetInsertPoint(RetBlock);
+        if(proto->GetReturnType() != EOI)
+            GetBuilder().CreateRet(ReadSlot(slot, proto->GetName()));
+        else
+            GetBuilder().CreateRetVoid();
+    };
+    // In SSA mode the result is only known once every exit has branched there
+    if(!buildSSA)
+        emitReturn();
     lastFunctionReturnBlock = RetBlock;
 
-    builder.SetInsertPoint(BB);
+    GetBuilder().SetInsertPoint(BB);
 
     //Again... I'm so sorry for this. 
     bool oldHasBrokeLoop = hasBrokeFromLoopInBlock;
     bool oldHasBrokeFunction = hasBrokeFromFunctionInBlock;
     if(Value *BodyVal = body->codegen()){
         if(!hasBrokeFromFunctionInBlock){
-            builder.CreateBr(RetBlock);
+            GetBuilder().CreateBr(RetBlock);
+        }
+        if(buildSSA){
+            SealBlock(RetBlock);
+            emitReturn();
         }
         hasBrokeFromLoopInBlock = oldHasBrokeLoop;
         hasBrokeFromFunctionInBlock = oldHasBrokeFunction;
         verifyFunction(*theFunction);
-        return OldBindings;
+        return;
     }
+    ForgetBlocks(theFunction);
     theFunction->eraseFromParent();
-    return {};
 }
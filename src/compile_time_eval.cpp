@@ -0,0 +1,497 @@
+#include "compile_time_eval.h"
+#include "call_graph.h"
+#include "ast_visitor.h"
+#include "arithmetic.h"
+
+#include <algorithm>
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/DenseSet.h"
+
+using namespace llvm;
+
+namespace{
+
+// Steps one call may take, and all calls together, before giving up on them
+const uint64_t callFuel = 1 << 20;
+const uint64_t totalFuel = 1 << 24;
+// Pascal calls nested deeper than this are left for runtime
+const unsigned maxDepth = 256;
+
+/************************/
+/*        Purity        */
+/************************/
+
+// What a function's body touches, decides whether it can be run at compile time
+struct BodySummary{
+    bool localOnly = true;
+    std::vector<FunctionAST*> callees;
+};
+
+class PurityAnalysis{
+    private:
+        const DefinitionMap &definitions;
+        std::vector<FunctionAST*> functions;
+        DenseMap<FunctionAST*, BodySummary> summaries;
+
+        void CollectFunctions(std::vector<std::unique_ptr<AST>> &declarations){
+            for(auto &decl : declarations){
+                auto function = dyn_cast<FunctionAST>(decl.get());
+                if(!function)
+                    continue;
+                functions.push_back(function);
+                if(auto block = dyn_cast_or_null<MainBlockAST>(function->GetBody().get()))
+                    CollectFunctions(block->GetDeclarations());
+            }
+        }
+
+        void AddLocals(AST *decl, DenseSet<uint32_t> &locals){
+            if(auto ofType = dyn_cast<VariableDeclarationsOfTypeAST>(decl)){
+                for(auto &ident : ofType->GetIdentifiers())
+                    locals.insert(ident->GetSlot());
+            }
+            else if(auto decls = dyn_cast<VariableDeclarationsAST>(decl)){
+                for(auto &inner : decls->GetDeclarations())
+                    AddLocals(inner.get(), locals);
+            }
+        }
+
+        // Declarations come before the statements that use them and for loop
+        // variables before their bodies, so locals is complete by each use
+        void Summarize(AST *node, DenseSet<uint32_t> &locals, BodySummary &summary){
+            switch(node->GetKind()){
+                case AST_MAIN_BLOCK:{
+                    auto block = cast<MainBlockAST>(node);
+                    // Nested procedures are summarized on their own
+                    for(auto &decl : block->GetDeclarations())
+                        AddLocals(decl.get(), locals);
+                    if(block->GetStatementSequence())
+                        Summarize(block->GetStatementSequence().get(), locals, summary);
+                    return;
+                }
+                case AST_VARIABLE_IDENTIFIER:
+                    if(!locals.count(cast<VariableIdentifierAST>(node)->GetSlot()))
+                        summary.localOnly = false;
+                    return;
+                case AST_FOR:
+                    locals.insert(cast<ForExpressionAST>(node)->GetLoopVarSlot());
+                    break;
+                case AST_CALL:{
+                    auto call = cast<CallExpessionsAst>(node);
+                    if(call->GetBuiltin() == BUILTIN_WRITELN || call->GetBuiltin() == BUILTIN_READLN){
+                        summary.localOnly = false;
+                        return;
+                    }
+                    if(call->GetBuiltin() == BUILTIN_NONE){
+                        auto callee = call->GetDeclaration() ? definitions.lookup(call->GetDeclaration()) : nullptr;
+                        if(!callee){
+                            summary.localOnly = false;
+                            return;
+                        }
+                        summary.callees.push_back(callee);
+                    }
+                    break;
+                }
+                default:
+                    break;
+            }
+            ForEachChild(node, [&](AST *child){ Summarize(child, locals, summary); });
+        }
+
+    public:
+        DenseSet<FunctionAST*> pure;
+
+        PurityAnalysis(ProgramAST *program, const DefinitionMap &definitions): definitions(definitions){
+            CollectFunctions(program->GetDeclarations());
+        }
+
+        // Assumes every function whose own body is local only is pure, then
+        // drops the ones calling something that isn't until nothing changes,
+        // so (mutually) recursive functions stay pure
+        void Run(){
+            for(auto function : functions){
+                BodySummary &summary = summaries[function];
+                DenseSet<uint32_t> locals;
+                // Parameters then the result variable
+                for(size_t i = 0; i <= function->GetPrototype()->GetArgs().size(); i++)
+                    locals.insert(function->GetFirstSlot() + i);
+                if(function->GetFirstSlot() && function->GetBody())
+                    Summarize(function->GetBody().get(), locals, summary);
+                else
+                    summary.localOnly = false;
+                if(summary.localOnly)
+                    pure.insert(function);
+            }
+
+            bool changed = true;
+            while(changed){
+                changed = false;
+                for(auto function : functions){
+                    if(!pure.count(function))
+                        continue;
+                    for(auto callee : summaries[function].callees){
+                        if(!pure.count(callee)){
+                            pure.erase(function);
+                            changed = true;
+                            break;
+                        }
+                    }
+                }
+            }
+        }
+};
+
+/************************/
+/*      Interpreter     */
+/************************/
+
+// How a statement finished, exit and break unwind to the function or loop
+enum Flow{
+    FLOW_NORMAL,
+    FLOW_BREAK,
+    FLOW_EXIT,
+    // Out of fuel or depth, divided by zero, or hit something codegen would reject
+    FLOW_FAILED,
+};
+
+typedef DenseMap<uint32_t, uint64_t> Frame;
+
+class Interpreter{
+    private:
+        const DefinitionMap &definitions;
+        uint64_t fuel = 0;
+        unsigned depth = 0;
+
+        bool Step(){
+            if(!fuel)
+                return false;
+            fuel--;
+            return true;
+        }
+
+        bool Store(AST *target, uint64_t value, Frame &frame){
+            auto var = dyn_cast_or_null<VariableIdentifierAST>(target);
+            if(!var)
+                return false;
+            frame[var->GetSlot()] = value;
+            return true;
+        }
+
+        bool EvaluateCall(CallExpessionsAst *call, Frame &frame, uint64_t &value){
+            if(call->GetBuiltin() == BUILTIN_INC || call->GetBuiltin() == BUILTIN_DEC){
+                if(call->GetArgs().size() != 1)
+                    return false;
+                auto var = dyn_cast_or_null<VariableIdentifierAST>(call->GetArgs()[0].get());
+                if(!var)
+                    return false;
+                if(!ComputeBinary(call->GetBuiltin() == BUILTIN_INC ? PLUS : MINUS, frame.lookup(var->GetSlot()), 1, value))
+                    return false;
+                frame[var->GetSlot()] = value;
+                return true;
+            }
+            if(call->GetBuiltin() != BUILTIN_NONE || !call->GetDeclaration())
+                return false;
+            FunctionAST *function = definitions.lookup(call->GetDeclaration());
+            if(!function)
+                return false;
+
+            std::vector<uint64_t> args;
+            for(auto &arg : call->GetArgs()){
+                args.push_back(0);
+                if(!arg || !Evaluate(arg.get(), frame, args.back()))
+                    return false;
+            }
+            return Call(function, args, value);
+        }
+
+        bool Evaluate(AST *node, Frame &frame, uint64_t &value){
+            if(!Step())
+                return false;
+            switch(node->GetKind()){
+                case AST_NUMBER:
+                    value = (int64_t) cast<NumberAST>(node)->GetValue();
+                    return true;
+                case AST_VARIABLE_IDENTIFIER:
+                    value = frame.lookup(cast<VariableIdentifierAST>(node)->GetSlot());
+                    return true;
+                case AST_UNARY_OP:{
+                    auto unary = cast<UnaryOpAST>(node);
+                    uint64_t operand;
+                    return unary->GetExpression() && Evaluate(unary->GetExpression().get(), frame, operand) &&
+                           ComputeNegation(operand, value);
+                }
+                case AST_BINARY_OP:
+                case AST_COMPARISON_OP:{
+                    AST *lhs, *rhs;
+                    LexicalTokenType op;
+                    if(auto binary = dyn_cast<BinaryOpAST>(node)){
+                        lhs = binary->GetLHS().get(); rhs = binary->GetRHS().get(); op = binary->GetOp();
+                    }
+                    else{
+                        auto comparison = cast<ComparisonOpAST>(node);
+                        lhs = comparison->GetLHS().get(); rhs = comparison->GetRHS().get(); op = comparison->GetOp();
+                    }
+                    if(!lhs || !rhs)
+                        return false;
+                    // Like codegen, the left side is worked out before the right even for assignments
+                    uint64_t l = 0, r;
+                    if(op != ASSIGN && !Evaluate(lhs, frame, l))
+                        return false;
+                    // and/or of booleans stop once the left side decides them
+                    if((op == AND || op == OR) && IsBoolean(node) && l == (op == OR)){
+                        value = l;
+                        return true;
+                    }
+                    if(!Evaluate(rhs, frame, r))
+                        return false;
+                    if(op == ASSIGN){
+                        value = r;
+                        return Store(lhs, r, frame);
+                    }
+                    return ComputeBinary(op, l, r, value);
+                }
+                case AST_CALL:
+                    return EvaluateCall(cast<CallExpessionsAst>(node), frame, value);
+                default:
+                    return false;
+            }
+        }
+
+        bool Condition(std::unique_ptr<AST> &cond, Frame &frame, bool &result){
+            uint64_t value;
+            if(!cond || !Evaluate(cond.get(), frame, value))
+                return false;
+            result = value != 0;
+            return true;
+        }
+
+        Flow Execute(AST *node, Frame &frame){
+            if(!Step())
+                return FLOW_FAILED;
+            switch(node->GetKind()){
+                case AST_STATEMENT_SEQUENCE:
+                    for(auto &statement : cast<StatementSequenceAST>(node)->GetStatements()){
+                        if(!statement)
+                            continue;
+                        Flow flow = Execute(statement.get(), frame);
+                        if(flow != FLOW_NORMAL)
+                            return flow;
+                    }
+                    return FLOW_NORMAL;
+                case AST_EXIT_BREAK:
+                    return cast<ExitBreakStatementAST>(node)->GetExitOrBreak() == KW_EXIT ? FLOW_EXIT : FLOW_BREAK;
+                case AST_IF:{
+                    auto ifNode = cast<IfExpressionAST>(node);
+                    bool taken;
+                    if(!Condition(ifNode->GetCond(), frame, taken))
+                        return FLOW_FAILED;
+                    AST *branch = taken ? ifNode->GetThen().get() : ifNode->GetElse().get();
+                    return branch ? Execute(branch, frame) : FLOW_NORMAL;
+                }
+                case AST_WHILE:{
+                    auto whileNode = cast<WhileExpressionAST>(node);
+                    while(true){
+                        bool again;
+                        if(!Condition(whileNode->GetCond(), frame, again))
+                            return FLOW_FAILED;
+                        if(!again)
+                            return FLOW_NORMAL;
+                        Flow flow = whileNode->GetBody() ? Execute(whileNode->GetBody().get(), frame) : FLOW_NORMAL;
+                        if(flow == FLOW_BREAK)
+                            return FLOW_NORMAL;
+                        if(flow != FLOW_NORMAL)
+                            return flow;
+                    }
+                }
+                // As codegen lowers it: start, end and step are evaluated once,
+                // a step that isn't positive runs it zero times and the loop
+                // ends once the variable is out of bounds (signed) or less
+                // than a step from the end
+                case AST_FOR:{
+                    auto forNode = cast<ForExpressionAST>(node);
+                    uint32_t slot = forNode->GetLoopVarSlot();
+                    uint64_t start, end, step = 1;
+                    if(!forNode->GetStart() || !forNode->GetEnd() || !Evaluate(forNode->GetStart().get(), frame, start) ||
+                       !Evaluate(forNode->GetEnd().get(), frame, end))
+                        return FLOW_FAILED;
+                    if(forNode->GetStep() && !Evaluate(forNode->GetStep().get(), frame, step))
+                        return FLOW_FAILED;
+                    bool upwards = forNode->GetDirection() == KW_TO;
+                    auto inBounds = [&](){
+                        return upwards ? (int64_t) frame[slot] <= (int64_t) end : (int64_t) frame[slot] >= (int64_t) end;
+                    };
+                    frame[slot] = start;
+                    if((int64_t) step <= 0 || !inBounds())
+                        return FLOW_NORMAL;
+                    while(true){
+                        Flow flow = forNode->GetBody() ? Execute(forNode->GetBody().get(), frame) : FLOW_NORMAL;
+                        if(flow == FLOW_BREAK)
+                            return FLOW_NORMAL;
+                        if(flow != FLOW_NORMAL)
+                            return flow;
+                        if(!inBounds() || (upwards ? end - frame[slot] : frame[slot] - end) < step)
+                            return FLOW_NORMAL;
+                        frame[slot] = upwards ? frame[slot] + step : frame[slot] - step;
+                    }
+                }
+                default:{
+                    uint64_t ignored;
+                    return Evaluate(node, frame, ignored) ? FLOW_NORMAL : FLOW_FAILED;
+                }
+            }
+        }
+
+        // Runs a procedure or function with a fresh frame, locals start at 0
+        // as DoAllocations stores
+        bool Call(FunctionAST *function, const std::vector<uint64_t> &args, uint64_t &result){
+            PrototypeAST *proto = function->GetPrototype();
+            auto block = dyn_cast_or_null<MainBlockAST>(function->GetBody().get());
+            if(!block || args.size() != proto->GetArgs().size() || depth >= maxDepth)
+                return false;
+
+            Frame frame;
+            for(size_t i = 0; i < args.size(); i++)
+                frame[function->GetFirstSlot() + i] = args[i];
+            depth++;
+            Flow flow = block->GetStatementSequence() ? Execute(block->GetStatementSequence().get(), frame) : FLOW_NORMAL;
+            depth--;
+            if(flow != FLOW_NORMAL && flow != FLOW_EXIT)
+                return false;
+            result = frame.lookup(function->GetFirstSlot() + args.size());
+            return true;
+        }
+
+    public:
+        uint64_t remaining = totalFuel;
+
+        Interpreter(const DefinitionMap &definitions): definitions(definitions){}
+
+        bool Run(FunctionAST *function, const std::vector<uint64_t> &args, uint64_t &result){
+            fuel = std::min(callFuel, remaining);
+            bool ok = Call(function, args, result);
+            remaining -= std::min(callFuel, remaining) - fuel;
+            return ok;
+        }
+};
+
+/************************/
+/*       Rewriting      */
+/************************/
+
+class CallEvaluator{
+    private:
+        const DefinitionMap &definitions;
+        const DenseSet<FunctionAST*> &pure;
+        Interpreter interpreter;
+
+        // NumberAST holds an int that codegen sign extends to 64 bits
+        static bool FitsNumber(uint64_t value){
+            return (int64_t) value == (int64_t)(int32_t) value;
+        }
+
+        void TryEvaluate(std::unique_ptr<AST> &node){
+            auto call = cast<CallExpessionsAst>(node.get());
+            FunctionAST *function = call->GetDeclaration() ? definitions.lookup(call->GetDeclaration()) : nullptr;
+            if(!function || !pure.count(function) || function->GetPrototype()->GetReturnType() == EOI)
+                return;
+            std::vector<uint64_t> args;
+            for(auto &arg : call->GetArgs()){
+                auto number = dyn_cast_or_null<NumberAST>(arg.get());
+                if(!number)
+                    return;
+                args.push_back((int64_t) number->GetValue());
+            }
+
+            uint64_t result;
+            if(!interpreter.Run(function, args, result) || !FitsNumber(result))
+                return;
+            auto replacement = std::make_unique<NumberAST>((int) result);
+            replacement->SetLocation(node->GetOffset(), node->GetLength());
+            node = std::move(replacement);
+            replaced++;
+        }
+
+        void RewriteDeclarations(std::vector<std::unique_ptr<AST>> &declarations){
+            for(auto &decl : declarations){
+                if(auto function = dyn_cast<FunctionAST>(decl.get())){
+                    if(function->GetBody())
+                        Rewrite(function->GetBody());
+                }
+            }
+        }
+
+    public:
+        unsigned replaced = 0;
+
+        CallEvaluator(const DefinitionMap &definitions, const DenseSet<FunctionAST*> &pure)
+            : definitions(definitions), pure(pure), interpreter(definitions){}
+
+        // Arguments first, so calls nested in arguments are numbers by the time their caller is tried
+        void Rewrite(std::unique_ptr<AST> &node){
+            auto each = [&](std::unique_ptr<AST> &child){ if(child) Rewrite(child); };
+            switch(node->GetKind()){
+                case AST_PROGRAM:
+                    RewriteDeclarations(cast<ProgramAST>(node.get())->GetDeclarations());
+                    each(cast<ProgramAST>(node.get())->GetStatementSequence());
+                    break;
+                case AST_MAIN_BLOCK:
+                    RewriteDeclarations(cast<MainBlockAST>(node.get())->GetDeclarations());
+                    each(cast<MainBlockAST>(node.get())->GetStatementSequence());
+                    break;
+                case AST_STATEMENT_SEQUENCE:
+                    for(auto &statement : cast<StatementSequenceAST>(node.get())->GetStatements()) each(statement);
+                    break;
+                case AST_UNARY_OP:
+                    each(cast<UnaryOpAST>(node.get())->GetExpression());
+                    break;
+                case AST_BINARY_OP:
+                    each(cast<BinaryOpAST>(node.get())->GetRHS());
+                    // The target of an assignment stays a variable
+                    if(cast<BinaryOpAST>(node.get())->GetOp() != ASSIGN)
+                        each(cast<BinaryOpAST>(node.get())->GetLHS());
+                    break;
+                case AST_COMPARISON_OP:
+                    each(cast<ComparisonOpAST>(node.get())->GetLHS());
+                    each(cast<ComparisonOpAST>(node.get())->GetRHS());
+                    break;
+                case AST_CALL:
+                    for(auto &arg : cast<CallExpessionsAst>(node.get())->GetArgs()) each(arg);
+                    TryEvaluate(node);
+                    break;
+                case AST_IF:
+                    each(cast<IfExpressionAST>(node.get())->GetCond());
+                    each(cast<IfExpressionAST>(node.get())->GetThen());
+                    each(cast<IfExpressionAST>(node.get())->GetElse());
+                    break;
+                case AST_FOR:
+                    each(cast<ForExpressionAST>(node.get())->GetStart());
+                    each(cast<ForExpressionAST>(node.get())->GetEnd());
+                    each(cast<ForExpressionAST>(node.get())->GetStep());
+                    each(cast<ForExpressionAST>(node.get())->GetBody());
+                    break;
+                case AST_WHILE:
+                    each(cast<WhileExpressionAST>(node.get())->GetCond());
+                    each(cast<WhileExpressionAST>(node.get())->GetBody());
+                    break;
+                default:
+                    break;
+            }
+        }
+};
+
+}
+
+unsigned EvaluateConstantCalls(std::unique_ptr<AST> &tree){
+    auto program = dyn_cast<ProgramAST>(tree.get());
+    if(!program)
+        return 0;
+    DefinitionMap definitions = CollectDefinitions(program->GetDeclarations());
+    PurityAnalysis purity(program, definitions);
+    purity.Run();
+    if(purity.pure.empty())
+        return 0;
+
+    CallEvaluator evaluator(definitions, purity.pure);
+    evaluator.Rewrite(tree);
+    return evaluator.replaced;
+}
@@ -0,0 +1,26 @@
+#ifndef COMPILE_TIME_EVAL_H
+#define COMPILE_TIME_EVAL_H
+
+#include <memory>
+
+#include "ast.h"
+
+/*
+ * Compile time evaluation of pure function calls
+ *
+ * Runs after ResolveNames and FoldConstants. A function is pure if its body
+ * only reads and writes its own parameters, result and locals, calls no
+ * writeln or readln, and only calls functions that are pure themselves. A
+ * call to a pure function whose arguments are all numbers is run by an
+ * interpreter over the AST, with the same semantics codegen gives it (see
+ * arithmetic.h), and replaced by a NumberAST holding the result.
+ *
+ * Every evaluation gets a budget of steps and a maximum call depth, a call
+ * that runs out of either (or divides by zero, or overflows a signed integer)
+ * is left for runtime.
+ *
+ * Returns how many calls were replaced.
+ */
+unsigned EvaluateConstantCalls(std::unique_ptr<AST> &tree);
+
+#endif
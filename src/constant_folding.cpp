@@ -0,0 +1,224 @@
+#include "constant_folding.h"
+#include "ast_visitor.h"
+#include "arithmetic.h"
+
+#include "llvm/ADT/DenseMap.h"
+
+using namespace llvm;
+
+namespace{
+
+// What folding an expression found out about its value
+struct Folded{
+    bool known = false;
+    // Comparisons and and/or of them are i1 in codegen, the rest i64
+    bool boolean = false;
+    uint64_t value = 0;
+
+    static Folded Unknown(){ return Folded(); }
+    static Folded Value(uint64_t value, bool boolean){
+        Folded folded;
+        folded.known = true;
+        folded.boolean = boolean;
+        folded.value = value;
+        return folded;
+    }
+};
+
+// Codegen handles exit and break through flags that if statements reset, so
+// a branch holding one can't be spliced into its parent
+bool HasExitOrBreak(AST *node){
+    if(isa<ExitBreakStatementAST>(node))
+        return true;
+    bool found = false;
+    ForEachChild(node, [&](AST *child){
+        if(!found)
+            found = HasExitOrBreak(child);
+    });
+    return found;
+}
+
+class ConstantFolder{
+    private:
+        // Slot to value of every constant declared so far
+        DenseMap<uint32_t, int> constants;
+
+        void Replace(std::unique_ptr<AST> &node, std::unique_ptr<AST> replacement){
+            replacement->SetLocation(node->GetOffset(), node->GetLength());
+            node = std::move(replacement);
+            replaced++;
+        }
+
+        std::unique_ptr<AST> EmptyStatement(){
+            return std::make_unique<StatementSequenceAST>(std::vector<std::unique_ptr<AST>>());
+        }
+
+        // NumberAST holds an int that codegen sign extends to 64 bits
+        static bool FitsNumber(uint64_t value){
+            return (int64_t) value == (int64_t)(int32_t) value;
+        }
+
+        void FoldDeclarations(std::vector<std::unique_ptr<AST>> &declarations){
+            for(auto &decl : declarations){
+                if(auto constantDecls = dyn_cast<ConstantDeclarationsAST>(decl.get())){
+                    uint32_t slot = constantDecls->GetFirstSlot();
+                    for(auto &constant : constantDecls->GetConstants()){
+                        if(slot)
+                            constants[slot++] = constant.value;
+                    }
+                }
+                else if(auto function = dyn_cast<FunctionAST>(decl.get())){
+                    if(function->GetBody())
+                        Fold(function->GetBody());
+                }
+            }
+        }
+
+        // Folds the arguments, the ones inc/dec/readln write to have to stay variables
+        void FoldCall(CallExpessionsAst *call){
+            bool writesArguments = call->GetBuiltin() == BUILTIN_INC || call->GetBuiltin() == BUILTIN_DEC ||
+                                   call->GetBuiltin() == BUILTIN_READLN;
+            for(auto &arg : call->GetArgs()){
+                if(arg && !(writesArguments && isa<VariableIdentifierAST>(arg.get())))
+                    Fold(arg);
+            }
+        }
+
+        template<typename T>
+        Folded FoldBinary(std::unique_ptr<AST> &node, T *op){
+            if(op->GetOp() == ASSIGN){
+                if(op->GetRHS())
+                    Fold(op->GetRHS());
+                return Folded::Unknown();
+            }
+            if(!op->GetLHS() || !op->GetRHS())
+                return Folded::Unknown();
+            Folded lhs = Fold(op->GetLHS());
+            Folded rhs = Fold(op->GetRHS());
+            uint64_t result;
+            if(!lhs.known || !rhs.known || lhs.boolean != rhs.boolean ||
+               !ComputeBinary(op->GetOp(), lhs.value, rhs.value, result))
+                return Folded::Unknown();
+
+            bool boolean = isa<ComparisonOpAST>(op) || lhs.boolean;
+            if(!boolean && FitsNumber(result))
+                Replace(node, std::make_unique<NumberAST>((int) result));
+            return Folded::Value(result, boolean);
+        }
+
+    public:
+        unsigned replaced = 0;
+
+        Folded Fold(std::unique_ptr<AST> &node){
+            switch(node->GetKind()){
+                case AST_PROGRAM:{
+                    auto program = cast<ProgramAST>(node.get());
+                    FoldDeclarations(program->GetDeclarations());
+                    if(program->GetStatementSequence())
+                        Fold(program->GetStatementSequence());
+                    return Folded::Unknown();
+                }
+                case AST_MAIN_BLOCK:{
+                    auto block = cast<MainBlockAST>(node.get());
+                    FoldDeclarations(block->GetDeclarations());
+                    if(block->GetStatementSequence())
+                        Fold(block->GetStatementSequence());
+                    return Folded::Unknown();
+                }
+                case AST_STATEMENT_SEQUENCE:
+                    for(auto &statement : cast<StatementSequenceAST>(node.get())->GetStatements()){
+                        if(statement)
+                            Fold(statement);
+                    }
+                    return Folded::Unknown();
+
+                case AST_NUMBER:
+                    return Folded::Value((int64_t) cast<NumberAST>(node.get())->GetValue(), false);
+                case AST_VARIABLE_IDENTIFIER:{
+                    auto found = constants.find(cast<VariableIdentifierAST>(node.get())->GetSlot());
+                    if(found == constants.end())
+                        return Folded::Unknown();
+                    int value = found->second;
+                    Replace(node, std::make_unique<NumberAST>(value));
+                    return Folded::Value((int64_t) value, false);
+                }
+
+                // Unless integers are signed minus passes its operand through
+                // untouched, the operand is then left where it is for codegen
+                case AST_UNARY_OP:{
+                    auto unary = cast<UnaryOpAST>(node.get());
+                    if(!unary->GetExpression())
+                        return Folded::Unknown();
+                    Folded operand = Fold(unary->GetExpression());
+                    uint64_t result;
+                    if(!SignedArithmetic() || !operand.known || operand.boolean ||
+                       !ComputeNegation(operand.value, result))
+                        return Folded::Unknown();
+                    if(FitsNumber(result))
+                        Replace(node, std::make_unique<NumberAST>((int) result));
+                    return Folded::Value(result, false);
+                }
+                case AST_BINARY_OP:
+                    return FoldBinary(node, cast<BinaryOpAST>(node.get()));
+                case AST_COMPARISON_OP:
+                    return FoldBinary(node, cast<ComparisonOpAST>(node.get()));
+
+                case AST_CALL:
+                    FoldCall(cast<CallExpessionsAst>(node.get()));
+                    return Folded::Unknown();
+
+                case AST_IF:{
+                    auto ifNode = cast<IfExpressionAST>(node.get());
+                    if(ifNode->GetThen())
+                        Fold(ifNode->GetThen());
+                    if(ifNode->GetElse())
+                        Fold(ifNode->GetElse());
+                    Folded cond = ifNode->GetCond() ? Fold(ifNode->GetCond()) : Folded::Unknown();
+                    if(!cond.known)
+                        return Folded::Unknown();
+
+                    std::unique_ptr<AST> taken = std::move(cond.value ? ifNode->GetThen() : ifNode->GetElse());
+                    if(taken && HasExitOrBreak(taken.get())){
+                        // Put it back, the if has to stay
+                        (cond.value ? ifNode->GetThen() : ifNode->GetElse()) = std::move(taken);
+                        return Folded::Unknown();
+                    }
+                    if(!taken)
+                        taken = EmptyStatement();
+                    node = std::move(taken);
+                    replaced++;
+                    return Folded::Unknown();
+                }
+                case AST_WHILE:{
+                    auto whileNode = cast<WhileExpressionAST>(node.get());
+                    Folded cond = whileNode->GetCond() ? Fold(whileNode->GetCond()) : Folded::Unknown();
+                    if(cond.known && !cond.value){
+                        Replace(node, EmptyStatement());
+                        return Folded::Unknown();
+                    }
+                    if(whileNode->GetBody())
+                        Fold(whileNode->GetBody());
+                    return Folded::Unknown();
+                }
+                case AST_FOR:{
+                    auto forNode = cast<ForExpressionAST>(node.get());
+                    for(auto child : {&forNode->GetStart(), &forNode->GetEnd(), &forNode->GetStep(), &forNode->GetBody()}){
+                        if(*child)
+                            Fold(*child);
+                    }
+                    return Folded::Unknown();
+                }
+
+                default:
+                    return Folded::Unknown();
+            }
+        }
+};
+
+}
+
+unsigned FoldConstants(std::unique_ptr<AST> &tree){
+    ConstantFolder folder;
+    folder.Fold(tree);
+    return folder.replaced;
+}
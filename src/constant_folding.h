@@ -0,0 +1,25 @@
+#ifndef CONSTANT_FOLDING_H
+#define CONSTANT_FOLDING_H
+
+#include <memory>
+
+#include "ast.h"
+
+/*
+ * Constant propagation and folding
+ *
+ * Runs after ResolveNames. Uses of declared constants become NumberASTs,
+ * arithmetic on numbers is worked out with the same semantics codegen gives
+ * it (see arithmetic.h), and if statements and while loops whose
+ * condition is known are cut down to the branch that runs.
+ *
+ * Comparisons (and and/or of them) are i1 in codegen, so their results are
+ * only used to prune branches and are never turned into numbers. Constants
+ * that are assigned to, or passed to inc/dec/readln, are left for codegen to
+ * report.
+ *
+ * Returns how many nodes were replaced.
+ */
+unsigned FoldConstants(std::unique_ptr<AST> &tree);
+
+#endif
@@ -0,0 +1,63 @@
+#include "expression_table.h"
+#include "ast_visitor.h"
+
+#include "llvm/ADT/Hashing.h"
+
+size_t ExpressionTable::KeyHash::operator()(const Key &key) const{
+    return llvm::hash_combine(key.kind, key.op, key.first, key.second);
+}
+
+uint32_t ExpressionTable::Intern(const Key &key){
+    auto inserted = expressions.insert({key, (uint32_t) expressions.size() + 1});
+    return inserted.first->second;
+}
+
+uint32_t ExpressionTable::Number(int value){
+    return Intern({AST_NUMBER, ERR, value, 0});
+}
+
+uint32_t ExpressionTable::Variable(const std::string &name){
+    auto id = names.insert({name, (uint32_t) names.size()}).first->second;
+    return Intern({AST_VARIABLE_IDENTIFIER, ERR, id, 0});
+}
+
+uint32_t ExpressionTable::Operation(ASTKind kind, LexicalTokenType op, uint32_t lhs, uint32_t rhs){
+    //Assignments have a side effect, and nothing unnumbered can be shared
+    if(op == ASSIGN || !lhs || (!rhs && kind != AST_UNARY_OP))
+        return 0;
+    return Intern({kind, op, lhs, rhs});
+}
+
+void NumberExpressions(AST *tree, ExpressionTable &table){
+    ForEachChild(tree, [&](AST *child){ NumberExpressions(child, table); });
+    switch(tree->GetKind()){
+        case AST_NUMBER:
+            tree->SetValueNumber(table.Number(llvm::cast<NumberAST>(tree)->GetValue()));
+            break;
+        case AST_VARIABLE_IDENTIFIER:
+            tree->SetValueNumber(table.Variable(llvm::cast<VariableIdentifierAST>(tree)->GetName()));
+            break;
+        case AST_UNARY_OP:{
+            auto unary = llvm::cast<UnaryOpAST>(tree);
+            if(unary->GetExpression())
+                tree->SetValueNumber(table.Operation(AST_UNARY_OP, unary->GetOp(), unary->GetExpression()->GetValueNumber(), 0));
+            break;
+        }
+        case AST_BINARY_OP:{
+            auto binary = llvm::cast<BinaryOpAST>(tree);
+            if(binary->GetLHS() && binary->GetRHS())
+                tree->SetValueNumber(table.Operation(AST_BINARY_OP, binary->GetOp(),
+                            binary->GetLHS()->GetValueNumber(), binary->GetRHS()->GetValueNumber()));
+            break;
+        }
+        case AST_COMPARISON_OP:{
+            auto comparison = llvm::cast<ComparisonOpAST>(tree);
+            if(comparison->GetLHS() && comparison->GetRHS())
+                tree->SetValueNumber(table.Operation(AST_COMPARISON_OP, comparison->GetOp(),
+                            comparison->GetLHS()->GetValueNumber(), comparison->GetRHS()->GetValueNumber()));
+            break;
+        }
+        default:
+            break;
+    }
+}
@@ -0,0 +1,60 @@
+#ifndef EXPRESSION_TABLE_H
+#define EXPRESSION_TABLE_H
+
+#include <string>
+#include <unordered_map>
+#include <stdint.h>
+
+#include "llvm/ADT/StringMap.h"
+
+#include "ast.h"
+
+/*
+ * Hash-consing for pure expressions (numbers, variables and the arithmetic,
+ * logic and comparison operators over them).
+ *
+ * Every distinct expression gets a number, keyed by its kind, operator and
+ * the numbers of its operands, so two subtrees get the same number exactly
+ * when they're structurally identical. The parser asks for a number as it
+ * builds each node (see BuildASTActions) and codegen uses it to reuse a value
+ * already computed in the same basic block instead of emitting it again.
+ *
+ * 0 is never handed out. It's what nodes that aren't numbered keep, and
+ * anything built on top of one of them isn't numbered either.
+ */
+class ExpressionTable{
+    public:
+        uint32_t Number(int value);
+        uint32_t Variable(const std::string &name);
+        uint32_t Operation(ASTKind kind, LexicalTokenType op, uint32_t lhs, uint32_t rhs);
+
+        // How many distinct expressions were seen
+        size_t Size() const {return expressions.size();};
+
+    private:
+        struct Key{
+            ASTKind kind;
+            LexicalTokenType op;
+            int64_t first;
+            uint32_t second;
+
+            bool operator==(const Key &other) const{
+                return kind == other.kind && op == other.op &&
+                       first == other.first && second == other.second;
+            }
+        };
+        struct KeyHash{
+            size_t operator()(const Key &key) const;
+        };
+
+        uint32_t Intern(const Key &key);
+
+        std::unordered_map<Key, uint32_t, KeyHash> expressions;
+        llvm::StringMap<uint32_t> names;
+};
+
+// Numbers every pure expression in a tree that was built without a table
+// (one loaded from an AST file), the same way the parser would have
+void NumberExpressions(AST *tree, ExpressionTable &table);
+
+#endif
@@ -0,0 +1,267 @@
+/*
+ * Build time tool that turns grammer-formal.md into LL(1) predict tables.
+ *
+ * Usage: grammar_gen [grammar.md] [output.h]
+ *
+ * The output has an enum of non-terminals, an enum of productions named
+ * <NON_TERMINAL>__<FIRST_SYMBOL> (or __EMPTY), and a constexpr table indexed
+ * by non-terminal and LexicalTokenType giving the production to use. The
+ * parser switches on Predict() instead of hand written FIRST set checks.
+ */
+#include <stdio.h>
+#include <algorithm>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <regex>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+struct Production{
+    std::string lhs;
+    std::vector<std::string> rhs;
+    std::string name;
+};
+
+// Terminal spellings in the grammar and the LexicalTokenType they lex to
+static const std::map<std::string, std::string> terminalTokens = {
+    {"identifier", "IDENTIFIER"}, {"number", "NUMBER"},
+    {"+", "PLUS"}, {"-", "MINUS"}, {"*", "TIMES"}, {"/", "DIVIDE"},
+    {"and", "AND"}, {"or", "OR"}, {"mod", "MOD"}, {"div", "DIV"},
+    {"=", "EQUAL"}, {"<>", "NOTEQUAL"}, {"<", "LESSTHAN"}, {">", "GREATERTHAN"},
+    {"<=", "LESSTHANEQ"}, {">=", "GREATERTHANEQ"},
+    {"(", "LEFTPAREN"}, {")", "RIGHTPAREN"}, {"[", "LEFTBRACKET"}, {"]", "RIGHTBRACKET"},
+    {":=", "ASSIGN"}, {",", "COMMA"}, {":", "COLON"}, {";", "SEMICOLON"},
+    {"..", "DOTDOT"}, {".", "DOT"},
+    {"var", "KW_VAR"}, {"const", "KW_CONST"}, {"if", "KW_IF"}, {"then", "KW_THEN"},
+    {"else", "KW_ELSE"}, {"begin", "KW_BEGIN"}, {"end", "KW_END"}, {"exit", "KW_EXIT"},
+    {"break", "KW_BREAK"}, {"while", "KW_WHILE"}, {"do", "KW_DO"}, {"for", "KW_FOR"},
+    {"to", "KW_TO"}, {"downto", "KW_DOWNTO"}, {"step", "KW_STEP"}, {"program", "KW_PROGRAM"},
+    {"procedure", "KW_PROCEDURE"}, {"function", "KW_FUNCTION"}, {"forward", "KW_FORWARD"},
+    {"array", "KW_ARRAY"}, {"integer", "KW_INTEGER"}, {"of", "KW_OF"},
+};
+
+static const std::string END_OF_INPUT = "EOI";
+
+static bool IsNonTerminal(const std::string &symbol){
+    return symbol.size() > 2 && symbol.front() == '<' && symbol.back() == '>';
+}
+
+// <Statement-Sequence-Pr> -> STATEMENT_SEQUENCE_PR
+static std::string EnumName(const std::string &symbol){
+    if(!IsNonTerminal(symbol))
+        return terminalTokens.at(symbol);
+    std::string name;
+    for(size_t i = 1; i<symbol.size() - 1; i++){
+        char c = symbol[i];
+        name.push_back(c == '-' ? '_' : toupper(c));
+    }
+    return name;
+}
+
+int main(int argc, char *argv[]){
+    if(argc != 3){
+        printf("Usage: grammar_gen [grammar.md] [output.h]\n");
+        return 1;
+    }
+
+    std::ifstream in(argv[1]);
+    if(!in){
+        printf("Could not open %s\n", argv[1]);
+        return 1;
+    }
+
+    std::regex productionLine("^(<[A-Za-z][A-Za-z-]*>)\\s*=>(.*)$");
+    std::regex symbolPattern("<[A-Za-z][A-Za-z-]*>|<>|<=|>=|:=|\\.\\.|[A-Za-z_]+|\\S");
+
+    std::vector<Production> productions;
+    std::vector<std::string> nonTerminals;
+    std::string line;
+    int lineNumber = 0;
+    while(std::getline(in, line)){
+        lineNumber++;
+        std::smatch match;
+        if(!std::regex_match(line, match, productionLine))
+            continue;
+
+        Production prod;
+        prod.lhs = match[1];
+        std::string rhs = match[2];
+        for(auto it = std::sregex_iterator(rhs.begin(), rhs.end(), symbolPattern); it != std::sregex_iterator(); ++it){
+            std::string symbol = it->str();
+            if(symbol == "$") continue;
+            if(!IsNonTerminal(symbol) && !terminalTokens.count(symbol)){
+                printf("%s:%d: unknown terminal '%s'\n", argv[1], lineNumber, symbol.c_str());
+                return 1;
+            }
+            prod.rhs.push_back(symbol);
+        }
+        prod.name = EnumName(prod.lhs) + "__" + (prod.rhs.empty() ? "EMPTY" : EnumName(prod.rhs[0]));
+
+        if(std::find(nonTerminals.begin(), nonTerminals.end(), prod.lhs) == nonTerminals.end())
+            nonTerminals.push_back(prod.lhs);
+        productions.push_back(prod);
+    }
+
+    if(productions.empty()){
+        printf("%s: no productions found\n", argv[1]);
+        return 1;
+    }
+    for(auto &prod : productions){
+        for(auto &symbol : prod.rhs){
+            if(IsNonTerminal(symbol) && std::find(nonTerminals.begin(), nonTerminals.end(), symbol) == nonTerminals.end()){
+                printf("%s: %s is used but never defined\n", argv[1], symbol.c_str());
+                return 1;
+            }
+        }
+    }
+
+    // Nullable, FIRST and FOLLOW by iterating until nothing changes
+    std::set<std::string> nullable;
+    std::map<std::string, std::set<std::string>> first, follow;
+    follow[productions[0].lhs].insert(END_OF_INPUT);
+
+    auto firstOfSequence = [&](const std::vector<std::string> &symbols, size_t from, bool &allNullable){
+        std::set<std::string> result;
+        allNullable = true;
+        for(size_t i = from; i<symbols.size(); i++){
+            auto &symbol = symbols[i];
+            if(!IsNonTerminal(symbol)){
+                result.insert(terminalTokens.at(symbol));
+                allNullable = false;
+                break;
+            }
+            result.insert(first[symbol].begin(), first[symbol].end());
+            if(!nullable.count(symbol)){
+                allNullable = false;
+                break;
+            }
+        }
+        return result;
+    };
+
+    bool changed = true;
+    while(changed){
+        changed = false;
+        for(auto &prod : productions){
+            bool allNullable;
+            auto firsts = firstOfSequence(prod.rhs, 0, allNullable);
+            auto &lhsFirst = first[prod.lhs];
+            size_t before = lhsFirst.size();
+            lhsFirst.insert(firsts.begin(), firsts.end());
+            if(lhsFirst.size() != before) changed = true;
+            if(allNullable && nullable.insert(prod.lhs).second) changed = true;
+
+            for(size_t i = 0; i<prod.rhs.size(); i++){
+                if(!IsNonTerminal(prod.rhs[i])) continue;
+                auto &symbolFollow = follow[prod.rhs[i]];
+                size_t before = symbolFollow.size();
+                bool restNullable;
+                auto rest = firstOfSequence(prod.rhs, i + 1, restNullable);
+                symbolFollow.insert(rest.begin(), rest.end());
+                if(restNullable){
+                    auto lhsFollow = follow[prod.lhs];
+                    symbolFollow.insert(lhsFollow.begin(), lhsFollow.end());
+                }
+                if(symbolFollow.size() != before) changed = true;
+            }
+        }
+    }
+
+    // Predict sets, table[nonTerminal][token] = production index
+    std::map<std::string, std::map<std::string, size_t>> table;
+    bool conflicts = false;
+    for(size_t p = 0; p<productions.size(); p++){
+        auto &prod = productions[p];
+        bool allNullable;
+        auto predict = firstOfSequence(prod.rhs, 0, allNullable);
+        if(allNullable)
+            predict.insert(follow[prod.lhs].begin(), follow[prod.lhs].end());
+
+        for(auto &token : predict){
+            auto &row = table[prod.lhs];
+            auto existing = row.find(token);
+            if(existing == row.end()){
+                row[token] = p;
+                continue;
+            }
+            auto &other = productions[existing->second];
+            if(other.rhs.empty() != prod.rhs.empty()){
+                // Prefer shifting into the non empty production (dangling else)
+                if(other.rhs.empty())
+                    existing->second = p;
+                continue;
+            }
+            printf("%s: LL(1) conflict in %s on %s between %s and %s\n", argv[1],
+                    prod.lhs.c_str(), token.c_str(), other.name.c_str(), prod.name.c_str());
+            conflicts = true;
+        }
+    }
+    if(conflicts)
+        return 1;
+
+    std::ostringstream out;
+    out << "// Generated by grammar_gen from " << argv[1] << ". Do not edit.\n"
+        << "#ifndef GRAMMAR_TABLES_H\n"
+        << "#define GRAMMAR_TABLES_H\n\n"
+        << "#include <stdint.h>\n"
+        << "#include \"lexar.h\"\n\n"
+        << "enum GrammarNonTerminal{\n";
+    for(auto &nt : nonTerminals)
+        out << "    NT_" << EnumName(nt) << ",\n";
+    out << "    NT_COUNT\n};\n\n"
+        << "enum GrammarProduction{\n";
+    for(auto &prod : productions){
+        out << "    " << prod.name << ", //" << prod.lhs << " =>";
+        for(auto &symbol : prod.rhs) out << " " << symbol;
+        if(prod.rhs.empty()) out << " $";
+        out << "\n";
+    }
+    out << "    NO_PRODUCTION = 0xFF\n};\n\n"
+        << "struct PredictTable{\n"
+        << "    uint8_t entries[NT_COUNT][ERR + 1];\n"
+        << "};\n\n"
+        << "constexpr PredictTable BuildPredictTable(){\n"
+        << "    PredictTable table{};\n"
+        << "    for(int nt = 0; nt<NT_COUNT; nt++)\n"
+        << "        for(int token = 0; token<=ERR; token++)\n"
+        << "            table.entries[nt][token] = NO_PRODUCTION;\n";
+    for(auto &nt : nonTerminals){
+        for(auto &entry : table[nt])
+            out << "    table.entries[NT_" << EnumName(nt) << "][" << entry.first << "] = "
+                << productions[entry.second].name << ";\n";
+    }
+    out << "    return table;\n"
+        << "}\n\n"
+        << "static constexpr PredictTable predictTable = BuildPredictTable();\n\n"
+        << "constexpr GrammarProduction Predict(GrammarNonTerminal nt, LexicalTokenType token){\n"
+        << "    return (GrammarProduction) predictTable.entries[nt][token];\n"
+        << "}\n\n"
+        << "// What to report as expected when no production matches\n"
+        << "static constexpr LexicalTokenType expectedToken[NT_COUNT] = {\n";
+    // Leftmost terminal of the first non-empty production, in grammar order
+    std::function<std::string(const std::string&)> leftmostTerminal = [&](const std::string &symbol){
+        if(!IsNonTerminal(symbol))
+            return terminalTokens.at(symbol);
+        for(auto &prod : productions){
+            if(prod.lhs == symbol && !prod.rhs.empty())
+                return leftmostTerminal(prod.rhs[0]);
+        }
+        return END_OF_INPUT;
+    };
+    for(auto &nt : nonTerminals)
+        out << "    " << leftmostTerminal(nt) << ", //" << nt << "\n";
+    out << "};\n\n"
+        << "#endif\n";
+
+    std::ofstream outFile(argv[2]);
+    if(!outFile){
+        printf("Could not write %s\n", argv[2]);
+        return 1;
+    }
+    outFile << out.str();
+    return 0;
+}
@@ -0,0 +1,74 @@
+#include "jit.h"
+#include "backend.h"
+#include "runtime.h"
+
+#include <stdio.h>
+#include <unistd.h>
+
+#include "llvm/ExecutionEngine/Orc/LLJIT.h"
+#include "llvm/ExecutionEngine/Orc/Mangling.h"
+#include "llvm/ExecutionEngine/Orc/ThreadSafeModule.h"
+
+using namespace llvm;
+
+// The real stdout while SeparateCompilerOutput has it pointed at stderr
+static int programOutput = -1;
+
+void SeparateCompilerOutput(){
+    fflush(stdout);
+    programOutput = dup(STDOUT_FILENO);
+    if(programOutput >= 0)
+        dup2(STDERR_FILENO, STDOUT_FILENO);
+}
+
+static int Fail(const char *what, Error error){
+    printf("%s: %s\n", what, toString(std::move(error)).c_str());
+    return 1;
+}
+
+int RunModule(std::unique_ptr<Module> module, std::unique_ptr<LLVMContext> context, OptimizationLevel level,
+              const TargetSelection &target){
+    // Sets the host's triple and data layout, which the JIT expects too
+    auto machine = CreateTargetMachine(*module, level, target);
+    if(!machine || !OptimizeModule(*module, *machine, level))
+        return 1;
+
+    auto host = orc::JITTargetMachineBuilder::detectHost();
+    if(!host)
+        return Fail("Could not set up the JIT", host.takeError());
+    host->setCodeGenOptLevel(CodeGenLevel(level));
+    // Without -march and friends the JIT already generates code for this very CPU
+    if(!target.cpu.empty() || !target.features.empty()){
+        host->setCPU(target.cpu.empty() ? "generic" : target.cpu);
+        host->getFeatures() = SubtargetFeatures(target.features);
+    }
+    auto jit = orc::LLJITBuilder().setJITTargetMachineBuilder(std::move(*host)).create();
+    if(!jit)
+        return Fail("Could not set up the JIT", jit.takeError());
+
+    // What writeln and readln call, the compiler links the same runtime library
+    orc::MangleAndInterner mangle((*jit)->getExecutionSession(), (*jit)->getDataLayout());
+    orc::SymbolMap runtime;
+    runtime[mangle("pascal_writeln")] = JITEvaluatedSymbol(pointerToJITTargetAddress(&pascal_writeln), JITSymbolFlags::Exported);
+    runtime[mangle("pascal_readln")] = JITEvaluatedSymbol(pointerToJITTargetAddress(&pascal_readln), JITSymbolFlags::Exported);
+    if(Error error = (*jit)->getMainJITDylib().define(orc::absoluteSymbols(std::move(runtime))))
+        return Fail("Could not bind the runtime", std::move(error));
+
+    if(Error error = (*jit)->addIRModule(orc::ThreadSafeModule(std::move(module), std::move(context))))
+        return Fail("Could not add the module to the JIT", std::move(error));
+    auto entry = (*jit)->lookup("main");
+    if(!entry)
+        return Fail("Could not compile main", entry.takeError());
+
+    // The runtime writes to the file descriptor, what the compiler printed has to come first
+    fflush(stdout);
+    if(programOutput >= 0){
+        dup2(programOutput, STDOUT_FILENO);
+        close(programOutput);
+        programOutput = -1;
+    }
+    auto programMain = jitTargetAddressToFunction<void (*)()>(entry->getAddress());
+    programMain();
+    pascal_flush();
+    return 0;
+}
@@ -0,0 +1,32 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include <memory>
+
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Passes/OptimizationLevel.h"
+
+#include "backend.h"
+
+/*
+ * compiler --run
+ *
+ * Optimizes the module as -O would, compiles it in memory with ORC's LLJIT
+ * and calls its main in this process. Nothing is written to disk and no
+ * other program runs. The runtime library the builtins are lowered to (see
+ * runtime.h) is bound to the copy linked into the compiler, the program can't
+ * reach any other symbol.
+ *
+ * Takes the context along with the module since the JIT owns both from here.
+ * Returns the exit code for the compiler, 1 if the program couldn't be run.
+ */
+// Points stdout at stderr, so the AST dump, IR and errors the compiler prints
+// on the way don't end up in the program's output. RunModule gives the real
+// stdout back to the program just before calling its main.
+void SeparateCompilerOutput();
+
+int RunModule(std::unique_ptr<llvm::Module> module, std::unique_ptr<llvm::LLVMContext> context,
+              llvm::OptimizationLevel level, const TargetSelection &target);
+
+#endif
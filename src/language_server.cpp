@@ -0,0 +1,491 @@
+#include <algorithm>
+#include <functional>
+#include <iostream>
+#include <stdlib.h>
+#include <string.h>
+
+#include "llvm/Support/raw_ostream.h"
+
+#include "language_server.h"
+#include "ast_visitor.h"
+#include "lexar.h"
+#include "parser.h"
+
+using namespace llvm;
+
+// LSP SymbolKind values we hand out
+enum{
+    SYMBOL_MODULE = 2,
+    SYMBOL_FUNCTION = 12,
+    SYMBOL_VARIABLE = 13,
+    SYMBOL_CONSTANT = 14
+};
+
+// JSON-RPC error codes
+enum{
+    PARSE_ERROR = -32700,
+    INVALID_REQUEST = -32600,
+    METHOD_NOT_FOUND = -32601
+};
+
+LanguageServer::LanguageServer(std::istream &in, std::ostream &out): in(in), out(out){
+}
+
+int LanguageServer::Run(){
+    std::string message;
+    while(ReadMessage(message)){
+        auto parsed = json::parse(message);
+        if(!parsed){
+            consumeError(parsed.takeError());
+            ReplyError(nullptr, PARSE_ERROR, "Message is not valid JSON");
+            continue;
+        }
+        auto object = parsed->getAsObject();
+        if(!object){
+            ReplyError(nullptr, INVALID_REQUEST, "Message is not an object");
+            continue;
+        }
+        if(!Handle(*object))
+            return shutdownRequested ? 0 : 1;
+    }
+    //Input closed without an exit notification
+    return 1;
+}
+
+/************************/
+/*       Transport      */
+/************************/
+
+bool LanguageServer::ReadMessage(std::string &message){
+    size_t contentLength = 0;
+    std::string line;
+    while(std::getline(in, line)){
+        if(!line.empty() && line.back() == '\r')
+            line.pop_back();
+        if(!line.empty()){
+            if(line.compare(0, 15, "Content-Length:") == 0)
+                contentLength = strtoul(line.c_str() + 15, nullptr, 10);
+            continue;
+        }
+        //Blank line ends the headers
+        if(!contentLength)
+            continue;
+        message.resize(contentLength);
+        in.read(&message[0], contentLength);
+        return (size_t) in.gcount() == contentLength;
+    }
+    return false;
+}
+
+void LanguageServer::Send(json::Value message){
+    std::string body;
+    raw_string_ostream stream(body);
+    stream << message;
+    stream.flush();
+    out << "Content-Length: " << body.size() << "\r\n\r\n" << body;
+    out.flush();
+}
+
+void LanguageServer::Reply(const json::Value &id, json::Value result){
+    Send(json::Object{{"jsonrpc", "2.0"}, {"id", id}, {"result", std::move(result)}});
+}
+
+void LanguageServer::ReplyError(const json::Value &id, int code, const std::string &message){
+    Send(json::Object{{"jsonrpc", "2.0"}, {"id", id},
+            {"error", json::Object{{"code", code}, {"message", message}}}});
+}
+
+static std::string GetURI(const json::Object &params){
+    auto textDocument = params.getObject("textDocument");
+    if(!textDocument)
+        return "";
+    auto uri = textDocument->getString("uri");
+    return uri ? uri->str() : "";
+}
+
+bool LanguageServer::Handle(const json::Object &message){
+    auto method = message.getString("method");
+    const json::Value *id = message.get("id");
+    //Responses to requests we never make
+    if(!method)
+        return true;
+
+    static const json::Object noParams;
+    const json::Object *params = message.getObject("params");
+    if(!params)
+        params = &noParams;
+
+    //These are requests, there's nothing to answer without an id
+    bool isRequest = *method == "initialize" || *method == "shutdown" ||
+                     *method == "textDocument/documentSymbol" || *method == "textDocument/definition";
+    if(isRequest && !id){
+        ReplyError(nullptr, INVALID_REQUEST, method->str() + " is a request but has no id");
+        return true;
+    }
+
+    if(*method == "initialize"){
+        Reply(*id, json::Object{
+                {"capabilities", json::Object{
+                    //Incremental, so we get just the edited range
+                    {"textDocumentSync", json::Object{{"openClose", true}, {"change", 2}}},
+                    {"documentSymbolProvider", true},
+                    {"definitionProvider", true}}},
+                {"serverInfo", json::Object{{"name", "compiler"}}}});
+    }
+    else if(*method == "shutdown"){
+        shutdownRequested = true;
+        Reply(*id, nullptr);
+    }
+    else if(*method == "exit"){
+        return false;
+    }
+    else if(*method == "textDocument/didOpen"){
+        auto textDocument = params->getObject("textDocument");
+        auto text = textDocument ? textDocument->getString("text") : None;
+        Open(GetURI(*params), text ? text->str() : "");
+    }
+    else if(*method == "textDocument/didChange"){
+        auto changes = params->getArray("contentChanges");
+        if(changes)
+            Change(GetURI(*params), *changes);
+    }
+    else if(*method == "textDocument/didClose"){
+        auto uri = GetURI(*params);
+        documents.erase(uri);
+        Send(json::Object{{"jsonrpc", "2.0"}, {"method", "textDocument/publishDiagnostics"},
+                {"params", json::Object{{"uri", uri}, {"diagnostics", json::Array()}}}});
+    }
+    else if(*method == "textDocument/documentSymbol"){
+        Reply(*id, DocumentSymbols(GetURI(*params)));
+    }
+    else if(*method == "textDocument/definition"){
+        auto position = params->getObject("position");
+        Reply(*id, position ? Definition(GetURI(*params), *position) : nullptr);
+    }
+    else if(id){
+        ReplyError(*id, METHOD_NOT_FOUND, "Unhandled method " + method->str());
+    }
+    return true;
+}
+
+/************************/
+/*       Documents      */
+/************************/
+
+void LanguageServer::Open(const std::string &uri, std::string text){
+    Document &doc = documents[uri];
+    doc.text = std::move(text);
+    doc.lines = LineTable::FromText(uri, doc.text.data(), doc.text.size());
+    ParseAll(doc);
+    PublishDiagnostics(uri);
+}
+
+void LanguageServer::Change(const std::string &uri, const json::Array &changes){
+    auto found = documents.find(uri);
+    if(found == documents.end())
+        return;
+    Document &doc = found->second;
+
+    //A single ranged edit says exactly what changed, otherwise diff against a copy
+    auto single = changes.size() == 1 ? changes[0].getAsObject() : nullptr;
+    bool exactRange = single && single->getObject("range");
+    std::string oldText = exactRange ? "" : doc.text;
+    size_t oldSize = doc.text.size();
+    uint32_t changeStart = 0, oldChangeEnd = 0;
+    for(auto &change : changes){
+        auto object = change.getAsObject();
+        if(!object)
+            continue;
+        auto text = object->getString("text");
+        if(!text)
+            continue;
+        auto range = object->getObject("range");
+        auto start = range ? range->getObject("start") : nullptr;
+        auto end = range ? range->getObject("end") : nullptr;
+        if(start && end){
+            changeStart = OffsetOf(doc, *start);
+            oldChangeEnd = std::max(changeStart, OffsetOf(doc, *end));
+            doc.text.replace(changeStart, oldChangeEnd - changeStart, text->str());
+        }
+        else{
+            doc.text = text->str();
+        }
+        doc.lines = LineTable::FromText(uri, doc.text.data(), doc.text.size());
+    }
+
+    //Several edits or a full replacement, work out what differs
+    if(!exactRange){
+        size_t shorter = std::min(oldText.size(), doc.text.size());
+        size_t prefix = 0;
+        while(prefix < shorter && oldText[prefix] == doc.text[prefix])
+            prefix++;
+        size_t suffix = 0;
+        while(suffix < shorter - prefix &&
+              oldText[oldText.size() - 1 - suffix] == doc.text[doc.text.size() - 1 - suffix])
+            suffix++;
+        changeStart = prefix;
+        oldChangeEnd = oldText.size() - suffix;
+    }
+    int64_t delta = (int64_t) doc.text.size() - (int64_t) oldSize;
+
+    if(!ReparseDeclaration(doc, changeStart, oldChangeEnd, delta))
+        ParseAll(doc);
+    PublishDiagnostics(uri);
+}
+
+void LanguageServer::ParseAll(Document &doc){
+    Lexar lexar = Lexar();
+    lexar.quiet = true;
+    lexar.Init(doc.text);
+    Parser parser = Parser(&lexar);
+    parser.quiet = true;
+    if(parser.Parse()){
+        doc.tree = std::move(parser.tree);
+        doc.hasError = false;
+        return;
+    }
+    doc.tree.reset();
+    doc.hasError = true;
+    doc.errorOffset = parser.errorOffset;
+    doc.errorLength = parser.errorLength;
+    doc.errorMessage = parser.errorMessage;
+}
+
+static void MoveLocations(AST *node, int64_t delta){
+    node->SetLocation(node->GetOffset() + delta, node->GetLength());
+    ForEachChild(node, [&](AST *child){ MoveLocations(child, delta); });
+}
+
+bool LanguageServer::ReparseDeclaration(Document &doc, uint32_t changeStart, uint32_t oldChangeEnd, int64_t delta){
+    auto program = dyn_cast_or_null<ProgramAST>(doc.tree.get());
+    if(!program)
+        return false;
+
+    auto &declarations = program->GetDeclarations();
+    //Declarations are in source order, find the first one ending after the change
+    auto found = std::lower_bound(declarations.begin(), declarations.end(), changeStart,
+            [](const std::unique_ptr<AST> &decl, uint32_t offset){
+                return decl->GetOffset() + decl->GetLength() <= offset;
+            });
+    if(found == declarations.end() || !isa<FunctionAST>(found->get()))
+        return false;
+
+    //Strictly inside, so the keyword and the closing semicolon are untouched
+    AST *old = found->get();
+    uint32_t start = old->GetOffset();
+    uint32_t oldEnd = start + old->GetLength();
+    if(!(start < changeStart && oldChangeEnd < oldEnd))
+        return false;
+    //Some other part of the file is broken, the tree can't be trusted there
+    if(doc.hasError && doc.brokenDeclarationStart != start)
+        return false;
+
+    uint32_t newLength = old->GetLength() + delta;
+    Lexar lexar = Lexar();
+    lexar.quiet = true;
+    lexar.Init(doc.text.substr(start, newLength), start);
+    Parser parser = Parser(&lexar);
+    parser.quiet = true;
+    if(parser.ParseDeclaration()){
+        *found = std::move(parser.tree);
+        doc.hasError = false;
+    }
+    else{
+        //Keep the old subtree standing in for it until it parses again
+        old->SetLocation(start, newLength);
+        doc.hasError = true;
+        doc.brokenDeclarationStart = start;
+        doc.errorOffset = parser.errorOffset;
+        doc.errorLength = parser.errorLength;
+        doc.errorMessage = parser.errorMessage;
+    }
+
+    if(delta){
+        for(auto later = found + 1; later != declarations.end(); ++later)
+            MoveLocations(later->get(), delta);
+        if(program->GetStatementSequence())
+            MoveLocations(program->GetStatementSequence().get(), delta);
+        program->SetLocation(program->GetOffset(), program->GetLength() + delta);
+    }
+    return true;
+}
+
+void LanguageServer::PublishDiagnostics(const std::string &uri){
+    const Document &doc = documents[uri];
+    json::Array diagnostics;
+    if(doc.hasError){
+        diagnostics.push_back(json::Object{
+                {"range", Range(doc, doc.errorOffset, doc.errorLength)},
+                {"severity", 1},
+                {"source", "compiler"},
+                {"message", doc.errorMessage}});
+    }
+    Send(json::Object{{"jsonrpc", "2.0"}, {"method", "textDocument/publishDiagnostics"},
+            {"params", json::Object{{"uri", uri}, {"diagnostics", std::move(diagnostics)}}}});
+}
+
+/************************/
+/*       Positions      */
+/************************/
+
+json::Value LanguageServer::Range(const Document &doc, uint32_t offset, uint32_t length){
+    auto start = doc.lines.Resolve(offset);
+    auto end = doc.lines.Resolve(offset + length);
+    return json::Object{
+        {"start", json::Object{{"line", start.line - 1}, {"character", start.column - 1}}},
+        {"end", json::Object{{"line", end.line - 1}, {"character", end.column - 1}}}};
+}
+
+uint32_t LanguageServer::OffsetOf(const Document &doc, const json::Object &position){
+    auto line = position.getInteger("line");
+    auto character = position.getInteger("character");
+    uint32_t offset = doc.lines.GetLineStart(line ? *line + 1 : 1) + (character ? *character : 0);
+    return std::min<uint32_t>(offset, doc.text.size());
+}
+
+/************************/
+/*        Symbols       */
+/************************/
+
+static json::Object Symbol(const std::string &name, int kind, json::Value range, json::Value selection){
+    return json::Object{{"name", name}, {"kind", kind}, {"range", std::move(range)},
+                        {"selectionRange", std::move(selection)}};
+}
+
+json::Value LanguageServer::DocumentSymbols(const std::string &uri){
+    auto found = documents.find(uri);
+    if(found == documents.end() || !found->second.tree)
+        return json::Array();
+    const Document &doc = found->second;
+
+    std::function<json::Array(std::vector<std::unique_ptr<AST>>&)> symbolsOf;
+    symbolsOf = [&](std::vector<std::unique_ptr<AST>> &declarations){
+        json::Array symbols;
+        for(auto &decl : declarations){
+            auto range = Range(doc, decl->GetOffset(), decl->GetLength());
+            if(auto vars = dyn_cast<VariableDeclarationsAST>(decl.get())){
+                for(auto &ofType : vars->GetDeclarations()){
+                    for(auto &ident : cast<VariableDeclarationsOfTypeAST>(ofType.get())->GetIdentifiers()){
+                        auto identRange = Range(doc, ident->GetOffset(), ident->GetLength());
+                        symbols.push_back(Symbol(ident->GetName(), SYMBOL_VARIABLE, identRange, identRange));
+                    }
+                }
+            }
+            else if(auto constants = dyn_cast<ConstantDeclarationsAST>(decl.get())){
+                //Constants don't keep their own location, point at the const part
+                for(auto &constant : constants->GetConstants())
+                    symbols.push_back(Symbol(constant.name, SYMBOL_CONSTANT, range, range));
+            }
+            else if(auto proto = dyn_cast<PrototypeAST>(decl.get())){
+                symbols.push_back(Symbol(proto->GetName(), SYMBOL_FUNCTION, range, range));
+            }
+            else if(auto function = dyn_cast<FunctionAST>(decl.get())){
+                auto proto = function->GetPrototype();
+                auto symbol = Symbol(proto->GetName(), SYMBOL_FUNCTION, range,
+                                     Range(doc, proto->GetOffset(), proto->GetLength()));
+                symbol["detail"] = proto->GetReturnType() == EOI ? "procedure" : "function";
+                if(auto block = dyn_cast_or_null<MainBlockAST>(function->GetBody().get()))
+                    symbol["children"] = symbolsOf(block->GetDeclarations());
+                symbols.push_back(std::move(symbol));
+            }
+        }
+        return symbols;
+    };
+
+    auto program = cast<ProgramAST>(doc.tree.get());
+    auto range = Range(doc, program->GetOffset(), program->GetLength());
+    auto symbol = Symbol(program->GetName(), SYMBOL_MODULE, range, range);
+    symbol["children"] = symbolsOf(program->GetDeclarations());
+    return json::Array{std::move(symbol)};
+}
+
+/************************/
+/*      Definitions     */
+/************************/
+
+// Finds the variable or call under offset, collecting the functions it sits in
+static bool FindReference(AST *node, uint32_t offset, std::vector<FunctionAST*> &scopes, std::string &name){
+    if(offset < node->GetOffset() || offset > node->GetOffset() + node->GetLength())
+        return false;
+    if(auto var = dyn_cast<VariableIdentifierAST>(node)){
+        name = var->GetName();
+        return true;
+    }
+    if(auto call = dyn_cast<CallExpessionsAst>(node)){
+        if(offset <= call->GetOffset() + call->GetCallee().size()){
+            name = call->GetCallee();
+            return true;
+        }
+    }
+    auto function = dyn_cast<FunctionAST>(node);
+    if(function)
+        scopes.push_back(function);
+    bool found = false;
+    ForEachChild(node, [&](AST *child){
+        if(!found)
+            found = FindReference(child, offset, scopes, name);
+    });
+    if(function && !found)
+        scopes.pop_back();
+    return found;
+}
+
+static AST *LookupIn(std::vector<std::unique_ptr<AST>> &declarations, const std::string &name){
+    AST *forward = nullptr;
+    for(auto &decl : declarations){
+        if(auto vars = dyn_cast<VariableDeclarationsAST>(decl.get())){
+            for(auto &ofType : vars->GetDeclarations()){
+                for(auto &ident : cast<VariableDeclarationsOfTypeAST>(ofType.get())->GetIdentifiers()){
+                    if(ident->GetName() == name)
+                        return ident.get();
+                }
+            }
+        }
+        else if(auto constants = dyn_cast<ConstantDeclarationsAST>(decl.get())){
+            for(auto &constant : constants->GetConstants()){
+                if(constant.name == name)
+                    return constants;
+            }
+        }
+        else if(auto function = dyn_cast<FunctionAST>(decl.get())){
+            if(function->GetPrototype()->GetName() == name)
+                return function->GetPrototype();
+        }
+        //Prefer the declaration with the body over a forward one
+        else if(auto proto = dyn_cast<PrototypeAST>(decl.get())){
+            if(proto->GetName() == name && !forward)
+                forward = proto;
+        }
+    }
+    return forward;
+}
+
+json::Value LanguageServer::Definition(const std::string &uri, const json::Object &position){
+    auto found = documents.find(uri);
+    if(found == documents.end() || !found->second.tree)
+        return nullptr;
+    const Document &doc = found->second;
+
+    std::vector<FunctionAST*> scopes;
+    std::string name;
+    if(!FindReference(doc.tree.get(), OffsetOf(doc, position), scopes, name))
+        return nullptr;
+
+    AST *definition = nullptr;
+    for(auto scope = scopes.rbegin(); scope != scopes.rend() && !definition; ++scope){
+        auto proto = (*scope)->GetPrototype();
+        //The function's own name is its result variable
+        bool isParameter = std::any_of(proto->GetArgs().begin(), proto->GetArgs().end(),
+                [&](const TypeNamePair &arg){ return arg.name == name; });
+        if(isParameter || proto->GetName() == name)
+            definition = proto;
+        else if(auto block = dyn_cast_or_null<MainBlockAST>((*scope)->GetBody().get()))
+            definition = LookupIn(block->GetDeclarations(), name);
+    }
+    if(!definition)
+        definition = LookupIn(cast<ProgramAST>(doc.tree.get())->GetDeclarations(), name);
+    if(!definition)
+        return nullptr;
+
+    return json::Object{{"uri", uri}, {"range", Range(doc, definition->GetOffset(), definition->GetLength())}};
+}
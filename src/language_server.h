@@ -0,0 +1,82 @@
+#ifndef LANGUAGE_SERVER_H
+#define LANGUAGE_SERVER_H
+
+#include <istream>
+#include <map>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <stdint.h>
+
+#include "llvm/Support/JSON.h"
+
+#include "ast.h"
+#include "source_location.h"
+
+/*
+ * compiler --lsp
+ *
+ * A language server speaking LSP (JSON-RPC with Content-Length headers) over
+ * stdin/stdout. It serves diagnostics for parse errors, document symbols and
+ * go-to-definition.
+ *
+ * Every open document keeps its text, line table and AST. When it changes only
+ * the top level procedure or function the edit landed in is lexed and parsed
+ * again, with ParseDeclaration, and is swapped into the tree. Everything after
+ * it just has its offsets moved. Edits anywhere else (the program header, the
+ * var/const parts, the main body, between declarations) fall back to parsing
+ * the whole file.
+ *
+ * If the reparsed declaration doesn't parse, the old subtree is kept in its
+ * place until it does, so typing inside one procedure stays incremental even
+ * while it's broken. Only that procedure's symbols are out of date meanwhile.
+ */
+class LanguageServer{
+    public:
+        LanguageServer(std::istream &in, std::ostream &out);
+
+        // Serves until exit, returns the exit code the protocol asks for
+        int Run();
+
+    private:
+        struct Document{
+            std::string text;
+            LineTable lines;
+            std::unique_ptr<AST> tree;
+
+            bool hasError = false;
+            // Start of the top level declaration that failed to reparse, the
+            // only part of the tree that's stale. Unused if the whole file failed.
+            uint32_t brokenDeclarationStart = 0;
+            uint32_t errorOffset = 0;
+            uint32_t errorLength = 0;
+            std::string errorMessage;
+        };
+
+        std::istream &in;
+        std::ostream &out;
+        std::map<std::string, Document> documents;
+        bool shutdownRequested = false;
+
+        bool ReadMessage(std::string &message);
+        void Send(llvm::json::Value message);
+        void Reply(const llvm::json::Value &id, llvm::json::Value result);
+        void ReplyError(const llvm::json::Value &id, int code, const std::string &message);
+
+        // Returns false once the client asked to exit
+        bool Handle(const llvm::json::Object &message);
+
+        void Open(const std::string &uri, std::string text);
+        void Change(const std::string &uri, const llvm::json::Array &changes);
+        void PublishDiagnostics(const std::string &uri);
+        llvm::json::Value DocumentSymbols(const std::string &uri);
+        llvm::json::Value Definition(const std::string &uri, const llvm::json::Object &position);
+
+        void ParseAll(Document &doc);
+        bool ReparseDeclaration(Document &doc, uint32_t changeStart, uint32_t oldChangeEnd, int64_t delta);
+
+        static llvm::json::Value Range(const Document &doc, uint32_t offset, uint32_t length);
+        static uint32_t OffsetOf(const Document &doc, const llvm::json::Object &position);
+};
+
+#endif
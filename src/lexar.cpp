@@ -1,19 +1,18 @@
 #include <stdio.h>
-#include <sstream>
 #include <string.h>
 #include <string>
 #include "lexar.h"
 
 using namespace std;
 
-const char *lexicalTokenNames[51] = {
+const char *lexicalTokenNames[52] = {
 	"IDENTIFIER", "NUMBER", "PLUS", "MINUS", "TIMES", "DIVIDE", "AND", "OR", "MOD", "DIV",
 	"EQUAL", "NOTEQUAL", "LESSTHAN", "GREATERTHAN", "LESSTHANEQ", "GREATERTHANEQ",
 	"LEFTPAREN", "RIGHTPAREN", "LEFTBRACKET", "RIGHTBRACKET",
 	"ASSIGN", "COMMA", "COLON", "SEMICOLON", "DOT DOT", "DOT", "kwVAR", "kwCONST", 
 	"kwIF", "kwTHEN", "kwELSE", "kwBEGIN", "kwEND", "kwEXIT", "kwBREAK",
 	"kwWHILE", "kwDO", "kwREAD", "kwWRITE",
-    "kwFOR", "kwTO", "kwDOWNTO",
+    "kwFOR", "kwTO", "kwDOWNTO", "kwSTEP",
     "kwPROGRAM", "kwPROCEDURE", "kwFUNCTION", "kwFORWARD", "kwARRAY", "kwINTEGER", "kwOF", 
 	"EOI", "ERR"
 };
@@ -34,6 +33,7 @@ const struct {const char* word; LexicalTokenType symb;} keyWordTable[] ={
 	{"end", KW_END},
 	{"downto", KW_DOWNTO},
 	{"to", KW_TO},
+	{"step", KW_STEP},
 	{"of", KW_OF},
 	{"if", KW_IF},
 	{"then", KW_THEN},
@@ -77,14 +77,17 @@ Lexar::~Lexar(){
 	inputElement.inputFile = NULL;
 }
 
-void Lexar::Error(string message){
-	printf("ERROR ln: %d, col: %d; %s\n", lineNumber,columnNumber, message.c_str());
+void Lexar::Error(uint32_t offset, string message){
+	if(quiet) return;
+	printf("ERROR %s; %s\n", lineTable.Describe(offset).c_str(), message.c_str());
 }
 
 bool Lexar::Init(const char* fileN){
     int len = strlen(fileN);
     this->fileName.assign(fileN, len);
-	lineNumber = 1;
+	charOffset = 0;
+	lineTable.Clear();
+	lineTable.fileName = this->fileName;
 	if(!fileN){
 		inputElement.inputFile = &std::cin;
 	}
@@ -99,14 +102,16 @@ bool Lexar::Init(const char* fileN){
 	return true;
 }
 
-bool Lexar::Init(string input){
+bool Lexar::Init(string input, uint32_t startOffset){
     inputElement.inputText = input;
+    inputElement.textPosition = 0;
+	charOffset = startOffset;
+	lineTable.Clear();
 	currentInput = ReadInput();
-	columnNumber = 0;
     return true;
 }
 
-LexicalTokenType Lexar::GetKeyWord(string id){
+LexicalTokenType Lexar::GetKeyWord(const string &id){
 	int i = 0;
 	while(keyWordTable[i].word){
 		if(id.compare(keyWordTable[i].word) == 0){
@@ -123,18 +128,16 @@ char Lexar::GetNextChar(){
         next = inputElement.inputFile->get();
     }
     else{
-        if(inputElement.inputText.size() > 0){
-            next = inputElement.inputText.at(0);
-            inputElement.inputText.erase(0, 1);
+        if(inputElement.textPosition < inputElement.inputText.size()){
+            next = inputElement.inputText[inputElement.textPosition++];
         }
         else{
             next = EOF;
         }
     }
-    columnNumber++;
+    charOffset++;
     if(next == '\n') {
-        lineNumber++;
-        columnNumber = 0;
+        lineTable.AddLineStart(charOffset);
     }
     return next;
 }
@@ -168,20 +171,26 @@ LexicalToken Lexar::NextToken(){
 	//Consume all white space after comment
 	while(currentInput.type == WHITE_SPACE) currentInput = ReadInput();	
 
+	//currentInput has already been read, so it sits one behind charOffset
+	uint32_t start = charOffset - 1;
+	LexicalToken token = {};
 	switch(currentInput.type){
 		case LETTER:
-			return HandleIdentKeyword();	
+			token = HandleIdentKeyword();	
 			break;
 		case NUMB:
-			return HandleNumber();
+			token = HandleNumber();
 			break;
 		case END:
-			return {.type = EOI};
+			token.type = EOI;
 			break;
 		default:
-			return HandleSpecialChars();
+			token = HandleSpecialChars();
 			break;
 	}
+	token.offset = start;
+	token.length = (charOffset - 1) - start;
+	return token;
 }
 
 LexicalToken Lexar::HandleIdentKeyword(){
@@ -197,8 +206,8 @@ LexicalToken Lexar::HandleIdentKeyword(){
 	LexicalToken returnToken;
 	returnToken.type = GetKeyWord(word);	
 
-	if(returnToken.type == IDENTIFIER){
-		returnToken.identifierName = word;
+	if(returnToken.type == IDENTIFIER && keepIdentifierNames){
+		returnToken.identifierName = std::move(word);
 	}
 
 	return returnToken;
@@ -294,23 +303,20 @@ LexicalToken Lexar::HandleSpecialChars(){
 	
 	returnToken.type = ERR;
 	returnToken.identifierName = "Unexpected token";
-	Error("Unexpected token");
+	Error(charOffset - 1, "Unexpected token");
 	currentInput = ReadInput();
 	return returnToken;
 
 }
 
 void Lexar::HandleComments(){
-	int startingLine = lineNumber;
+	//currentInput is the opening bracket
+	uint32_t start = charOffset - 1;
 	while(currentInput.value != BlockCommentClose){
 		currentInput = ReadInput();
 		if(currentInput.value == BlockCommentOpen) HandleComments();
 		else if(currentInput.type == END) {
-			ostringstream oss;
-			oss << "Unexpected end of input. Comment was started around line: "
-				<< startingLine
-				<< " but was never finished.";
-			Error(oss.str());
+			Error(start, "Unexpected end of input. The comment started here was never finished.");
 			currentInput = ReadInput();
 			return;
 		}
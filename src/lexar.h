@@ -5,6 +5,8 @@
 #include <iostream>
 #include <fstream>
 #include <stdio.h>
+#include <stdint.h>
+#include "source_location.h"
 
 
 #define MAX_LINE_LENGTH 257
@@ -20,16 +22,19 @@ enum LexicalTokenType{
 	ASSIGN, COMMA, COLON, SEMICOLON, DOTDOT, DOT, KW_VAR, KW_CONST,
 	KW_IF, KW_THEN, KW_ELSE, KW_BEGIN, KW_END, KW_EXIT, KW_BREAK,
 	KW_WHILE, KW_DO, KW_READ, KW_WRITE, 
-    KW_FOR, KW_TO, KW_DOWNTO, 
+    KW_FOR, KW_TO, KW_DOWNTO, KW_STEP, 
     KW_PROGRAM, KW_PROCEDURE, KW_FUNCTION, KW_FORWARD, KW_ARRAY, KW_INTEGER, KW_OF, 
 	EOI, ERR
 };
-extern const char *lexicalTokenNames[51];
+extern const char *lexicalTokenNames[52];
 
 struct LexicalToken{
 	LexicalTokenType type;
 	int storedNumber;
 	std::string identifierName;
+	//Byte offset of the first character and how many characters it spans
+	uint32_t offset;
+	uint32_t length;
 };
 
 struct InputToken{
@@ -40,6 +45,8 @@ struct InputToken{
 struct InputElement{
     std::istream* inputFile;
     std::string inputText;
+    //Next character of inputText to read
+    size_t textPosition;
 };
 
 class Lexar{
@@ -48,23 +55,31 @@ class Lexar{
 		~Lexar();
         std::string fileName;
 		bool Init(const char* fileName);
-        bool Init(std::string);
+        //startOffset is where the text sits in a bigger file, token offsets count from there
+        bool Init(std::string, uint32_t startOffset = 0);
 		LexicalToken NextToken();
-		int lineNumber;
-		int columnNumber;
+		//Number of characters read so far
+		uint32_t charOffset;
+		LineTable lineTable;
+		//Don't print errors, the parser reports the ERR token anyway
+		bool quiet = false;
+		//Leave identifierName empty for identifiers, their offset and length
+		//still locate the spelling
+		bool keepIdentifierNames = true;
 	private:
         InputElement inputElement;
 		InputToken currentInput;
 
 		char GetNextChar();
 		InputToken ReadInput();
-		LexicalTokenType GetKeyWord(std::string id);
+		LexicalTokenType GetKeyWord(const std::string &id);
 		LexicalToken HandleIdentKeyword();
 		LexicalToken HandleNumber();
 		LexicalToken HandleSpecialChars();
 		void HandleComments();
 
-		void Error(std::string message);
+		//offset is where in the source the error is, see lineTable
+		void Error(uint32_t offset, std::string message);
 };
 
 #endif
@@ -1,11 +1,13 @@
 #include <iostream>
 #include <fstream>
 #include <stdio.h>
+#include <string.h>
 #include "llvm/IR/LegacyPassManager.h"
 #include "llvm/Support/FileSystem.h"
 #include "llvm/Support/Host.h"
+#include "llvm/Support/MemoryBuffer.h"
 #include "llvm/Support/raw_ostream.h"
-#include "llvm/Support/TargetRegistry.h"
+#include "llvm/MC/TargetRegistry.h"
 #include "llvm/Support/TargetSelect.h"
 #include "llvm/Target/TargetMachine.h"
 #include "llvm/Target/TargetOptions.h"
@@ -13,6 +15,18 @@
 #include "lexar.h"
 #include "parser.h"
 #include "ast.h"
+#include "ast_serialize.h"
+#include "language_server.h"
+#include "name_resolution.h"
+#include "constant_folding.h"
+#include "compile_time_eval.h"
+#include "type_check.h"
+#include "call_graph.h"
+#include "symbol_index.h"
+#include "backend.h"
+#include "jit.h"
+#include "multiversion.h"
+#include "arithmetic.h"
 
 void printSymb(LexicalToken token){
 	printf("<%s", lexicalTokenNames[token.type]);
@@ -33,97 +47,189 @@ void printSymb(LexicalToken token){
 }
 int main(int argc, char *argv[]){
 	char *fileName;
-
-    if(argc != 3){
-        printf("Usage: compiler [src-path] [output-path]\n");
-        return 0;
-    }
-	fileName = argv[1];
-	printf("Input file %s.\n", fileName);
-	Lexar lexar = Lexar();
-    lexar.Init(fileName);
-    Parser parser = Parser(&lexar);
-    bool success = parser.Parse(); 
-    if(!success) {
-        printf("\nParse Error!\nExiting\n");
-        return 1;
+    char *outputName;
+    bool useASTCache = false;
+    bool syntaxOnly = false;
+    bool numberExpressions = false;
+    bool buildIndex = false;
+    bool findReferences = false;
+    llvm::OptimizationLevel optLevel = llvm::OptimizationLevel::O0;
+    bool objectOnly = false;
+    bool emitLLVM = false;
+    bool runProgram = false;
+    TargetSelection target;
+    std::vector<std::string> multiversioned;
+
+    std::vector<char*> positional;
+    for(int i = 1; i<argc; i++){
+        if(strcmp(argv[i], "--ast-cache") == 0) useASTCache = true;
+        else if(strcmp(argv[i], "--syntax-only") == 0) syntaxOnly = true;
+        else if(strcmp(argv[i], "--cse") == 0) numberExpressions = true;
+        else if(strcmp(argv[i], "--index") == 0) buildIndex = true;
+        else if(strcmp(argv[i], "--references") == 0) findReferences = true;
+        else if(ParseOptimizationLevel(argv[i], optLevel)) continue;
+        else if(ParseTargetFlag(argv[i], target)) continue;
+        else if(strcmp(argv[i], "-c") == 0) objectOnly = true;
+        else if(strcmp(argv[i], "--emit-llvm") == 0) emitLLVM = true;
+        else if(strcmp(argv[i], "--run") == 0) runProgram = true;
+        else if(strcmp(argv[i], "--ssa") == 0) SetSSACodegen(true);
+        else if(strcmp(argv[i], "--signed") == 0) SetSignedArithmetic(true);
+        else if(strncmp(argv[i], "--multiversion=", 15) == 0){
+            llvm::SmallVector<llvm::StringRef, 4> names;
+            llvm::StringRef(argv[i] + 15).split(names, ',', -1, false);
+            for(auto name : names)
+                multiversioned.push_back(name.str());
+        }
+        else if(strcmp(argv[i], "--lsp") == 0){
+            //stdout is the protocol from here on, nothing else may print to it
+            LanguageServer server(std::cin, std::cout);
+            return server.Run();
+        }
+        else positional.push_back(argv[i]);
     }
-    parser.tree->PrintNode(0);
-    printf("\n\nEnd ast print.\n");
-    printf("\nBeginning codegen\n");
-    parser.tree->codegen();
-
-    auto theModule = dynamic_cast<ProgramAST*>(parser.tree.get())->GetModule();
-    std::error_code error_code;
-    std::string bitcodeFilename = argv[2];
-    bitcodeFilename+=".bc";
-    llvm::StringRef sRefName(bitcodeFilename);
-    llvm::raw_fd_ostream raw(sRefName, error_code,  (llvm::sys::fs::OpenFlags)8);
-    llvm::WriteBitcodeToFile(*theModule, raw);
-
-/*    std::string gccComand = "gcc ";
-    gccComand+=argv[2];
-    gccComand+=".o -o ";
-    gccComand+=argv[2];
-    printf("Executing command: %s\n", gccComand.c_str());
-    std::system(gccComand.c_str());*/
 
-/*
-    auto theModule = dynamic_cast<ProgramAST*>(parser.tree.get())->GetModule();
-    // Initialize the target registry etc.
-    llvm::InitializeAllTargetInfos();
-    llvm::InitializeAllTargets();
-    llvm::InitializeAllTargetMCs();
-    llvm::InitializeAllAsmParsers();
-    llvm::InitializeAllAsmPrinters();
-
-    auto TargetTriple = llvm::sys::getDefaultTargetTriple();
-    theModule->setTargetTriple(TargetTriple);
-
-    std::string Error;
-    auto Target = llvm::TargetRegistry::lookupTarget(TargetTriple, Error);
-
-    // Print an error and exit if we couldn't find the requested target.
-    // This generally occurs if we've forgotten to initialise the
-    // TargetRegistry or we have a bogus target triple.
-    if (!Target) {
-        llvm::errs() << Error;
-        return 1;
+    if(syntaxOnly && positional.size() == 1){
+        // Nothing past the parser runs, so LLVM is never set up
+        Lexar lexar = Lexar();
+        lexar.Init(positional[0]);
+        SyntaxParser parser = SyntaxParser(&lexar);
+        return parser.Parse() ? 0 : 1;
     }
 
-    auto CPU = "generic";
-    auto Features = "";
-
-    llvm::TargetOptions opt;
-    auto RM = llvm::Optional<llvm::Reloc::Model>();
-    auto TheTargetMachine =
-      Target->createTargetMachine(TargetTriple, CPU, Features, opt, RM);
-
-    theModule->setDataLayout(TheTargetMachine->createDataLayout());
+    if(buildIndex && positional.size() >= 1){
+        std::vector<std::string> sources(positional.begin() + 1, positional.end());
+        return UpdateSymbolIndex(positional[0], sources) ? 0 : 1;
+    }
 
-    auto Filename = argv[2];
-    std::error_code EC;
-    llvm::raw_fd_ostream dest(Filename, EC, llvm::sys::fs::F_None);
+    if(findReferences && positional.size() == 2){
+        auto index = SymbolIndex::Open(positional[0]);
+        if(!index){
+            printf("Could not open symbol index %s\n", positional[0]);
+            return 1;
+        }
+        for(auto &occurrence : index->Find(positional[1])){
+            printf("%s:%u:%u: %s of %s %s\n", index->GetFilePath(occurrence.file).str().c_str(),
+                    (unsigned) occurrence.line, (unsigned) occurrence.column,
+                    symbolRoleNames[occurrence.role], symbolKindNames[occurrence.kind], positional[1]);
+        }
+        return 0;
+    }
 
-    if (EC) {
-        llvm::errs() << "Could not open file: " << EC.message();
+    if(positional.size() != (runProgram ? 1 : 2)){
+        printf("Usage: compiler [options] [src-path] [output-path]\n");
+        printf("       compiler [options] --run [src-path]\n");
+        printf("       compiler --syntax-only [src-path]\n");
+        printf("       compiler --lsp\n");
+        printf("       compiler --index [index-path] [src-paths...]\n");
+        printf("       compiler --references [index-path] [name]\n");
+        printf("Options:\n");
+        printf("  --ast-cache   Reuse output-path.ast if it was made from the same source, otherwise write it\n");
+        printf("  --syntax-only Only check the syntax, exits with 1 and prints the error if there is one\n");
+        printf("  --cse         Hash-cons pure expressions and reuse their values within a basic block\n");
+        printf("  --lsp         Run as a language server over stdin/stdout\n");
+        printf("  --index       Add the sources to the symbol index, reparsing only the ones that changed\n");
+        printf("  --references  List every definition and use of name recorded in the symbol index\n");
+        printf("  -O0 ... -O3   Optimization level, -O0 (the default) leaves the code as generated\n");
+        printf("  -Os, -Oz      Optimize for size\n");
+        printf("  -march=<cpu>  Optimize and generate code for cpu, native for this machine (-mcpu= is the same)\n");
+        printf("  -mattr=<list> Enable or disable target features, e.g. -mattr=+avx2,-fma\n");
+        printf("  --multiversion=<names>\n");
+        printf("                Clone the comma separated procedures for AVX2 and AVX-512, picked at load time\n");
+        printf("  -c            Write an object file to output-path instead of linking an executable\n");
+        printf("  --emit-llvm   Write LLVM bitcode to output-path.bc instead of linking an executable\n");
+        printf("  --run         Compile the program in memory and run it, nothing but src-path.ast (--ast-cache) is written\n");
+        printf("  --ssa         Generate variables as SSA values and phis instead of allocas\n");
+        printf("  --signed      Signed integers: div/mod round toward zero, -x negates, overflow is an error\n");
+        return 0;
+    }
+    // The JIT has no ifuncs, and already compiles for the machine it runs on
+    if(runProgram && !multiversioned.empty()){
+        printf("--multiversion can't be used with --run\n");
         return 1;
     }
+    if(runProgram)
+        SeparateCompilerOutput();
+    fileName = positional[0];
+    // With --run only the AST cache goes to disk, it sits next to the source
+    outputName = runProgram ? positional[0] : positional[1];
+    printf("Input file %s.\n", fileName);
+
+    std::unique_ptr<AST> tree;
+    LineTable lineTable;
+    ExpressionTable expressions;
+    std::string astFileName = std::string(outputName) + ".ast";
+    uint64_t sourceHash = 0;
+    if(useASTCache){
+        auto source = llvm::MemoryBuffer::getFile(fileName);
+        if(source){
+            sourceHash = HashSource((*source)->getBuffer());
+            tree = ReadASTFile(astFileName, sourceHash);
+            if(tree)
+                lineTable = LineTable::FromText(fileName, (*source)->getBufferStart(), (*source)->getBufferSize());
+        }
+        if(tree)
+            printf("Loaded AST from %s\n", astFileName.c_str());
+        // Value numbers aren't stored in the file
+        if(tree && numberExpressions)
+            NumberExpressions(tree.get(), expressions);
+    }
 
-    llvm::legacy::PassManager pass;
-    auto FileType = llvm::TargetMachine::CGFT_ObjectFile;
-
-    if (TheTargetMachine->addPassesToEmitFile(pass, dest, FileType)) {
-        llvm::errs() << "TheTargetMachine can't emit a file of this type";
+    if(!tree){
+        Lexar lexar = Lexar();
+        lexar.Init(fileName);
+        Parser parser = Parser(&lexar, BuildASTActions(numberExpressions ? &expressions : nullptr));
+        bool success = parser.Parse(); 
+        if(!success) {
+            printf("\nParse Error!\nExiting\n");
+            return 1;
+        }
+        tree = std::move(parser.tree);
+        lineTable = lexar.lineTable;
+        if(useASTCache && sourceHash)
+            WriteASTFile(tree.get(), sourceHash, astFileName);
+    }
+    SetDiagnosticLineTable(&lineTable);
+    tree->PrintNode(0);
+    printf("\n\nEnd ast print.\n");
+    printf("\nBeginning codegen\n");
+    ResolveNames(tree.get());
+    if(CheckTypes(tree.get()))
         return 1;
+    FoldConstants(tree);
+    // Evaluated calls are numbers the arithmetic around them can fold into
+    if(EvaluateConstantCalls(tree))
+        FoldConstants(tree);
+    MarkReachableProcedures(tree.get());
+    SetTargetAttributes(target.cpu, target.features);
+    tree->codegen();
+
+    auto theModule = llvm::cast<ProgramAST>(tree.get())->GetModule();
+    if(runProgram)
+        return RunModule(std::move(theModule), llvm::cast<ProgramAST>(tree.get())->GetLLVMContext(), optLevel, target);
+
+    // Bitcode at -O0 is the module exactly as generated, for llc and friends
+    std::unique_ptr<llvm::TargetMachine> machine;
+    if(!emitLLVM || optLevel != llvm::OptimizationLevel::O0){
+        machine = CreateTargetMachine(*theModule, optLevel, target);
+        if(!machine)
+            return 1;
     }
+    // Before optimizing, so each clone is optimized for its own CPU
+    if(!multiversioned.empty() && !MultiversionFunctions(*theModule, multiversioned))
+        return 1;
+    if(machine && !OptimizeModule(*theModule, *machine, optLevel))
+        return 1;
 
-    pass.run(*theModule.get());
-    dest.flush();
-
-    llvm::outs() << "Wrote " << Filename << "\n";
-    */
-    return 0;
-
+    if(emitLLVM){
+        std::error_code error_code;
+        std::string bitcodeFilename = outputName;
+        bitcodeFilename+=".bc";
+        llvm::StringRef sRefName(bitcodeFilename);
+        llvm::raw_fd_ostream raw(sRefName, error_code,  (llvm::sys::fs::OpenFlags)8);
+        llvm::WriteBitcodeToFile(*theModule, raw);
+        return 0;
+    }
+    if(objectOnly)
+        return EmitObjectFile(*theModule, *machine, outputName) ? 0 : 1;
+    return EmitExecutable(*theModule, *machine, outputName) ? 0 : 1;
 }
-
@@ -0,0 +1,161 @@
+#include "multiversion.h"
+
+#include <stdio.h>
+
+#include "llvm/ADT/Triple.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/InlineAsm.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/Support/Host.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+
+using namespace llvm;
+
+namespace{
+
+// The clones besides the baseline, in the order pascal.cpu_level numbers them
+struct FeatureLevel{
+    const char *suffix;
+    const char *features;
+    // AVX-512 CPUs default to 256 bit vectors, the clone is only worth it at 512
+    bool preferWide;
+};
+
+const FeatureLevel featureLevels[] = {
+    {"avx2", "+avx2,+fma,+bmi,+bmi2", false},
+    {"avx512", "+avx512f,+avx512vl,+avx512bw,+avx512dq,+avx2,+fma,+bmi,+bmi2", true},
+};
+
+// cpuid bits for the features above
+const uint32_t leaf1FMA = 1u << 12, leaf1OSXSAVE = 1u << 27, leaf1AVX = 1u << 28;
+const uint32_t leaf7AVX2 = (1u << 3) | (1u << 5) | (1u << 8);
+const uint32_t leaf7AVX512 = (1u << 16) | (1u << 17) | (1u << 30) | (1u << 31);
+// XCR0 bits the OS sets when it saves the YMM and the opmask/ZMM state
+const uint32_t xcr0YMM = 0x6, xcr0ZMM = 0xe6;
+
+Value *CPUID(IRBuilder<> &builder, uint32_t leaf, unsigned reg){
+    Type *i32 = builder.getInt32Ty();
+    auto type = FunctionType::get(StructType::get(i32, i32, i32, i32), {i32, i32}, false);
+    auto cpuid = InlineAsm::get(type, "cpuid", "={ax},={bx},={cx},={dx},{ax},{cx}", false);
+    Value *regs = builder.CreateCall(cpuid, {builder.getInt32(leaf), builder.getInt32(0)});
+    return builder.CreateExtractValue(regs, reg);
+}
+
+Value *HasAll(IRBuilder<> &builder, Value *reg, uint32_t bits){
+    return builder.CreateICmpEQ(builder.CreateAnd(reg, bits), builder.getInt32(bits));
+}
+
+// i32 pascal.cpu_level(), 0 for the baseline or 1 + the index into
+// featureLevels of the widest level this machine and OS support. Only inline
+// assembly, as resolvers run before relocations (and so calls to libc) are done.
+Function *GetCPULevel(Module &module){
+    const char *name = "pascal.cpu_level";
+    if(Function *existing = module.getFunction(name))
+        return existing;
+
+    LLVMContext &context = module.getContext();
+    auto F = Function::Create(FunctionType::get(Type::getInt32Ty(context), false), Function::InternalLinkage,
+                              name, &module);
+    BasicBlock *entry = BasicBlock::Create(context, "entry", F);
+    BasicBlock *features = BasicBlock::Create(context, "features", F);
+    BasicBlock *osState = BasicBlock::Create(context, "osstate", F);
+    BasicBlock *baseline = BasicBlock::Create(context, "baseline", F);
+    IRBuilder<> builder(entry);
+
+    Value *maxLeaf = CPUID(builder, 0, 0);
+    builder.CreateCondBr(builder.CreateICmpUGE(maxLeaf, builder.getInt32(7)), features, baseline);
+
+    // xgetbv faults unless the OS enabled it
+    builder.SetInsertPoint(features);
+    Value *leaf1 = CPUID(builder, 1, 2);
+    Value *leaf7 = CPUID(builder, 7, 1);
+    builder.CreateCondBr(HasAll(builder, leaf1, leaf1OSXSAVE | leaf1AVX | leaf1FMA), osState, baseline);
+
+    builder.SetInsertPoint(osState);
+    Type *i32 = builder.getInt32Ty();
+    auto xgetbvType = FunctionType::get(StructType::get(i32, i32), {i32}, false);
+    auto xgetbv = InlineAsm::get(xgetbvType, "xgetbv", "={ax},={dx},{cx}", false);
+    Value *xcr0 = builder.CreateExtractValue(builder.CreateCall(xgetbv, {builder.getInt32(0)}), 0);
+    Value *avx2 = builder.CreateAnd(HasAll(builder, xcr0, xcr0YMM), HasAll(builder, leaf7, leaf7AVX2));
+    Value *avx512 = builder.CreateAnd(avx2, builder.CreateAnd(HasAll(builder, xcr0, xcr0ZMM),
+                                                             HasAll(builder, leaf7, leaf7AVX512)));
+    builder.CreateRet(builder.CreateSelect(avx512, builder.getInt32(2),
+                                           builder.CreateSelect(avx2, builder.getInt32(1), builder.getInt32(0))));
+
+    builder.SetInsertPoint(baseline);
+    builder.CreateRet(builder.getInt32(0));
+    return F;
+}
+
+void AddFeatures(Function *F, const FeatureLevel &level){
+    std::string features = F->getFnAttribute("target-features").getValueAsString().str();
+    if(!features.empty())
+        features += ",";
+    features += level.features;
+    F->addFnAttr("target-features", features);
+    if(level.preferWide)
+        F->addFnAttr("prefer-vector-width", "512");
+}
+
+// Self recursive calls that now go through the ifunc stay in the clone
+void BindRecursion(Function *version, GlobalIFunc *dispatch){
+    for(auto &block : *version){
+        for(auto &inst : block){
+            auto call = dyn_cast<CallInst>(&inst);
+            if(call && call->getCalledOperand() == dispatch)
+                call->setCalledOperand(version);
+        }
+    }
+}
+
+void Multiversion(Module &module, Function *F){
+    std::string name = F->getName().str();
+    F->setName(name + ".baseline");
+    F->setLinkage(GlobalValue::InternalLinkage);
+
+    std::vector<Function*> versions = {F};
+    for(auto &level : featureLevels){
+        ValueToValueMapTy map;
+        Function *clone = CloneFunction(F, map);
+        clone->setName(name + "." + level.suffix);
+        AddFeatures(clone, level);
+        versions.push_back(clone);
+    }
+
+    // Resolvers return the address of the implementation to bind to
+    auto resolver = Function::Create(FunctionType::get(F->getType(), false), Function::InternalLinkage,
+                                     name + ".resolver", &module);
+    auto dispatch = GlobalIFunc::create(F->getFunctionType(), F->getAddressSpace(), GlobalValue::ExternalLinkage,
+                                        name, resolver, &module);
+    // Before the resolver exists, its references to the versions have to stay
+    F->replaceAllUsesWith(dispatch);
+    for(Function *version : versions)
+        BindRecursion(version, dispatch);
+
+    IRBuilder<> builder(BasicBlock::Create(module.getContext(), "entry", resolver));
+    Value *level = builder.CreateCall(GetCPULevel(module));
+    Value *chosen = versions[0];
+    for(unsigned i = 1; i<versions.size(); i++)
+        chosen = builder.CreateSelect(builder.CreateICmpUGE(level, builder.getInt32(i)), versions[i], chosen);
+    builder.CreateRet(chosen);
+}
+
+}
+
+bool MultiversionFunctions(Module &module, const std::vector<std::string> &names){
+    Triple triple(module.getTargetTriple().empty() ? sys::getDefaultTargetTriple() : module.getTargetTriple());
+    if(triple.getArch() != Triple::x86_64 || !triple.isOSBinFormatELF()){
+        printf("Multiversioning needs an x86-64 ELF target, not %s\n", triple.str().c_str());
+        return false;
+    }
+
+    for(auto &name : names){
+        Function *F = module.getFunction(name);
+        if(!F || F->isDeclaration() || name == "main"){
+            printf("Can't multiversion %s, it isn't a procedure or function the program uses\n", name.c_str());
+            return false;
+        }
+        Multiversion(module, F);
+    }
+    return true;
+}
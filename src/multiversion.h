@@ -0,0 +1,31 @@
+#ifndef MULTIVERSION_H
+#define MULTIVERSION_H
+
+#include <string>
+#include <vector>
+
+#include "llvm/IR/Module.h"
+
+/*
+ * compiler --multiversion=name[,name...]
+ *
+ * Compiles each named procedure or function three times: once for whatever
+ * CPU the module targets (the baseline), once with AVX2 (and the FMA and BMI
+ * that come with every AVX2 CPU) and once with AVX-512 at its full vector
+ * width. The name itself becomes an ifunc whose resolver checks cpuid (and
+ * that the OS saves the wider registers) when the executable is loaded and
+ * binds every call to the best clone the machine can run. One binary then
+ * runs the hot procedures at full width on new machines without breaking
+ * old ones.
+ *
+ * Recursive calls inside a clone go straight to the same clone, every other
+ * call goes through the ifunc.
+ *
+ * Runs after codegen and before the optimizer, so each clone is optimized for
+ * its own features. Only x86-64 ELF targets have ifuncs and these levels.
+ * Returns false (after printing why) for another target or a name that isn't
+ * a procedure or function in the module.
+ */
+bool MultiversionFunctions(llvm::Module &module, const std::vector<std::string> &names);
+
+#endif
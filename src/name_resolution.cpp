@@ -0,0 +1,136 @@
+#include "name_resolution.h"
+#include "ast_visitor.h"
+
+using namespace llvm;
+
+/************************/
+/*      Symbol table    */
+/************************/
+
+void ScopedSymbolTable::PushScope(){
+    scopeStarts.push_back(shadowed.size());
+}
+
+void ScopedSymbolTable::PopScope(){
+    size_t start = scopeStarts.back();
+    scopeStarts.pop_back();
+    while(shadowed.size() > start){
+        shadowed.back().first->second = shadowed.back().second;
+        shadowed.pop_back();
+    }
+}
+
+void ScopedSymbolTable::Bind(StringRef name, uint32_t slot){
+    auto &entry = *visible.try_emplace(name, 0).first;
+    shadowed.push_back({&entry, entry.second});
+    entry.second = slot;
+}
+
+uint32_t ScopedSymbolTable::Lookup(StringRef name) const{
+    auto found = visible.find(name);
+    return found == visible.end() ? 0 : found->second;
+}
+
+/************************/
+/*       Resolving      */
+/************************/
+
+class NameResolver: public ASTVisitor<NameResolver>{
+    private:
+        ScopedSymbolTable symbols;
+        // Procedures and functions live in their own namespace, bound to
+        // an index into declarations plus one
+        ScopedSymbolTable callables;
+        std::vector<PrototypeAST*> declarations;
+
+        uint32_t NewSlot(StringRef name){
+            symbols.Bind(name, ++slotCount);
+            return slotCount;
+        }
+
+        void Declare(PrototypeAST *proto){
+            declarations.push_back(proto);
+            callables.Bind(proto->GetName(), declarations.size());
+        }
+
+        void PushScope(){
+            symbols.PushScope();
+            callables.PushScope();
+        }
+
+        void PopScope(){
+            symbols.PopScope();
+            callables.PopScope();
+        }
+
+    public:
+        uint32_t slotCount = 0;
+
+        // Anything without names of its own just has its children resolved
+        void VisitAST(AST *node){
+            ForEachChild(node, [&](AST *child){ Visit(child); });
+        }
+
+        void VisitVariableIdentifierAST(VariableIdentifierAST *node){
+            node->SetSlot(symbols.Lookup(node->GetName()));
+        }
+
+        void VisitVariableDeclarationsOfTypeAST(VariableDeclarationsOfTypeAST *node){
+            for(auto &ident : node->GetIdentifiers())
+                ident->SetSlot(NewSlot(ident->GetName()));
+        }
+
+        void VisitConstantDeclarationsAST(ConstantDeclarationsAST *node){
+            node->SetFirstSlot(slotCount + 1);
+            for(auto &constant : node->GetConstants())
+                NewSlot(constant.name);
+        }
+
+        // A forward declaration, calls up to the body bind to it
+        void VisitPrototypeAST(PrototypeAST *node){
+            Declare(node);
+        }
+
+        // A procedure of the program's own hides a builtin of the same name
+        void VisitCallExpessionsAst(CallExpessionsAst *node){
+            if(uint32_t declaration = callables.Lookup(node->GetCallee()))
+                node->SetDeclaration(declarations[declaration - 1]);
+            else
+                node->SetBuiltin(LookupBuiltin(node->GetCallee()));
+            VisitAST(node);
+        }
+
+        // Parameters, then the result variable named after the function, then the body's own declarations
+        void VisitFunctionAST(FunctionAST *node){
+            auto proto = node->GetPrototype();
+            Declare(proto);
+            PushScope();
+            node->SetFirstSlot(slotCount + 1);
+            for(auto &arg : proto->GetArgs())
+                NewSlot(arg.name);
+            NewSlot(proto->GetName());
+            if(node->GetBody())
+                Visit(node->GetBody().get());
+            PopScope();
+        }
+
+        // The start, end and step are evaluated once before the loop variable
+        // exists, only the body sees the new one
+        void VisitForExpressionAST(ForExpressionAST *node){
+            for(auto child : {&node->GetStart(), &node->GetEnd(), &node->GetStep()}){
+                if(*child)
+                    Visit(child->get());
+            }
+            symbols.PushScope();
+            node->SetLoopVarSlot(NewSlot(node->GetLoopVarName()));
+            if(node->GetBody())
+                Visit(node->GetBody().get());
+            symbols.PopScope();
+        }
+};
+
+uint32_t ResolveNames(AST *tree){
+    NameResolver resolver;
+    resolver.Visit(tree);
+    return resolver.slotCount;
+}
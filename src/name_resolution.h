@@ -0,0 +1,48 @@
+#ifndef NAME_RESOLUTION_H
+#define NAME_RESOLUTION_H
+
+#include <utility>
+#include <vector>
+#include <stdint.h>
+
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+
+#include "ast.h"
+
+/*
+ * Name resolution
+ *
+ * Every variable, constant, parameter, function result and for loop variable
+ * gets a dense slot number, and every identifier that refers to one is bound
+ * to it, before codegen runs. Codegen then keeps its storage in a vector
+ * indexed by slot instead of looking names up. Calls are bound to the
+ * PrototypeAST they call, or to a builtin if no declaration is visible.
+ *
+ * Slot 0 means unresolved, codegen reports those as unknown variables.
+ */
+
+// Hash map of the names visible right now. Binding a name that's already
+// visible remembers what it shadowed so popping the scope can put it back,
+// pushing is O(1) and popping costs one step per name bound in the scope.
+class ScopedSymbolTable{
+    public:
+        void PushScope();
+        void PopScope();
+
+        void Bind(llvm::StringRef name, uint32_t slot);
+        // 0 if name isn't visible
+        uint32_t Lookup(llvm::StringRef name) const;
+
+    private:
+        llvm::StringMap<uint32_t> visible;
+        // Each binding and the slot it replaced (0 if none), innermost last
+        std::vector<std::pair<llvm::StringMapEntry<uint32_t>*, uint32_t>> shadowed;
+        std::vector<size_t> scopeStarts;
+};
+
+// Binds every identifier in the program to a slot, returns how many slots
+// were given out (slots run from 1 to the result)
+uint32_t ResolveNames(AST *tree);
+
+#endif
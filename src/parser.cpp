@@ -1,22 +1,38 @@
 #include <stdlib.h>
 #include "parser.h"
 #include "lexar.h"
+#include "grammar_tables.h"
 
 
-Parser::Parser(Lexar* lexar){
+template<typename Actions>
+BasicParser<Actions>::BasicParser(Lexar* lexar, Actions actions): actions(actions){
     this->lexar = lexar;
+    lexar->keepIdentifierNames = Actions::keepsIdentifierNames;
 }
 
-void Parser::ConsumeError(LexicalTokenType type){
-    printf("ERROR at line: %d col: %d\n in file %s\n", lexar->lineNumber, lexar->columnNumber, lexar->fileName.c_str());
-    printf("Expected type of '%s', got type of '%s'\n",
-            lexicalTokenNames[type],
-            lexicalTokenNames[currentToken.type]);
+template<typename Actions>
+void BasicParser<Actions>::ConsumeError(LexicalTokenType type){
+    errorOffset = currentToken.offset;
+    errorLength = currentToken.length;
+    errorMessage = std::string("Expected type of '") + lexicalTokenNames[type] +
+                   "', got type of '" + lexicalTokenNames[currentToken.type] + "'";
+    if(!quiet){
+        auto loc = lexar->lineTable.Resolve(currentToken.offset);
+        printf("ERROR at line: %d col: %d\n in file %s\n", loc.line, loc.column, lexar->fileName.c_str());
+        printf("%s\n", errorMessage.c_str());
+    }
     throw "Consuming failed";
 }
 
-void Parser::Consume(LexicalTokenType type){
+template<typename Actions>
+void BasicParser<Actions>::PredictError(int nonTerminal){
+    ConsumeError(expectedToken[nonTerminal]);
+}
+
+template<typename Actions>
+void BasicParser<Actions>::Consume(LexicalTokenType type){
     if(currentToken.type == type){
+        previousTokenEnd = currentToken.offset + currentToken.length;
         currentToken = lexar->NextToken();
     }
     else{
@@ -24,14 +40,36 @@ void Parser::Consume(LexicalTokenType type){
     }
 }
 
-bool Parser::Parse(){
+template<typename Actions>
+bool BasicParser<Actions>::Parse(){
+    try{
+        previousTokenEnd = 0;
+        currentToken = lexar->NextToken();
+        tree = Program();
+        Consume(EOI);
+        return true;
+    } catch(const char * msg){
+        if(!quiet)
+            printf("%s\nExiting\n", msg);
+    }
+    return false;
+}
+
+template<typename Actions>
+bool BasicParser<Actions>::ParseDeclaration(){
     try{
         currentToken = lexar->NextToken();
-        this->tree = Program();
+        previousTokenEnd = currentToken.offset;
+        switch(Predict(NT_DECLARATION_PART, currentToken.type)){
+            case DECLARATION_PART__PROCEDURE_DECLARATION: tree = ProcedureDeclaration(); break;
+            case DECLARATION_PART__FUNCTION_DECLARATION: tree = FunctionDeclaration(); break;
+            default: ConsumeError(KW_PROCEDURE); break;
+        }
         Consume(EOI);
         return true;
     } catch(const char * msg){
-        printf("%s\nExiting\n", msg);
+        if(!quiet)
+            printf("%s\nExiting\n", msg);
     }
     return false;
 }
@@ -40,50 +78,56 @@ bool Parser::Parse(){
 /*      Main Program    */
 /************************/
 
-std::unique_ptr<AST> Parser::Program(){
+template<typename Actions>
+typename BasicParser<Actions>::Node BasicParser<Actions>::Program(){
+    auto start = currentToken.offset;
     auto header = ProgramHeader();
     auto declarations = DeclarationPart();
     Consume(KW_BEGIN);
     auto statements = StatementSequence();
     Consume(KW_END);
     Consume(DOT);
-    return llvm::make_unique<ProgramAST>(header, std::move(declarations), std::move(statements));
+    return Locate(actions.Program(header, std::move(declarations), std::move(statements)), start);
 }
 
-std::string Parser::ProgramHeader(){
+template<typename Actions>
+typename BasicParser<Actions>::Name BasicParser<Actions>::ProgramHeader(){
     Consume(KW_PROGRAM);
-    auto programName = currentToken.identifierName;
+    auto programName = Actions::GetName(currentToken);
     Consume(IDENTIFIER);
     Consume(SEMICOLON);
     return programName;
 }
 
-std::unique_ptr<AST> Parser::Block(){
-    return StatementPart(DeclarationPart());
+template<typename Actions>
+typename BasicParser<Actions>::Node BasicParser<Actions>::Block(){
+    auto start = currentToken.offset;
+    return Locate(StatementPart(DeclarationPart()), start);
 }
 
-std::vector<std::unique_ptr<AST>> Parser::DeclarationPart(){
+template<typename Actions>
+typename BasicParser<Actions>::NodeList BasicParser<Actions>::DeclarationPart(){
     bool moreDeclarations = true;
-    std::vector<std::unique_ptr<AST>> declarations;
+    NodeList declarations;
 
     while(moreDeclarations){
-        switch(currentToken.type){
-            case KW_VAR:
+        switch(Predict(NT_DECLARATION_PART, currentToken.type)){
+            case DECLARATION_PART__VARIABLE_DECLARATION:
                 {
                     declarations.push_back(VariableDeclaration());
                     break;
                 }
-            case KW_CONST:
+            case DECLARATION_PART__CONSTANT_DECLARATION:
                 {
                     declarations.push_back(ConstantDeclaration());
                     break;
                 }
-            case KW_PROCEDURE:
+            case DECLARATION_PART__PROCEDURE_DECLARATION:
                 {
                     declarations.push_back(ProcedureDeclaration());
                     break;
                 }
-            case KW_FUNCTION:
+            case DECLARATION_PART__FUNCTION_DECLARATION:
                 {
                     declarations.push_back(FunctionDeclaration());
                     break;
@@ -94,64 +138,75 @@ std::vector<std::unique_ptr<AST>> Parser::DeclarationPart(){
     return declarations;
 }
 
-std::unique_ptr<AST> Parser::VariableDeclaration(){
+template<typename Actions>
+typename BasicParser<Actions>::Node BasicParser<Actions>::VariableDeclaration(){
+    auto start = currentToken.offset;
     Consume(KW_VAR);
-    std::vector<std::unique_ptr<AST>> declarations;
+    NodeList declarations;
     do{
         declarations.push_back(VariableDeclarationPart());
     }
-    while(currentToken.type == IDENTIFIER);
-    return llvm::make_unique<VariableDeclarationsAST>(std::move(declarations));
+    while(Predict(NT_VARIABLE_DECLARATION_PR, currentToken.type) == VARIABLE_DECLARATION_PR__VARIABLE_DECLARATION_PART);
+    return Locate(actions.VariableDeclarations(std::move(declarations)), start);
 }
 
-std::unique_ptr<AST> Parser::VariableDeclarationPart(){
+template<typename Actions>
+typename BasicParser<Actions>::Node BasicParser<Actions>::VariableDeclarationPart(){
+    auto start = currentToken.offset;
     auto idents = IdentifierList();
     Consume(COLON);
     auto type = Type();
     Consume(SEMICOLON);
-    return llvm::make_unique<VariableDeclarationsOfTypeAST>(std::move(idents), type);
+    return Locate(actions.VariableDeclarationsOfType(std::move(idents), type), start);
 }
 
-std::unique_ptr<AST> Parser::ConstantDeclaration(){
+template<typename Actions>
+typename BasicParser<Actions>::Node BasicParser<Actions>::ConstantDeclaration(){
+    auto start = currentToken.offset;
     Consume(KW_CONST);
-    std::vector<ValueNamePair> constants;
+    typename Actions::ConstantList constants;
     do{
        constants.push_back(ConstantDeclarationPart()); 
     }
-    while(currentToken.type == IDENTIFIER);
-    return llvm::make_unique<ConstantDeclarationsAST>(std::move(constants));
+    while(Predict(NT_CONSTANT_DECLARATION_PR, currentToken.type) == CONSTANT_DECLARATION_PR__CONSTANT_DECLARATION_PART);
+    return Locate(actions.ConstantDeclarations(std::move(constants)), start);
 }
 
 
-ValueNamePair Parser::ConstantDeclarationPart(){
-    auto identName = currentToken.identifierName;
+template<typename Actions>
+typename Actions::Constant BasicParser<Actions>::ConstantDeclarationPart(){
+    auto identName = Actions::GetName(currentToken);
     Consume(IDENTIFIER);
     Consume(EQUAL);
     auto value = currentToken.storedNumber;
     Consume(NUMBER);
     Consume(SEMICOLON);
-    return {value, identName};
+    return actions.MakeConstant(value, identName);
 }
 
-std::unique_ptr<AST> Parser::StatementPart(std::vector<std::unique_ptr<AST>> dValue){
+template<typename Actions>
+typename BasicParser<Actions>::Node BasicParser<Actions>::StatementPart(NodeList dValue){
     Consume(KW_BEGIN);
     auto result = StatementSequence();
     Consume(KW_END);
-    return llvm::make_unique<MainBlockAST>(std::move(dValue), std::move(result));
+    return actions.MainBlock(std::move(dValue), std::move(result));
 }
 
-std::vector<std::unique_ptr<VariableIdentifierAST>> Parser::IdentifierList(){
-    std::vector<std::unique_ptr<VariableIdentifierAST>> identifiers;
-    auto identName = currentToken.identifierName;
+template<typename Actions>
+typename Actions::IdentifierList BasicParser<Actions>::IdentifierList(){
+    typename Actions::IdentifierList identifiers;
+    auto identName = Actions::GetName(currentToken);
+    auto start = currentToken.offset;
     Consume(IDENTIFIER);
-    auto identAST = llvm::make_unique<VariableIdentifierAST>(identName);
+    auto identAST = Locate(actions.VariableIdentifier(identName), start);
     identifiers.push_back(std::move(identAST));
 
-    while(currentToken.type == COMMA){
+    while(Predict(NT_IDENTIFIER_LIST_PR, currentToken.type) == IDENTIFIER_LIST_PR__COMMA){
         Consume(COMMA);
-        auto identName = currentToken.identifierName;
+        auto identName = Actions::GetName(currentToken);
+        auto start = currentToken.offset;
         Consume(IDENTIFIER);
-        auto identAST = llvm::make_unique<VariableIdentifierAST>(identName);
+        auto identAST = Locate(actions.VariableIdentifier(identName), start);
         identifiers.push_back(std::move(identAST));
     }
     return identifiers;
@@ -162,41 +217,48 @@ std::vector<std::unique_ptr<VariableIdentifierAST>> Parser::IdentifierList(){
 /*      Procedures      */
 /************************/
 
-std::unique_ptr<AST> Parser::ProcedureDeclaration(){
+template<typename Actions>
+typename BasicParser<Actions>::Node BasicParser<Actions>::ProcedureDeclaration(){
     auto proto = ProcedureHeader();
     Consume(SEMICOLON);
     return ProcedureDeclarationPrime(std::move(proto));
 }
 
-std::unique_ptr<AST> Parser::ProcedureDeclarationPrime(std::unique_ptr<AST> dValue){
-    if(currentToken.type == KW_FORWARD){
+template<typename Actions>
+typename BasicParser<Actions>::Node BasicParser<Actions>::ProcedureDeclarationPrime(Node dValue){
+    if(Predict(NT_PROCEDURE_DECLARATION_PR, currentToken.type) == PROCEDURE_DECLARATION_PR__DIRECTIVE){
         Directive();
         Consume(SEMICOLON);
         return dValue;
     }
     else{
+        auto start = Actions::GetOffset(dValue);
         auto body = Block();
         Consume(SEMICOLON);
-        return llvm::make_unique<FunctionAST>(std::move(dValue), std::move(body));
+        return Locate(actions.Function(std::move(dValue), std::move(body)), start);
     }
 }
 
 
-std::unique_ptr<AST> Parser::ProcedureHeader(){
+template<typename Actions>
+typename BasicParser<Actions>::Node BasicParser<Actions>::ProcedureHeader(){
+    auto start = currentToken.offset;
     Consume(KW_PROCEDURE);
-    auto identName = currentToken.identifierName;
+    auto identName = Actions::GetName(currentToken);
     Consume(IDENTIFIER);
-    return llvm::make_unique<PrototypeAST>(identName, ParameterList(), EOI);
+    auto params = ParameterList();
+    return Locate(actions.Prototype(identName, std::move(params), EOI), start);
 }
 
-std::vector<TypeNamePair> Parser::ParameterList(){
-    if(currentToken.type == LEFTPAREN){
+template<typename Actions>
+typename Actions::ParameterList BasicParser<Actions>::ParameterList(){
+    if(Predict(NT_PARAMETER_LIST, currentToken.type) == PARAMETER_LIST__LEFTPAREN){
         Consume(LEFTPAREN);
-        std::vector<TypeNamePair> params;
-        if(currentToken.type == IDENTIFIER){
+        typename Actions::ParameterList params;
+        if(Predict(NT_PARAMETERS, currentToken.type) == PARAMETERS__PARAMETER){
             params.push_back(Parameter());
             while(1){
-                if(currentToken.type == SEMICOLON){
+                if(Predict(NT_PARAMETER_LIST_PR, currentToken.type) == PARAMETER_LIST_PR__SEMICOLON){
                     Consume(SEMICOLON);
                     params.push_back(Parameter());
                 }
@@ -210,11 +272,13 @@ std::vector<TypeNamePair> Parser::ParameterList(){
 }
 
 
-TypeNamePair Parser::Parameter(){
-    auto identName = currentToken.identifierName;
+template<typename Actions>
+typename Actions::Parameter BasicParser<Actions>::Parameter(){
+    auto identName = Actions::GetName(currentToken);
     Consume(IDENTIFIER);
     Consume(COLON);
-    return TypeNamePair{Type(), identName};
+    auto type = Type();
+    return actions.MakeParameter(type, identName);
 }
 
 
@@ -222,37 +286,43 @@ TypeNamePair Parser::Parameter(){
 /*      Functions       */
 /************************/
 
-std::unique_ptr<AST> Parser::FunctionDeclaration(){
+template<typename Actions>
+typename BasicParser<Actions>::Node BasicParser<Actions>::FunctionDeclaration(){
     auto proto = FunctionHeader();
     Consume(SEMICOLON);
     return FunctionDeclarationPrime(std::move(proto));
 }
 
-std::unique_ptr<AST> Parser::FunctionDeclarationPrime(std::unique_ptr<AST> dValue){
-    if(currentToken.type == KW_FORWARD){
+template<typename Actions>
+typename BasicParser<Actions>::Node BasicParser<Actions>::FunctionDeclarationPrime(Node dValue){
+    if(Predict(NT_FUNCTION_DECLARATION_PR, currentToken.type) == FUNCTION_DECLARATION_PR__DIRECTIVE){
         Directive();
         Consume(SEMICOLON);
         //Was only prototype, so we can just return the prototype
         return dValue;
     }
     else{
+        auto start = Actions::GetOffset(dValue);
         auto body = Block();
         Consume(SEMICOLON);
-        return llvm::make_unique<FunctionAST>(std::move(dValue), std::move(body));
+        return Locate(actions.Function(std::move(dValue), std::move(body)), start);
     }
 }
 
-std::unique_ptr<AST> Parser::FunctionHeader(){
+template<typename Actions>
+typename BasicParser<Actions>::Node BasicParser<Actions>::FunctionHeader(){
+    auto start = currentToken.offset;
     Consume(KW_FUNCTION);
-    auto identName = currentToken.identifierName;
+    auto identName = Actions::GetName(currentToken);
     Consume(IDENTIFIER);
     auto params = ParameterList();
     Consume(COLON);
     auto retType = Type();
-    return llvm::make_unique<PrototypeAST>(identName, std::move(params), retType);
+    return Locate(actions.Prototype(identName, std::move(params), retType), start);
 }
 
-void Parser::Directive(){
+template<typename Actions>
+void BasicParser<Actions>::Directive(){
     Consume(KW_FORWARD);
 }
 
@@ -261,40 +331,36 @@ void Parser::Directive(){
 /*      Statements      */
 /************************/
 
-std::unique_ptr<AST> Parser::StatementSequence(){
-    std::vector<std::unique_ptr<AST>> statements;
+template<typename Actions>
+typename BasicParser<Actions>::Node BasicParser<Actions>::StatementSequence(){
+    auto start = currentToken.offset;
+    NodeList statements;
     statements.push_back(Statement());
     while(1){
         Consume(SEMICOLON);
-        if( currentToken.type == KW_IF ||
-            currentToken.type == KW_FOR ||
-            currentToken.type == KW_WHILE ||
-            currentToken.type == KW_BEGIN ||
-            currentToken.type == IDENTIFIER ||
-            currentToken.type == KW_EXIT ||
-            currentToken.type == KW_BREAK){
+        if(Predict(NT_STATEMENT_SEQUENCE_PR, currentToken.type) == STATEMENT_SEQUENCE_PR__STATEMENT){
             statements.push_back(Statement());
         }
         else break;
     }
-    return llvm::make_unique<StatementSequenceAST>(std::move(statements));
+    return Locate(actions.StatementSequence(std::move(statements)), start);
 }
 
 
-std::unique_ptr<AST> Parser::Statement(){
-    switch(currentToken.type){
-        case KW_IF:
+template<typename Actions>
+typename BasicParser<Actions>::Node BasicParser<Actions>::Statement(){
+    switch(Predict(NT_STATEMENT, currentToken.type)){
+        case STATEMENT__CONDITIONAL_STATEMENT:
             {
                 return ConditionalStatement();
                 break;
             }
-        case KW_FOR:
-        case KW_WHILE:
+        case STATEMENT__REPEDITIVE_STATEMENT:
             {
                 return RepeditiveStatement();
                 break;
             }
-        case KW_BEGIN:
+        case STATEMENT__BLOCK_STATEMENT:
             {
                 return BlockStatment();
                 break;
@@ -308,75 +374,86 @@ std::unique_ptr<AST> Parser::Statement(){
 }
 
 //Only here so I could add a switch or something later
-std::unique_ptr<AST> Parser::ConditionalStatement(){
+template<typename Actions>
+typename BasicParser<Actions>::Node BasicParser<Actions>::ConditionalStatement(){
     return IfStatment();
 }
 
-std::unique_ptr<AST> Parser::IfStatment(){
+template<typename Actions>
+typename BasicParser<Actions>::Node BasicParser<Actions>::IfStatment(){
+    auto start = currentToken.offset;
     Consume(KW_IF);
     auto cond = Expression();
     Consume(KW_THEN);
     auto thenPart = Statement();
     auto elsePart = IfStatmentPrime();
-    return llvm::make_unique<IfExpressionAST>(std::move(cond), std::move(thenPart), std::move(elsePart));
+    return Locate(actions.If(std::move(cond), std::move(thenPart), std::move(elsePart)), start);
 }
 
-std::unique_ptr<AST> Parser::IfStatmentPrime(){
-    if(currentToken.type == KW_ELSE){
+template<typename Actions>
+typename BasicParser<Actions>::Node BasicParser<Actions>::IfStatmentPrime(){
+    if(Predict(NT_IF_STATEMENT_PR, currentToken.type) == IF_STATEMENT_PR__KW_ELSE){
         Consume(KW_ELSE);
         return Statement();
     }
-    return nullptr;
+    return {};
 }
 
-std::unique_ptr<AST> Parser::RepeditiveStatement(){
-    switch(currentToken.type){
-        case KW_FOR:
+template<typename Actions>
+typename BasicParser<Actions>::Node BasicParser<Actions>::RepeditiveStatement(){
+    switch(Predict(NT_REPEDITIVE_STATEMENT, currentToken.type)){
+        case REPEDITIVE_STATEMENT__FOR_STATEMENT:
             {
                 return ForStatement();
                 break;
             }
-        case KW_WHILE:
+        case REPEDITIVE_STATEMENT__WHILE_STATEMENT:
             {
                 return WhileStatement();
                 break;
             }
         default:
             {
-                ConsumeError(KW_FOR);
+                PredictError(NT_REPEDITIVE_STATEMENT);
                 break;
             }
     }
-    return nullptr;
+    return {};
 }
 
-std::unique_ptr<AST> Parser::WhileStatement(){
+template<typename Actions>
+typename BasicParser<Actions>::Node BasicParser<Actions>::WhileStatement(){
+    auto start = currentToken.offset;
     Consume(KW_WHILE);
     auto cond = Expression();
     Consume(KW_DO);
-    return llvm::make_unique<WhileExpressionAST>(std::move(cond), Statement());
+    auto body = Statement();
+    return Locate(actions.While(std::move(cond), std::move(body)), start);
 }
 
-std::unique_ptr<AST> Parser::ForStatement(){
+template<typename Actions>
+typename BasicParser<Actions>::Node BasicParser<Actions>::ForStatement(){
+    auto start = currentToken.offset;
     Consume(KW_FOR);
-    auto identName = currentToken.identifierName;
+    auto identName = Actions::GetName(currentToken);
     Consume(IDENTIFIER);
     Consume(ASSIGN);
-    return ForStatementPrime(identName, Expression());
+    return Locate(ForStatementPrime(identName, Expression()), start);
 }
 
-std::unique_ptr<AST> Parser::ForStatementPrime(std::string identifierName, std::unique_ptr<AST> start){
+template<typename Actions>
+typename BasicParser<Actions>::Node BasicParser<Actions>::ForStatementPrime(Name identifierName, Node start){
     LexicalTokenType direction = ERR;
-    std::unique_ptr<AST> end;
-    switch(currentToken.type){
-        case KW_TO:
+    Node end;
+    switch(Predict(NT_FOR_STATEMENT_PR, currentToken.type)){
+        case FOR_STATEMENT_PR__KW_TO:
             {
                 Consume(KW_TO);
                 direction = KW_TO;
                 end = Expression();
                 break;
             }
-        case KW_DOWNTO:
+        case FOR_STATEMENT_PR__KW_DOWNTO:
             {
                 Consume(KW_DOWNTO);
                 direction = KW_DOWNTO;
@@ -385,67 +462,90 @@ std::unique_ptr<AST> Parser::ForStatementPrime(std::string identifierName, std::
             }
         default:
             {
-                ConsumeError(KW_TO);
-                return nullptr;
+                PredictError(NT_FOR_STATEMENT_PR);
+                return {};
+            }
+    }
+    Node step;
+    switch(Predict(NT_FOR_STATEMENT_END, currentToken.type)){
+        case FOR_STATEMENT_END__KW_STEP:
+            {
+                Consume(KW_STEP);
+                step = Expression();
+                break;
+            }
+        case FOR_STATEMENT_END__KW_DO:
+            break;
+        default:
+            {
+                PredictError(NT_FOR_STATEMENT_END);
+                return {};
             }
     }
     Consume(KW_DO);
-    //TODO Step expression (if needed);
-    return llvm::make_unique<ForExpressionAST>(identifierName, direction, std::move(start), std::move(end), nullptr, Statement());
+    auto body = Statement();
+    return actions.For(identifierName, direction, std::move(start), std::move(end), std::move(step), std::move(body));
 }
 
-std::unique_ptr<AST> Parser::BlockStatment(){
+template<typename Actions>
+typename BasicParser<Actions>::Node BasicParser<Actions>::BlockStatment(){
     Consume(KW_BEGIN);
     auto result = StatementSequence();
     Consume(KW_END);
     return result;
 }
 
-std::unique_ptr<AST> Parser::RegularStatement(){
-    if(currentToken.type == KW_EXIT ||
-       currentToken.type == KW_BREAK){
-        auto res = llvm::make_unique<ExitBreakStatementAST>(currentToken.type);
+template<typename Actions>
+typename BasicParser<Actions>::Node BasicParser<Actions>::RegularStatement(){
+    auto start = currentToken.offset;
+    auto production = Predict(NT_REGULAR_STATEMENT, currentToken.type);
+    if(production == REGULAR_STATEMENT__KW_EXIT ||
+       production == REGULAR_STATEMENT__KW_BREAK){
+        auto res = actions.ExitBreak(currentToken.type);
         Consume(currentToken.type);
-        return res; 
+        return Locate(std::move(res), start); 
     }
-    auto identName = currentToken.identifierName;
+    auto identName = Actions::GetName(currentToken);
     Consume(IDENTIFIER);
     //array indexing
-    if(currentToken.type == LEFTBRACKET){
+    if(Predict(NT_INDEX, currentToken.type) == INDEX__LEFTBRACKET){
         Consume(LEFTBRACKET);
         Expression();
         Consume(RIGHTBRACKET);
     }
-    return RegularStatementPrime(identName);
+    return Locate(RegularStatementPrime(identName, start), start);
 }
 
-std::unique_ptr<AST> Parser::RegularStatementPrime(std::string identifierName){
-    switch(currentToken.type){
-        case ASSIGN:
+template<typename Actions>
+typename BasicParser<Actions>::Node BasicParser<Actions>::RegularStatementPrime(Name identifierName, uint32_t identStart){
+    switch(Predict(NT_REGULAR_STATEMENT_PR, currentToken.type)){
+        case REGULAR_STATEMENT_PR__ASSIGNMENT_STATEMENT:
             {
-                auto var = llvm::make_unique<VariableIdentifierAST>(identifierName);
-                return llvm::make_unique<BinaryOpAST>(ASSIGN, std::move(var), AssignmentStatement());
+                Node var = Locate(actions.VariableIdentifier(identifierName), identStart);
+                return actions.BinaryOp(ASSIGN, std::move(var), AssignmentStatement());
             }
-        case LEFTPAREN:
+        case REGULAR_STATEMENT_PR__PROCEDURE_STATEMENT:
             {
                 auto args = ProcdureStatement();
-                return llvm::make_unique<CallExpessionsAst>(identifierName, std::move(args));
+                return actions.Call(identifierName, std::move(args));
             }
         default:
             {
-               ConsumeError(ASSIGN);
+               PredictError(NT_REGULAR_STATEMENT_PR);
             }
     }
-    return nullptr;
+    return {};
 }
 
-std::unique_ptr<AST> Parser::AssignmentStatement(){
+template<typename Actions>
+typename BasicParser<Actions>::Node BasicParser<Actions>::AssignmentStatement(){
     Consume(ASSIGN);
     return Expression();
 }
 
-std::vector<std::unique_ptr<AST>> Parser::ProcdureStatement(){
-    if(currentToken.type == LEFTPAREN){
+template<typename Actions>
+typename BasicParser<Actions>::NodeList BasicParser<Actions>::ProcdureStatement(){
+    if(Predict(NT_PROCEDURE_STATEMENT, currentToken.type) == PROCEDURE_STATEMENT__LEFTPAREN){
         Consume(LEFTPAREN);
         auto result = UsageParameterList();
         Consume(RIGHTPAREN);
@@ -454,13 +554,14 @@ std::vector<std::unique_ptr<AST>> Parser::ProcdureStatement(){
     return {};
 }
 
-std::vector<std::unique_ptr<AST>> Parser::UsageParameterList(){
-    if(currentToken.type == RIGHTPAREN) return {};
-    std::vector<std::unique_ptr<AST>> args;
+template<typename Actions>
+typename BasicParser<Actions>::NodeList BasicParser<Actions>::UsageParameterList(){
+    if(Predict(NT_USAGE_PARAMETER_LIST, currentToken.type) == USAGE_PARAMETER_LIST__EMPTY) return {};
+    NodeList args;
     while(1){
         auto arg = UsageParameter();
         args.push_back(std::move(arg));
-        if(currentToken.type == COMMA){
+        if(Predict(NT_USAGE_PARAMETER_LIST_PR, currentToken.type) == USAGE_PARAMETER_LIST_PR__COMMA){
             Consume(COMMA);
         }
         else{
@@ -471,7 +572,8 @@ std::vector<std::unique_ptr<AST>> Parser::UsageParameterList(){
 }
 
 
-std::unique_ptr<AST> Parser::UsageParameter(){
+template<typename Actions>
+typename BasicParser<Actions>::Node BasicParser<Actions>::UsageParameter(){
     return Expression();
 }
 
@@ -480,128 +582,126 @@ std::unique_ptr<AST> Parser::UsageParameter(){
 /*      Expressions     */
 /************************/
 
-std::unique_ptr<AST> Parser::Expression(){
+template<typename Actions>
+typename BasicParser<Actions>::Node BasicParser<Actions>::Expression(){
     return ExpressionPrime(BaseExpression());
 }
 
-std::unique_ptr<AST> Parser::ExpressionPrime(std::unique_ptr<AST> dValue){
-    switch(currentToken.type){
-        case EQUAL: case LESSTHAN: case LESSTHANEQ:
-        case GREATERTHAN: case GREATERTHANEQ: case NOTEQUAL:
-            {
-                auto op = ComparisonOperator();
-                auto res = llvm::make_unique<ComparisonOpAST>(op, std::move(dValue), BaseExpression());
-                return ExpressionPrime(std::move(res));
-                break;
-            }
-        default:break;
+template<typename Actions>
+typename BasicParser<Actions>::Node BasicParser<Actions>::ExpressionPrime(Node dValue){
+    if(Predict(NT_EXPRESSION_PR, currentToken.type) == EXPRESSION_PR__COMPARISON_OPERATOR){
+        auto start = Actions::GetOffset(dValue);
+        auto op = ComparisonOperator();
+        auto res = actions.ComparisonOp(op, std::move(dValue), BaseExpression());
+        return ExpressionPrime(Locate(std::move(res), start));
     }
     return dValue;
 }
 
-LexicalTokenType Parser::ComparisonOperator(){
-    switch(currentToken.type){
-        case EQUAL: Consume(EQUAL); return EQUAL;
-        case LESSTHAN: Consume(LESSTHAN); return LESSTHAN;
-        case LESSTHANEQ: Consume(LESSTHANEQ); return LESSTHANEQ;
-        case GREATERTHAN: Consume(GREATERTHAN); return GREATERTHAN;
-        case GREATERTHANEQ: Consume(GREATERTHANEQ); return GREATERTHANEQ;
-        case NOTEQUAL: Consume(NOTEQUAL); return NOTEQUAL;
-        default: ConsumeError(EQUAL); return ERR;
+//Every production here is a single token, so the token is the operator
+template<typename Actions>
+LexicalTokenType BasicParser<Actions>::ComparisonOperator(){
+    if(Predict(NT_COMPARISON_OPERATOR, currentToken.type) == NO_PRODUCTION){
+        PredictError(NT_COMPARISON_OPERATOR);
+        return ERR;
     }
+    auto op = currentToken.type;
+    Consume(op);
+    return op;
 }
 
-std::unique_ptr<AST> Parser::BaseExpression(){
-    if(currentToken.type == MINUS){
+template<typename Actions>
+typename BasicParser<Actions>::Node BasicParser<Actions>::BaseExpression(){
+    if(Predict(NT_BASE_EXPRESSION, currentToken.type) == BASE_EXPRESSION__MINUS){
+        auto start = currentToken.offset;
         Consume(MINUS);
-        return llvm::make_unique<UnaryOpAST>(MINUS, BaseExpressionPrime(Term()));
+        // Like Pascal's sign, it's part of the first term: -a + b is (-a) + b
+        return BaseExpressionPrime(Locate(actions.UnaryOp(MINUS, Term()), start));
     }
     return BaseExpressionPrime(Term());
 }
 
-std::unique_ptr<AST> Parser::BaseExpressionPrime(std::unique_ptr<AST> dValue){
-    switch(currentToken.type){
-        case PLUS: case MINUS: case OR:
-            {
-                auto op = PlusMinusOr(); 
-                auto res = llvm::make_unique<BinaryOpAST>(op, std::move(dValue), Term());
-                return BaseExpressionPrime(std::move(res));
-                break;
-            }
-        default:break;
+template<typename Actions>
+typename BasicParser<Actions>::Node BasicParser<Actions>::BaseExpressionPrime(Node dValue){
+    if(Predict(NT_BASE_EXPRESSION_PR, currentToken.type) == BASE_EXPRESSION_PR__PLUS_MINUS_OR){
+        auto start = Actions::GetOffset(dValue);
+        auto op = PlusMinusOr(); 
+        auto res = actions.BinaryOp(op, std::move(dValue), Term());
+        return BaseExpressionPrime(Locate(std::move(res), start));
     }
     return dValue;
 }
 
-std::unique_ptr<AST> Parser::Term(){
+template<typename Actions>
+typename BasicParser<Actions>::Node BasicParser<Actions>::Term(){
    return TermPrime(Factor());
 }
 
-LexicalTokenType Parser::PlusMinusOr(){
-    switch(currentToken.type){
-        case PLUS: Consume(PLUS); return PLUS;
-        case MINUS: Consume(MINUS); return MINUS;
-        case OR: Consume(OR); return OR;
-        default:return ERR;
-    }
+template<typename Actions>
+LexicalTokenType BasicParser<Actions>::PlusMinusOr(){
+    if(Predict(NT_PLUS_MINUS_OR, currentToken.type) == NO_PRODUCTION)
+        return ERR;
+    auto op = currentToken.type;
+    Consume(op);
+    return op;
 }
 
-std::unique_ptr<AST> Parser::TermPrime(std::unique_ptr<AST> dValue){
-    switch(currentToken.type){
-        case TIMES: case DIVIDE: case AND: case MOD: case DIV:
-            {
-                auto op = MultDivAnd();
-                return TermPrime(llvm::make_unique<BinaryOpAST>(op, std::move(dValue), Factor()));
-                break;
-            }
-        default: break;
+template<typename Actions>
+typename BasicParser<Actions>::Node BasicParser<Actions>::TermPrime(Node dValue){
+    if(Predict(NT_TERM_PR, currentToken.type) == TERM_PR__MULT_DIV_AND){
+        auto start = Actions::GetOffset(dValue);
+        auto op = MultDivAnd();
+        auto res = actions.BinaryOp(op, std::move(dValue), Factor());
+        return TermPrime(Locate(std::move(res), start));
     }
     return dValue;
 }
 
-LexicalTokenType Parser::MultDivAnd(){
-    switch(currentToken.type){
-        case TIMES: Consume(TIMES); return TIMES;
-        case DIVIDE: Consume(DIVIDE); return DIVIDE;
-        case AND: Consume(AND); return AND;
-        case MOD: Consume(MOD); return MOD;
-        case DIV: Consume(DIV); return DIV;
-        default:return ERR;
-    }
+template<typename Actions>
+LexicalTokenType BasicParser<Actions>::MultDivAnd(){
+    if(Predict(NT_MULT_DIV_AND, currentToken.type) == NO_PRODUCTION)
+        return ERR;
+    auto op = currentToken.type;
+    Consume(op);
+    return op;
 }
 
-std::unique_ptr<AST> Parser::Factor(){
-    switch(currentToken.type){
-        case IDENTIFIER:
+template<typename Actions>
+typename BasicParser<Actions>::Node BasicParser<Actions>::Factor(){
+    switch(Predict(NT_FACTOR, currentToken.type)){
+        case FACTOR__IDENTIFIER:
             {
-                auto identName = currentToken.identifierName;
+                auto start = currentToken.offset;
+                auto identName = Actions::GetName(currentToken);
                 Consume(IDENTIFIER);
-                if(currentToken.type == LEFTPAREN){
+                auto production = Predict(NT_FACTOR_PR, currentToken.type);
+                if(production == FACTOR_PR__PROCEDURE_STATEMENT){
                     auto args = ProcdureStatement();
-                    return llvm::make_unique<CallExpessionsAst>(identName, std::move(args));
+                    return Locate(actions.Call(identName, std::move(args)), start);
                 }
                 //TODO
                 //Array index
-                else if(currentToken.type == LEFTBRACKET){
+                else if(production == FACTOR_PR__LEFTBRACKET){
                     Consume(LEFTBRACKET);
                     Expression();
                     Consume(RIGHTBRACKET);
                     //TODO not actually doing anything with the arrays
-                    return llvm::make_unique<VariableIdentifierAST>(identName);
+                    return Locate(actions.VariableIdentifier(identName), start);
                 }
                 //simple variable reference
                 else{
-                    return llvm::make_unique<VariableIdentifierAST>(identName);
+                    return Locate(actions.VariableIdentifier(identName), start);
                 }
                 break;
             }
-        case NUMBER:
+        case FACTOR__NUMBER:
             {
-                auto result = llvm::make_unique<NumberAST>(currentToken.storedNumber);
+                auto start = currentToken.offset;
+                auto result = actions.Number(currentToken.storedNumber);
                 Consume(NUMBER);
-                return std::move(result);
+                return Locate(std::move(result), start);
             }
-        case LEFTPAREN:
+        case FACTOR__LEFTPAREN:
             {
                 Consume(LEFTPAREN);
                 auto result = Expression();
@@ -610,11 +710,11 @@ std::unique_ptr<AST> Parser::Factor(){
             }
         default:
             {
-                ConsumeError(IDENTIFIER);
+                PredictError(NT_FACTOR);
                 break;
             }
     }
-    return nullptr;
+    return {};
 }
 
 
@@ -625,15 +725,16 @@ std::unique_ptr<AST> Parser::Factor(){
 /************************/
 
 //TODO 
-LexicalTokenType Parser::Type(){
-    switch(currentToken.type){
-        case KW_INTEGER:
+template<typename Actions>
+LexicalTokenType BasicParser<Actions>::Type(){
+    switch(Predict(NT_TYPE, currentToken.type)){
+        case TYPE__KW_INTEGER:
             {
                 Consume(KW_INTEGER);
                 return KW_INTEGER;
                 break;
             }
-        case KW_ARRAY:
+        case TYPE__ARRAY_TYPE:
             {
                 Consume(KW_ARRAY);
                 Consume(LEFTBRACKET);
@@ -648,13 +749,16 @@ LexicalTokenType Parser::Type(){
             }
         default:
             {
-                ConsumeError(KW_INTEGER);
+                PredictError(NT_TYPE);
                 break;
             }
     }
     return ERR;
 }
 
+template class BasicParser<BuildASTActions>;
+template class BasicParser<SyntaxOnlyActions>;
+
 
 
 
@@ -15,81 +15,115 @@
 
 #include "ast.h"
 #include "lexar.h"
+#include "parser_actions.h"
 
 
-class Parser{
+// Recursive descent over grammer-formal.md. What gets built is up to Actions,
+// see parser_actions.h.
+template<typename Actions>
+class BasicParser{
     public:
-        Parser(Lexar*);
-        std::unique_ptr<AST> tree;
+        typedef typename Actions::Node Node;
+        typedef typename Actions::NodeList NodeList;
+        typedef typename Actions::Name Name;
+
+        BasicParser(Lexar*, Actions actions = Actions());
+        Node tree;
         bool Parse();
+        // Parses a single procedure or function declaration into tree, used to
+        // reparse just the part of a file that changed
+        bool ParseDeclaration();
+
+        // Don't print errors, only keep them below
+        bool quiet = false;
+        // The token the last parse failed on and why
+        uint32_t errorOffset = 0;
+        uint32_t errorLength = 0;
+        std::string errorMessage;
 
     private:
         Lexar* lexar;
+        Actions actions;
         LexicalToken currentToken;
+        uint32_t previousTokenEnd;
         void Consume(LexicalTokenType type);
         void ConsumeError(LexicalTokenType type);
+        // No production in the predict table, report the token the non-terminal expects
+        void PredictError(int nonTerminal);
+
+        // Gives the node the source range from start up to the last consumed token
+        template<typename T>
+        T Locate(T node, uint32_t start){
+            Actions::SetLocation(node, start, previousTokenEnd - start);
+            return node;
+        }
 
         //Grammer Handlings
         
         // Main program
-        std::unique_ptr<AST> Program();
-        std::string ProgramHeader();
-        std::unique_ptr<AST> Block();
-        std::vector<std::unique_ptr<AST>> DeclarationPart();
-        std::unique_ptr<AST> VariableDeclaration();
-        std::unique_ptr<AST> VariableDeclarationPart();
-        std::unique_ptr<AST> ConstantDeclaration();
-        ValueNamePair ConstantDeclarationPart();
-        std::unique_ptr<AST> StatementPart(std::vector<std::unique_ptr<AST>>);
-        std::vector<std::unique_ptr<VariableIdentifierAST>> IdentifierList();
+        Node Program();
+        Name ProgramHeader();
+        Node Block();
+        NodeList DeclarationPart();
+        Node VariableDeclaration();
+        Node VariableDeclarationPart();
+        Node ConstantDeclaration();
+        typename Actions::Constant ConstantDeclarationPart();
+        Node StatementPart(NodeList);
+        typename Actions::IdentifierList IdentifierList();
 
         //Procedures
-        std::unique_ptr<AST> ProcedureDeclaration();
-        std::unique_ptr<AST> ProcedureDeclarationPrime(std::unique_ptr<AST>);
-        std::unique_ptr<AST> ProcedureHeader();
-        std::vector<TypeNamePair> ParameterList();
-        TypeNamePair Parameter();
+        Node ProcedureDeclaration();
+        Node ProcedureDeclarationPrime(Node);
+        Node ProcedureHeader();
+        typename Actions::ParameterList ParameterList();
+        typename Actions::Parameter Parameter();
 
         //Functions
-        std::unique_ptr<AST> FunctionDeclaration();
-        std::unique_ptr<AST> FunctionDeclarationPrime(std::unique_ptr<AST>);
-        std::unique_ptr<AST> FunctionHeader();
+        Node FunctionDeclaration();
+        Node FunctionDeclarationPrime(Node);
+        Node FunctionHeader();
         void Directive();
 
         //Statements
-        std::unique_ptr<AST> StatementSequence();
-        std::unique_ptr<AST> Statement();
-        std::unique_ptr<AST> ConditionalStatement();
-        std::unique_ptr<AST> IfStatment();
-        std::unique_ptr<AST> IfStatmentPrime();
-        std::unique_ptr<AST> RepeditiveStatement();
-        std::unique_ptr<AST> WhileStatement();
-        std::unique_ptr<AST> ForStatement();
-        std::unique_ptr<AST> ForStatementPrime(std::string, std::unique_ptr<AST>);
-        std::unique_ptr<AST> BlockStatment();        
-        std::unique_ptr<AST> RegularStatement();
-        std::unique_ptr<AST> RegularStatementPrime(std::string);
-        std::unique_ptr<AST> AssignmentStatement();
-        std::vector<std::unique_ptr<AST>> ProcdureStatement();
-        std::vector<std::unique_ptr<AST>> UsageParameterList();
-        std::unique_ptr<AST> UsageParameter();
+        Node StatementSequence();
+        Node Statement();
+        Node ConditionalStatement();
+        Node IfStatment();
+        Node IfStatmentPrime();
+        Node RepeditiveStatement();
+        Node WhileStatement();
+        Node ForStatement();
+        Node ForStatementPrime(Name, Node);
+        Node BlockStatment();        
+        Node RegularStatement();
+        Node RegularStatementPrime(Name, uint32_t);
+        Node AssignmentStatement();
+        NodeList ProcdureStatement();
+        NodeList UsageParameterList();
+        Node UsageParameter();
 
         //Expressions
-        std::unique_ptr<AST> Expression();
-        std::unique_ptr<AST> ExpressionPrime(std::unique_ptr<AST>);
+        Node Expression();
+        Node ExpressionPrime(Node);
         LexicalTokenType ComparisonOperator();
-        std::unique_ptr<AST> BaseExpression();
-        std::unique_ptr<AST> BaseExpressionPrime(std::unique_ptr<AST>);
+        Node BaseExpression();
+        Node BaseExpressionPrime(Node);
         LexicalTokenType PlusMinusOr();
-        std::unique_ptr<AST> Term();
-        std::unique_ptr<AST> TermPrime(std::unique_ptr<AST>);
+        Node Term();
+        Node TermPrime(Node);
         LexicalTokenType MultDivAnd();
-        std::unique_ptr<AST> Factor();
+        Node Factor();
 
         //MISC
         LexicalTokenType Type();
 };
 
+// Both are instantiated in parser.cpp
+typedef BasicParser<BuildASTActions> Parser;
+// Only checks the syntax, builds nothing
+typedef BasicParser<SyntaxOnlyActions> SyntaxParser;
+
 
 /* Grammer
  *
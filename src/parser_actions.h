@@ -0,0 +1,195 @@
+#ifndef PARSER_ACTIONS_H
+#define PARSER_ACTIONS_H
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include "ast.h"
+#include "expression_table.h"
+#include "lexar.h"
+
+/*
+ * Action policies for BasicParser.
+ *
+ * The parser only decides which productions to take; everything it builds
+ * goes through its Actions parameter. A policy gives the types the grammar
+ * routines pass around (Node, NodeList, Name, ...) and a function per
+ * kind of node. BuildASTActions makes the normal AST, SyntaxOnlyActions makes
+ * nothing, so a syntax check allocates no nodes and copies no identifiers.
+ *
+ * The parser keeps an instance of its policy, so a policy can carry state.
+ * keepsIdentifierNames says whether GetName reads identifierName, the lexer
+ * leaves it empty for policies that don't.
+ */
+
+struct BuildASTActions{
+    typedef std::unique_ptr<AST> Node;
+    typedef std::vector<std::unique_ptr<AST>> NodeList;
+    typedef std::string Name;
+    typedef std::unique_ptr<VariableIdentifierAST> Identifier;
+    typedef std::vector<std::unique_ptr<VariableIdentifierAST>> IdentifierList;
+    typedef TypeNamePair Parameter;
+    typedef std::vector<TypeNamePair> ParameterList;
+    typedef ValueNamePair Constant;
+    typedef std::vector<ValueNamePair> ConstantList;
+
+    static const bool keepsIdentifierNames = true;
+
+    // When set, pure expressions are numbered as they're built
+    ExpressionTable *expressions;
+
+    BuildASTActions(ExpressionTable *expressions = nullptr): expressions(expressions){};
+
+    static Name GetName(const LexicalToken &token){
+        return token.identifierName;
+    }
+
+    template<typename T>
+    static void SetLocation(std::unique_ptr<T> &node, uint32_t offset, uint32_t length){
+        if(node)
+            node->SetLocation(offset, length);
+    }
+
+    static uint32_t GetOffset(const Node &node){
+        return node->GetOffset();
+    }
+
+    // Main program
+    static Node Program(Name name, NodeList declarations, Node statements){
+        return std::make_unique<ProgramAST>(name, std::move(declarations), std::move(statements));
+    }
+    static Node MainBlock(NodeList declarations, Node statements){
+        return std::make_unique<MainBlockAST>(std::move(declarations), std::move(statements));
+    }
+    static Node VariableDeclarations(NodeList declarations){
+        return std::make_unique<VariableDeclarationsAST>(std::move(declarations));
+    }
+    static Node VariableDeclarationsOfType(IdentifierList identifiers, LexicalTokenType type){
+        return std::make_unique<VariableDeclarationsOfTypeAST>(std::move(identifiers), type);
+    }
+    static Node ConstantDeclarations(ConstantList constants){
+        return std::make_unique<ConstantDeclarationsAST>(std::move(constants));
+    }
+    static Constant MakeConstant(int value, Name name){
+        return {value, name};
+    }
+    Identifier VariableIdentifier(Name name){
+        auto node = std::make_unique<VariableIdentifierAST>(name);
+        if(expressions)
+            node->SetValueNumber(expressions->Variable(name));
+        return node;
+    }
+
+    // Procedures and functions
+    static Node Prototype(Name name, ParameterList params, LexicalTokenType returnType){
+        return std::make_unique<PrototypeAST>(name, std::move(params), returnType);
+    }
+    static Node Function(Node proto, Node body){
+        return std::make_unique<FunctionAST>(std::move(proto), std::move(body));
+    }
+    static Parameter MakeParameter(LexicalTokenType type, Name name){
+        return {type, name};
+    }
+
+    // Statements
+    static Node StatementSequence(NodeList statements){
+        return std::make_unique<StatementSequenceAST>(std::move(statements));
+    }
+    static Node If(Node cond, Node thenPart, Node elsePart){
+        return std::make_unique<IfExpressionAST>(std::move(cond), std::move(thenPart), std::move(elsePart));
+    }
+    static Node While(Node cond, Node body){
+        return std::make_unique<WhileExpressionAST>(std::move(cond), std::move(body));
+    }
+    static Node For(Name loopVar, LexicalTokenType direction, Node start, Node end, Node step, Node body){
+        return std::make_unique<ForExpressionAST>(loopVar, direction, std::move(start), std::move(end), std::move(step), std::move(body));
+    }
+    static Node ExitBreak(LexicalTokenType type){
+        return std::make_unique<ExitBreakStatementAST>(type);
+    }
+    static Node Call(Name callee, NodeList args){
+        return std::make_unique<CallExpessionsAst>(callee, std::move(args));
+    }
+
+    // Expressions
+    Node BinaryOp(LexicalTokenType op, Node lhs, Node rhs){
+        return Numbered(std::make_unique<BinaryOpAST>(op, std::move(lhs), std::move(rhs)));
+    }
+    Node ComparisonOp(LexicalTokenType op, Node lhs, Node rhs){
+        return Numbered(std::make_unique<ComparisonOpAST>(op, std::move(lhs), std::move(rhs)));
+    }
+    Node UnaryOp(LexicalTokenType op, Node expression){
+        auto node = std::make_unique<UnaryOpAST>(op, std::move(expression));
+        if(expressions && node->GetExpression())
+            node->SetValueNumber(expressions->Operation(AST_UNARY_OP, op, node->GetExpression()->GetValueNumber(), 0));
+        return node;
+    }
+    Node Number(int value){
+        auto node = std::make_unique<NumberAST>(value);
+        if(expressions)
+            node->SetValueNumber(expressions->Number(value));
+        return node;
+    }
+
+    // Binary and comparison operators are numbered from their operands
+    template<typename T>
+    Node Numbered(std::unique_ptr<T> node){
+        if(expressions && node->GetLHS() && node->GetRHS())
+            node->SetValueNumber(expressions->Operation(node->GetKind(), node->GetOp(),
+                        node->GetLHS()->GetValueNumber(), node->GetRHS()->GetValueNumber()));
+        return node;
+    }
+};
+
+struct SyntaxOnlyActions{
+    struct Nothing{};
+    // Swallows whatever the grammar routines collect
+    struct NoList{
+        template<typename T>
+        void push_back(const T&){}
+    };
+
+    typedef Nothing Node;
+    typedef NoList NodeList;
+    typedef Nothing Name;
+    typedef Nothing Identifier;
+    typedef NoList IdentifierList;
+    typedef Nothing Parameter;
+    typedef NoList ParameterList;
+    typedef Nothing Constant;
+    typedef NoList ConstantList;
+
+    static const bool keepsIdentifierNames = false;
+
+    static Name GetName(const LexicalToken&){ return {}; }
+    static void SetLocation(Nothing&, uint32_t, uint32_t){}
+    static uint32_t GetOffset(const Node&){ return 0; }
+
+    static Node Program(Name, NodeList, Node){ return {}; }
+    static Node MainBlock(NodeList, Node){ return {}; }
+    static Node VariableDeclarations(NodeList){ return {}; }
+    static Node VariableDeclarationsOfType(IdentifierList, LexicalTokenType){ return {}; }
+    static Node ConstantDeclarations(ConstantList){ return {}; }
+    static Constant MakeConstant(int, Name){ return {}; }
+    static Identifier VariableIdentifier(Name){ return {}; }
+
+    static Node Prototype(Name, ParameterList, LexicalTokenType){ return {}; }
+    static Node Function(Node, Node){ return {}; }
+    static Parameter MakeParameter(LexicalTokenType, Name){ return {}; }
+
+    static Node StatementSequence(NodeList){ return {}; }
+    static Node If(Node, Node, Node){ return {}; }
+    static Node While(Node, Node){ return {}; }
+    static Node For(Name, LexicalTokenType, Node, Node, Node, Node){ return {}; }
+    static Node ExitBreak(LexicalTokenType){ return {}; }
+    static Node Call(Name, NodeList){ return {}; }
+
+    static Node BinaryOp(LexicalTokenType, Node, Node){ return {}; }
+    static Node ComparisonOp(LexicalTokenType, Node, Node){ return {}; }
+    static Node UnaryOp(LexicalTokenType, Node){ return {}; }
+    static Node Number(int){ return {}; }
+};
+
+#endif
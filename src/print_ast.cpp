@@ -1,5 +1,13 @@
 #include "ast.h"
 
+void AST::PrintNode(int depth){
+    switch(GetKind()){
+#define AST_NODE(KIND, CLASS) \
+        case AST_##KIND: llvm::cast<CLASS>(this)->PrintNode(depth); break;
+#include "ast_nodes.def"
+    }
+}
+
 // Print functions
 void MainBlockAST::PrintNode(int depth){
     for(int i = 0; i<declarations.size(); i++){
@@ -0,0 +1,134 @@
+#include "runtime.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define BUFFER_SIZE (1 << 16)
+// The longest line writeln makes, "-9223372036854775808\n"
+#define MAX_LINE 21
+
+/************************/
+/*        Output        */
+/************************/
+
+static char output[BUFFER_SIZE];
+static size_t outputUsed;
+static int flushAtExit;
+
+// "00" to "99", so each division by 100 gives two digits at once
+static const char digitPairs[201] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+void pascal_flush(void){
+    size_t written = 0;
+    while(written < outputUsed){
+        ssize_t result = write(STDOUT_FILENO, output + written, outputUsed - written);
+        if(result < 0 && errno == EINTR)
+            continue;
+        // Nowhere left to report it, drop what couldn't be written
+        if(result <= 0)
+            break;
+        written += result;
+    }
+    outputUsed = 0;
+}
+
+void pascal_writeln(int64_t value){
+    if(!flushAtExit){
+        atexit(pascal_flush);
+        flushAtExit = 1;
+    }
+    if(BUFFER_SIZE - outputUsed < MAX_LINE)
+        pascal_flush();
+
+    // Digits are made backwards from the end of a scratch line
+    char line[MAX_LINE];
+    char *end = line + MAX_LINE;
+    char *start = end;
+    *--start = '\n';
+    // Negating in unsigned also works for INT64_MIN
+    uint64_t magnitude = value < 0 ? 0 - (uint64_t) value : (uint64_t) value;
+    while(magnitude >= 100){
+        const char *pair = digitPairs + (magnitude % 100) * 2;
+        magnitude /= 100;
+        *--start = pair[1];
+        *--start = pair[0];
+    }
+    if(magnitude >= 10){
+        const char *pair = digitPairs + magnitude * 2;
+        *--start = pair[1];
+        *--start = pair[0];
+    }
+    else
+        *--start = (char)('0' + magnitude);
+    if(value < 0)
+        *--start = '-';
+
+    memcpy(output + outputUsed, start, end - start);
+    outputUsed += end - start;
+}
+
+/************************/
+/*        Input         */
+/************************/
+
+static char input[BUFFER_SIZE];
+static size_t inputPos, inputEnd;
+static int inputDone;
+
+// Makes sure there's an unread byte, returns 0 at the end of input
+static int Refill(void){
+    if(inputPos < inputEnd)
+        return 1;
+    if(inputDone)
+        return 0;
+    // Whatever the program printed (a prompt) should be visible while it waits
+    pascal_flush();
+    ssize_t result;
+    do{
+        result = read(STDIN_FILENO, input, BUFFER_SIZE);
+    } while(result < 0 && errno == EINTR);
+    if(result <= 0){
+        inputDone = 1;
+        return 0;
+    }
+    inputPos = 0;
+    inputEnd = result;
+    return 1;
+}
+
+static int IsSpace(char c){
+    return c == ' ' || c == '\n' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+int64_t pascal_readln(int64_t current){
+    while(Refill() && IsSpace(input[inputPos]))
+        inputPos++;
+    if(!Refill())
+        return current;
+
+    int negative = 0;
+    if(input[inputPos] == '-' || input[inputPos] == '+'){
+        negative = input[inputPos] == '-';
+        inputPos++;
+    }
+    // Like scanf the character that isn't a number stays unread
+    if(!Refill() || input[inputPos] < '0' || input[inputPos] > '9')
+        return current;
+
+    uint64_t value = 0;
+    while(Refill() && input[inputPos] >= '0' && input[inputPos] <= '9')
+        value = value * 10 + (uint64_t)(input[inputPos++] - '0');
+    return (int64_t)(negative ? 0 - value : value);
+}
@@ -0,0 +1,36 @@
+#ifndef RUNTIME_H
+#define RUNTIME_H
+
+#include <stdint.h>
+
+/*
+ * The runtime library compiled programs link against (libpascal_runtime.a
+ * next to the compiler), and that --run binds the JIT to. writeln and readln
+ * are lowered to calls into it instead of printf and scanf.
+ *
+ * Output collects in a 64KB buffer and goes out with one write() when it
+ * fills, when the program is about to wait for input and at exit. Input is
+ * read() 64KB at a time and integers are parsed straight out of the buffer.
+ * Neither side parses a format string or looks at the locale.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// writeln(value), the decimal value and a newline
+void pascal_writeln(int64_t value);
+
+// readln(variable), the next integer on stdin. Like scanf's %d it skips
+// leading whitespace and takes an optional sign, current is returned
+// unchanged at the end of input or if there's no number next.
+int64_t pascal_readln(int64_t current);
+
+// Writes out everything buffered so far, runs by itself at exit
+void pascal_flush(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,58 @@
+#include <algorithm>
+#include "source_location.h"
+
+static const LineTable *diagnosticLineTable = nullptr;
+
+LineTable::LineTable(){
+    Clear();
+}
+
+void LineTable::Clear(){
+    lineStarts.clear();
+    lineStarts.push_back(0);
+}
+
+void LineTable::AddLineStart(uint32_t offset){
+    //The lexar can ask twice if it gets re-initialized on the same text
+    if(offset > lineStarts.back())
+        lineStarts.push_back(offset);
+}
+
+SourceLocation LineTable::Resolve(uint32_t offset) const{
+    auto next = std::upper_bound(lineStarts.begin(), lineStarts.end(), offset);
+    unsigned line = next - lineStarts.begin();
+    return {line, offset - *(next - 1) + 1};
+}
+
+uint32_t LineTable::GetLineStart(unsigned line) const{
+    if(line == 0)
+        return 0;
+    if(line > lineStarts.size())
+        return lineStarts.back();
+    return lineStarts[line - 1];
+}
+
+std::string LineTable::Describe(uint32_t offset) const{
+    auto loc = Resolve(offset);
+    return fileName + ":" + std::to_string(loc.line) + ":" + std::to_string(loc.column);
+}
+
+LineTable LineTable::FromText(const std::string &fileName, const char *text, size_t size){
+    LineTable table;
+    table.fileName = fileName;
+    for(size_t i = 0; i<size; i++){
+        if(text[i] == '\n')
+            table.AddLineStart(i + 1);
+    }
+    return table;
+}
+
+void SetDiagnosticLineTable(const LineTable *table){
+    diagnosticLineTable = table;
+}
+
+std::string DescribeLocation(uint32_t offset){
+    if(!diagnosticLineTable)
+        return "";
+    return diagnosticLineTable->Describe(offset);
+}
@@ -0,0 +1,41 @@
+#ifndef SOURCE_LOCATION_H
+#define SOURCE_LOCATION_H
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+// Nodes and tokens only keep a byte offset into the source. Line and column
+// are worked out from the line table when something actually needs printing.
+struct SourceLocation{
+    unsigned line;
+    unsigned column;
+};
+
+class LineTable{
+    public:
+        LineTable();
+
+        std::string fileName;
+
+        // Offset of the first character on a new line
+        void AddLineStart(uint32_t offset);
+        void Clear();
+        SourceLocation Resolve(uint32_t offset) const;
+        // Offset of the first character on a line (1 based), the last line's if past the end
+        uint32_t GetLineStart(unsigned line) const;
+        // file:line:col
+        std::string Describe(uint32_t offset) const;
+
+        static LineTable FromText(const std::string &fileName, const char *text, size_t size);
+
+    private:
+        std::vector<uint32_t> lineStarts;
+};
+
+// The table diagnostics outside of the parser (codegen etc) resolve against.
+// Returns an empty string if none was set.
+void SetDiagnosticLineTable(const LineTable *table);
+std::string DescribeLocation(uint32_t offset);
+
+#endif
@@ -0,0 +1,368 @@
+#include "symbol_index.h"
+#include "ast_serialize.h"
+#include "ast_visitor.h"
+#include "lexar.h"
+#include "parser.h"
+
+#include <algorithm>
+#include <string.h>
+
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Support/EndianStream.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace llvm;
+
+static const char SymbolIndexMagic[4] = {'P', 'I', 'D', 'X'};
+
+const char *symbolKindNames[] = {"procedure", "function", "constant", "variable"};
+const char *symbolRoleNames[] = {"definition", "forward declaration", "reference"};
+
+/************************/
+/*       Collecting     */
+/************************/
+
+class SymbolCollector{
+    private:
+        const LineTable &lines;
+        uint32_t file;
+        // Innermost last, the program's declarations at the bottom
+        std::vector<StringMap<SymbolKind>> scopes;
+
+        void Add(const std::string &name, SymbolKind kind, SymbolRole role, AST *at, uint32_t length){
+            auto location = lines.Resolve(at->GetOffset());
+            symbols.push_back({name, {file, at->GetOffset(), length, location.line, location.column, kind, role}});
+        }
+        void Define(const std::string &name, SymbolKind kind, SymbolRole role, AST *at){
+            scopes.back()[name] = kind;
+            Add(name, kind, role, at, at->GetLength());
+        }
+        SymbolKind Lookup(const std::string &name, SymbolKind fallback){
+            for(auto scope = scopes.rbegin(); scope != scopes.rend(); ++scope){
+                auto found = scope->find(name);
+                if(found != scope->end())
+                    return found->second;
+            }
+            // Builtins like writeln and anything undeclared
+            return fallback;
+        }
+        static SymbolKind KindOf(PrototypeAST *proto){
+            return proto->GetReturnType() == EOI ? SYMBOL_KIND_PROCEDURE : SYMBOL_KIND_FUNCTION;
+        }
+
+    public:
+        std::vector<std::pair<std::string, SymbolOccurrence>> symbols;
+
+        SymbolCollector(const LineTable &lines, uint32_t file): lines(lines), file(file), scopes(1){};
+
+        void Collect(AST *node){
+            switch(node->GetKind()){
+                case AST_VARIABLE_DECLARATIONS_OF_TYPE:
+                    for(auto &ident : cast<VariableDeclarationsOfTypeAST>(node)->GetIdentifiers())
+                        Define(ident->GetName(), SYMBOL_KIND_VARIABLE, SYMBOL_ROLE_DEFINITION, ident.get());
+                    return;
+                case AST_CONSTANT_DECLARATIONS:
+                    //Constants don't keep their own location, use the const part's
+                    for(auto &constant : cast<ConstantDeclarationsAST>(node)->GetConstants())
+                        Define(constant.name, SYMBOL_KIND_CONSTANT, SYMBOL_ROLE_DEFINITION, node);
+                    return;
+                case AST_PROTOTYPE:{
+                    // Only reached for forward declarations, FunctionAST handles its own
+                    auto proto = cast<PrototypeAST>(node);
+                    Define(proto->GetName(), KindOf(proto), SYMBOL_ROLE_FORWARD, proto);
+                    return;
+                }
+                case AST_FUNCTION:{
+                    auto proto = cast<FunctionAST>(node)->GetPrototype();
+                    Define(proto->GetName(), KindOf(proto), SYMBOL_ROLE_DEFINITION, proto);
+                    scopes.emplace_back();
+                    //Parameters don't keep their own location either
+                    for(auto &arg : proto->GetArgs())
+                        Define(arg.name, SYMBOL_KIND_VARIABLE, SYMBOL_ROLE_DEFINITION, proto);
+                    if(auto &body = cast<FunctionAST>(node)->GetBody())
+                        Collect(body.get());
+                    scopes.pop_back();
+                    return;
+                }
+                case AST_VARIABLE_IDENTIFIER:{
+                    auto name = cast<VariableIdentifierAST>(node)->GetName();
+                    Add(name, Lookup(name, SYMBOL_KIND_VARIABLE), SYMBOL_ROLE_REFERENCE, node, node->GetLength());
+                    break;
+                }
+                case AST_CALL:{
+                    auto &callee = cast<CallExpessionsAst>(node)->GetCallee();
+                    Add(callee, Lookup(callee, SYMBOL_KIND_PROCEDURE), SYMBOL_ROLE_REFERENCE, node, callee.size());
+                    break;
+                }
+                case AST_FOR:{
+                    //The loop variable has no node of its own, point at the whole statement
+                    auto &loopVar = cast<ForExpressionAST>(node)->GetLoopVarName();
+                    Add(loopVar, Lookup(loopVar, SYMBOL_KIND_VARIABLE), SYMBOL_ROLE_REFERENCE, node, node->GetLength());
+                    break;
+                }
+                default:
+                    break;
+            }
+            ForEachChild(node, [&](AST *child){ Collect(child); });
+        }
+};
+
+std::vector<std::pair<std::string, SymbolOccurrence>> CollectSymbols(AST *tree, const LineTable &lines, uint32_t file){
+    SymbolCollector collector(lines, file);
+    collector.Collect(tree);
+    return std::move(collector.symbols);
+}
+
+/************************/
+/*        Reading       */
+/************************/
+
+std::unique_ptr<SymbolIndex> SymbolIndex::Open(const std::string &fileName){
+    auto buffer = MemoryBuffer::getFile(fileName, /*IsText*/ false, /*RequiresNullTerminator*/ false);
+    if(!buffer)
+        return nullptr;
+
+    const char *start = (*buffer)->getBufferStart();
+    size_t size = (*buffer)->getBufferSize();
+    if(size < sizeof(Header))
+        return nullptr;
+    auto header = reinterpret_cast<const Header*>(start);
+    if(memcmp(header->magic, SymbolIndexMagic, sizeof(SymbolIndexMagic)) != 0 ||
+       header->version != SYMBOL_INDEX_VERSION)
+        return nullptr;
+
+    uint64_t expected = sizeof(Header) + (uint64_t) header->fileCount * sizeof(File)
+                      + (uint64_t) header->nameCount * sizeof(Name)
+                      + (uint64_t) header->occurrenceCount * sizeof(Occurrence)
+                      + header->stringSize;
+    if(expected != size){
+        printf("Malformed symbol index %s\n", fileName.c_str());
+        return nullptr;
+    }
+
+    std::unique_ptr<SymbolIndex> index(new SymbolIndex());
+    const char *cur = start + sizeof(Header);
+    index->files = makeArrayRef(reinterpret_cast<const File*>(cur), header->fileCount);
+    cur += header->fileCount * sizeof(File);
+    index->names = makeArrayRef(reinterpret_cast<const Name*>(cur), header->nameCount);
+    cur += header->nameCount * sizeof(Name);
+    index->occurrences = makeArrayRef(reinterpret_cast<const Occurrence*>(cur), header->occurrenceCount);
+    cur += header->occurrenceCount * sizeof(Occurrence);
+    index->strings = StringRef(cur, header->stringSize);
+
+    // Everything the accessors index with has to be in range
+    for(auto &file : index->files){
+        if((uint64_t) file.path + file.pathLength > header->stringSize){
+            printf("Malformed symbol index %s\n", fileName.c_str());
+            return nullptr;
+        }
+    }
+    for(auto &name : index->names){
+        if((uint64_t) name.name + name.nameLength > header->stringSize ||
+           (uint64_t) name.firstOccurrence + name.occurrenceCount > header->occurrenceCount){
+            printf("Malformed symbol index %s\n", fileName.c_str());
+            return nullptr;
+        }
+    }
+    for(auto &occurrence : index->occurrences){
+        if(occurrence.file >= header->fileCount || occurrence.kind > SYMBOL_KIND_VARIABLE ||
+           occurrence.role > SYMBOL_ROLE_REFERENCE){
+            printf("Malformed symbol index %s\n", fileName.c_str());
+            return nullptr;
+        }
+    }
+    index->buffer = std::move(*buffer);
+    return index;
+}
+
+StringRef SymbolIndex::GetFilePath(uint32_t file) const{
+    return strings.substr(files[file].path, files[file].pathLength);
+}
+
+StringRef SymbolIndex::GetName(uint32_t name) const{
+    return strings.substr(names[name].name, names[name].nameLength);
+}
+
+ArrayRef<SymbolIndex::Occurrence> SymbolIndex::GetOccurrences(uint32_t name) const{
+    return occurrences.slice(names[name].firstOccurrence, names[name].occurrenceCount);
+}
+
+ArrayRef<SymbolIndex::Occurrence> SymbolIndex::Find(StringRef name) const{
+    auto found = std::lower_bound(names.begin(), names.end(), name, [&](const Name &entry, StringRef name){
+        return strings.substr(entry.name, entry.nameLength) < name;
+    });
+    if(found == names.end() || strings.substr(found->name, found->nameLength) != name)
+        return {};
+    return GetOccurrences(found - names.begin());
+}
+
+/************************/
+/*        Updating      */
+/************************/
+
+bool UpdateSymbolIndex(const std::string &indexFileName, const std::vector<std::string> &sources){
+    auto old = SymbolIndex::Open(indexFileName);
+
+    struct IndexedFile{
+        std::string path;
+        uint64_t contentHash;
+        // Occurrences come from the old index unless it was reparsed
+        bool reparsed;
+    };
+    std::vector<IndexedFile> files;
+    StringMap<uint32_t> fileIds;
+    // Old file number to new, -1 for files that are gone
+    std::vector<int64_t> oldFileIds;
+
+    if(old){
+        for(uint32_t i = 0; i<old->GetFileCount(); i++){
+            auto path = old->GetFilePath(i);
+            if(!sys::fs::exists(path)){
+                oldFileIds.push_back(-1);
+                continue;
+            }
+            oldFileIds.push_back(files.size());
+            fileIds[path] = files.size();
+            files.push_back({path.str(), old->GetFileHash(i), false});
+        }
+    }
+
+    std::vector<std::pair<std::string, SymbolOccurrence>> symbols;
+    for(auto &source : sources){
+        SmallString<256> path;
+        if(sys::fs::real_path(source, path)){
+            printf("Could not find %s\n", source.c_str());
+            continue;
+        }
+        auto text = MemoryBuffer::getFile(path);
+        if(!text){
+            printf("Could not read %s\n", source.c_str());
+            continue;
+        }
+
+        uint64_t contentHash = HashSource((*text)->getBuffer());
+        auto known = fileIds.find(path);
+        if(known != fileIds.end() && files[known->second].contentHash == contentHash)
+            continue;
+
+        Lexar lexar = Lexar();
+        lexar.quiet = true;
+        lexar.Init((*text)->getBuffer().str());
+        lexar.lineTable.fileName = source;
+        Parser parser = Parser(&lexar);
+        parser.quiet = true;
+        if(!parser.Parse()){
+            printf("%s: %s\n", lexar.lineTable.Describe(parser.errorOffset).c_str(), parser.errorMessage.c_str());
+            continue;
+        }
+
+        uint32_t file;
+        if(known != fileIds.end()){
+            file = known->second;
+        }
+        else{
+            file = files.size();
+            fileIds[path] = file;
+            files.push_back({path.str().str(), 0, false});
+        }
+        files[file].contentHash = contentHash;
+        files[file].reparsed = true;
+        auto fileSymbols = CollectSymbols(parser.tree.get(), lexar.lineTable, file);
+        std::move(fileSymbols.begin(), fileSymbols.end(), std::back_inserter(symbols));
+    }
+
+    if(old){
+        for(uint32_t name = 0; name<old->GetNameCount(); name++){
+            for(auto &occurrence : old->GetOccurrences(name)){
+                int64_t file = oldFileIds[occurrence.file];
+                if(file < 0 || files[file].reparsed)
+                    continue;
+                symbols.push_back({old->GetName(name).str(),
+                        {(uint32_t) file, occurrence.offset, occurrence.length, occurrence.line, occurrence.column,
+                         (SymbolKind) occurrence.kind, (SymbolRole) occurrence.role}});
+            }
+        }
+    }
+
+    std::sort(symbols.begin(), symbols.end(), [](const std::pair<std::string, SymbolOccurrence> &a,
+                                                  const std::pair<std::string, SymbolOccurrence> &b){
+        if(a.first != b.first)
+            return a.first < b.first;
+        if(a.second.file != b.second.file)
+            return a.second.file < b.second.file;
+        return a.second.offset < b.second.offset;
+    });
+
+    // Strings are written paths first, then each distinct name once
+    std::string strings;
+    std::vector<std::pair<uint32_t, uint32_t>> names;
+    std::vector<uint32_t> nameStrings;
+    for(auto &file : files)
+        strings += file.path;
+    for(uint32_t i = 0; i<symbols.size(); i++){
+        if(i == 0 || symbols[i].first != symbols[i - 1].first){
+            nameStrings.push_back(strings.size());
+            strings += symbols[i].first;
+            names.push_back({i, 0});
+        }
+        names.back().second++;
+    }
+
+    // Written next to the old one and renamed over it, so a reader never maps half a file
+    std::string tempFileName = indexFileName + ".tmp";
+    std::error_code error_code;
+    {
+        raw_fd_ostream out(tempFileName, error_code, sys::fs::OF_None);
+        if(error_code){
+            printf("Could not open %s: %s\n", tempFileName.c_str(), error_code.message().c_str());
+            return false;
+        }
+
+        support::endian::Writer writer(out, support::little);
+        out.write(SymbolIndexMagic, sizeof(SymbolIndexMagic));
+        writer.write<uint32_t>(SYMBOL_INDEX_VERSION);
+        writer.write<uint32_t>(files.size());
+        writer.write<uint32_t>(names.size());
+        writer.write<uint32_t>(symbols.size());
+        writer.write<uint32_t>(strings.size());
+
+        uint32_t pathOffset = 0;
+        for(auto &file : files){
+            writer.write<uint64_t>(file.contentHash);
+            writer.write<uint32_t>(pathOffset);
+            writer.write<uint32_t>(file.path.size());
+            pathOffset += file.path.size();
+        }
+        for(size_t i = 0; i<names.size(); i++){
+            writer.write<uint32_t>(nameStrings[i]);
+            writer.write<uint32_t>(symbols[names[i].first].first.size());
+            writer.write<uint32_t>(names[i].first);
+            writer.write<uint32_t>(names[i].second);
+        }
+        for(auto &symbol : symbols){
+            auto &occurrence = symbol.second;
+            writer.write<uint32_t>(occurrence.file);
+            writer.write<uint32_t>(occurrence.offset);
+            writer.write<uint32_t>(occurrence.length);
+            writer.write<uint32_t>(occurrence.line);
+            writer.write<uint32_t>(occurrence.column);
+            writer.write<uint8_t>(occurrence.kind);
+            writer.write<uint8_t>(occurrence.role);
+            writer.write<uint16_t>(0);
+        }
+        out << strings;
+        if(out.has_error()){
+            printf("Could not write %s\n", tempFileName.c_str());
+            return false;
+        }
+    }
+
+    // The old index is still mapped, it has to go before the file is replaced
+    old.reset();
+    if(auto error = sys::fs::rename(tempFileName, indexFileName)){
+        printf("Could not write %s: %s\n", indexFileName.c_str(), error.message().c_str());
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,132 @@
+#ifndef SYMBOL_INDEX_H
+#define SYMBOL_INDEX_H
+
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+#include <stdint.h>
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/Endian.h"
+#include "llvm/Support/MemoryBuffer.h"
+
+#include "ast.h"
+#include "source_location.h"
+
+/*
+ * Symbol index files
+ *
+ * Records every definition and use of procedures, functions, constants and
+ * variables over a set of source files, so find-references can be answered
+ * without parsing anything. The file is laid out so it can be used straight
+ * from the memory map, every field is a fixed width little endian integer:
+ *
+ *  header          magic "PIDX", version and the four counts below
+ *  files           content hash (xxHash64) and path of each indexed file
+ *  names           every distinct symbol name, sorted, with the range of
+ *                  occurrences that belong to it
+ *  occurrences     grouped by name, then by file and offset
+ *  strings         the bytes of the names and paths
+ *
+ * Looking a name up is a binary search over the names and gives back a slice
+ * of the occurrences. Updating reparses only the files whose content hash
+ * changed, the occurrences of the others are copied from the old index.
+ */
+
+#define SYMBOL_INDEX_VERSION 1
+
+enum SymbolKind: uint8_t{
+    SYMBOL_KIND_PROCEDURE,
+    SYMBOL_KIND_FUNCTION,
+    SYMBOL_KIND_CONSTANT,
+    SYMBOL_KIND_VARIABLE,
+};
+
+enum SymbolRole: uint8_t{
+    SYMBOL_ROLE_DEFINITION,
+    SYMBOL_ROLE_FORWARD,
+    SYMBOL_ROLE_REFERENCE,
+};
+
+extern const char *symbolKindNames[];
+extern const char *symbolRoleNames[];
+
+struct SymbolOccurrence{
+    uint32_t file;
+    uint32_t offset;
+    uint32_t length;
+    uint32_t line;
+    uint32_t column;
+    SymbolKind kind;
+    SymbolRole role;
+};
+
+// Walks a parsed program and returns every symbol occurrence in it, in source
+// order, paired with the symbol's name. Uses are resolved through the
+// enclosing scopes to find out what kind of symbol they refer to.
+std::vector<std::pair<std::string, SymbolOccurrence>> CollectSymbols(AST *tree, const LineTable &lines, uint32_t file);
+
+class SymbolIndex{
+    public:
+        // On disk records, read in place
+        struct Header{
+            char magic[4];
+            llvm::support::ulittle32_t version;
+            llvm::support::ulittle32_t fileCount;
+            llvm::support::ulittle32_t nameCount;
+            llvm::support::ulittle32_t occurrenceCount;
+            llvm::support::ulittle32_t stringSize;
+        };
+        struct File{
+            llvm::support::ulittle64_t contentHash;
+            llvm::support::ulittle32_t path;
+            llvm::support::ulittle32_t pathLength;
+        };
+        struct Name{
+            llvm::support::ulittle32_t name;
+            llvm::support::ulittle32_t nameLength;
+            llvm::support::ulittle32_t firstOccurrence;
+            llvm::support::ulittle32_t occurrenceCount;
+        };
+        struct Occurrence{
+            llvm::support::ulittle32_t file;
+            llvm::support::ulittle32_t offset;
+            llvm::support::ulittle32_t length;
+            llvm::support::ulittle32_t line;
+            llvm::support::ulittle32_t column;
+            uint8_t kind;
+            uint8_t role;
+            uint8_t unused[2];
+        };
+
+        // Returns nullptr if the file is missing, from another version or malformed
+        static std::unique_ptr<SymbolIndex> Open(const std::string &fileName);
+
+        uint32_t GetFileCount() const {return files.size();};
+        llvm::StringRef GetFilePath(uint32_t file) const;
+        uint64_t GetFileHash(uint32_t file) const {return files[file].contentHash;};
+
+        uint32_t GetNameCount() const {return names.size();};
+        llvm::StringRef GetName(uint32_t name) const;
+        llvm::ArrayRef<Occurrence> GetOccurrences(uint32_t name) const;
+
+        // Every occurrence of name, empty if it isn't in the index
+        llvm::ArrayRef<Occurrence> Find(llvm::StringRef name) const;
+
+    private:
+        std::unique_ptr<llvm::MemoryBuffer> buffer;
+        llvm::ArrayRef<File> files;
+        llvm::ArrayRef<Name> names;
+        llvm::ArrayRef<Occurrence> occurrences;
+        llvm::StringRef strings;
+};
+
+// Brings the index at indexFileName up to date with the given sources, adding
+// them if they aren't in it yet. Files that were indexed before and no longer
+// exist are dropped. Returns false and prints an error if the index can't be
+// written, sources that don't parse are reported and keep their old entries.
+bool UpdateSymbolIndex(const std::string &indexFileName, const std::vector<std::string> &sources);
+
+#endif
@@ -0,0 +1,96 @@
+#include "type_check.h"
+#include "ast_visitor.h"
+#include "source_location.h"
+
+#include <stdio.h>
+
+using namespace llvm;
+
+namespace{
+
+class TypeChecker{
+    private:
+        void Report(AST *node, const std::string &message){
+            auto loc = DescribeLocation(node->GetOffset());
+            fprintf(stderr, "Error: %s%s\n", loc.empty() ? "" : (loc + ": ").c_str(), message.c_str());
+            errors++;
+        }
+
+        // node is where an integer is needed
+        void NeedInteger(AST *node, const std::string &where){
+            if(node && IsBoolean(node))
+                Report(node, "A comparison can't be used as an integer in " + where);
+        }
+
+        void CheckBinary(BinaryOpAST *op){
+            AST *lhs = op->GetLHS().get(), *rhs = op->GetRHS().get();
+            if(!lhs || !rhs)
+                return;
+            switch(op->GetOp()){
+                case AND:
+                case OR:
+                    if(IsBoolean(lhs) != IsBoolean(rhs))
+                        Report(op, "Both sides of and/or have to be comparisons, or both integers");
+                    return;
+                case ASSIGN:{
+                    auto var = dyn_cast<VariableIdentifierAST>(lhs);
+                    NeedInteger(rhs, "an assignment to " + (var ? var->GetName() : std::string("a variable")));
+                    return;
+                }
+                default:
+                    NeedInteger(lhs, "arithmetic");
+                    NeedInteger(rhs, "arithmetic");
+                    return;
+            }
+        }
+
+        void CheckCall(CallExpessionsAst *call){
+            // writeln prints a boolean as 0 or 1, the rest take variables
+            if(call->GetBuiltin() != BUILTIN_NONE)
+                return;
+            for(size_t i = 0; i<call->GetArgs().size(); i++)
+                NeedInteger(call->GetArgs()[i].get(), "argument " + std::to_string(i + 1) + " of " + call->GetCallee());
+        }
+
+    public:
+        unsigned errors = 0;
+
+        void Check(AST *node){
+            ForEachChild(node, [&](AST *child){ Check(child); });
+            switch(node->GetKind()){
+                case AST_BINARY_OP:
+                    CheckBinary(cast<BinaryOpAST>(node));
+                    break;
+                case AST_COMPARISON_OP:{
+                    auto comparison = cast<ComparisonOpAST>(node);
+                    if(comparison->GetLHS() && comparison->GetRHS() &&
+                       IsBoolean(comparison->GetLHS().get()) != IsBoolean(comparison->GetRHS().get()))
+                        Report(node, "A comparison can only be compared with another comparison");
+                    break;
+                }
+                case AST_UNARY_OP:
+                    NeedInteger(cast<UnaryOpAST>(node)->GetExpression().get(), "a negation");
+                    break;
+                case AST_CALL:
+                    CheckCall(cast<CallExpessionsAst>(node));
+                    break;
+                case AST_FOR:{
+                    auto forNode = cast<ForExpressionAST>(node);
+                    NeedInteger(forNode->GetStart().get(), "the start of a for loop");
+                    NeedInteger(forNode->GetEnd().get(), "the end of a for loop");
+                    NeedInteger(forNode->GetStep().get(), "the step of a for loop");
+                    break;
+                }
+                default:
+                    break;
+            }
+        }
+};
+
+}
+
+unsigned CheckTypes(AST *tree){
+    TypeChecker checker;
+    checker.Check(tree);
+    return checker.errors;
+}
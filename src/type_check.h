@@ -0,0 +1,24 @@
+#ifndef TYPE_CHECK_H
+#define TYPE_CHECK_H
+
+#include "ast.h"
+
+/*
+ * Boolean/integer checking
+ *
+ * Runs after ResolveNames. Comparisons, and and/or of them, are booleans (see
+ * IsBoolean) and everything else is an integer. Booleans may be if and while
+ * conditions, operands of and/or and comparisons with other booleans, and
+ * writeln prints them as 0 or 1. Anywhere else an integer is needed: both
+ * sides of + - * div mod, the operand of a minus, what := stores in a
+ * variable, call arguments and the bounds and step of a for loop. Each
+ * boolean found in one of those places, and each and/or or comparison of a
+ * boolean with an integer, is reported with its location.
+ *
+ * Codegen relies on a tree without any, so the compiler stops if there are.
+ *
+ * Returns how many were reported.
+ */
+unsigned CheckTypes(AST *tree);
+
+#endif
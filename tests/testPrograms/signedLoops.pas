@@ -0,0 +1,43 @@
+{ Loops the optimizer can only reason about with --signed:
+    compiler -O2 signedLoops.pas unsigned
+    compiler -O2 --signed signedLoops.pas signed
+    echo 100000 | ./unsigned; echo 100000 | ./signed
+  Both print 200003. Signed, k * 4 div 4 is an exact division that folds to
+  k, triangle's loop becomes its closed form and k mod 2 of an even k is 0,
+  so the program runs in linear instead of quadratic time. }
+program signedLoops;
+var n, i, j, total : integer;
+
+function triangle(n: integer): integer;
+var k, s: integer;
+begin
+    s := 0;
+    k := 0;
+    while k < n do
+    begin
+        s := s + k * 4 div 4;
+        k := k + 1;
+    end;
+    triangle := s;
+end;
+
+function evens(n: integer): integer;
+var k, s: integer;
+begin
+    s := 0;
+    k := 0;
+    while k < n do
+    begin
+        s := s + k mod 2;
+        k := k + 2;
+    end;
+    evens := s;
+end;
+
+begin
+    readln(n);
+    total := 0;
+    for i := 1 to n do
+        total := total + triangle(i) mod 7 + evens(i);
+    writeln(total);
+end.
@@ -3,6 +3,25 @@
 #include "catch.hpp"
 #include "../src/lexar.h"
 #include "../src/parser.h"
+#include "../src/symbol_index.h"
+#include "../src/name_resolution.h"
+#include "../src/constant_folding.h"
+#include "../src/call_graph.h"
+#include "../src/compile_time_eval.h"
+#include "../src/arithmetic.h"
+#include "../src/type_check.h"
+#include "../src/language_server.h"
+#include "../src/ast_serialize.h"
+#include "../src/ast_visitor.h"
+#include "../src/expression_table.h"
+
+#include <sstream>
+#include <unistd.h>
+
+#include "llvm/Support/EndianStream.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/LEB128.h"
+#include "llvm/Support/raw_ostream.h"
 
 TEST_CASE( "Files can be loaded", "[lexar]" ) {
     Lexar lexar = Lexar();
@@ -81,6 +100,27 @@ TEST_CASE("Tokenization is successful", "[lexar]"){
 
 }
 
+TEST_CASE("Token locations", "[lexar]"){
+    Lexar lexar = Lexar();
+    lexar.Init(std::string("first\n  second := 10"));
+
+    auto first = lexar.NextToken();
+    REQUIRE(first.offset == 0);
+    REQUIRE(first.length == 5);
+    auto second = lexar.NextToken();
+    REQUIRE(second.offset == 8);
+    REQUIRE(second.length == 6);
+    auto assign = lexar.NextToken();
+    REQUIRE(assign.offset == 15);
+    REQUIRE(assign.length == 2);
+    auto number = lexar.NextToken();
+    REQUIRE(number.offset == 18);
+    REQUIRE(number.length == 2);
+
+    auto loc = lexar.lineTable.Resolve(second.offset);
+    REQUIRE(loc.line == 2);
+    REQUIRE(loc.column == 3);
+}
 
 TEST_CASE("Parsing successful", "[parser]"){
     Lexar* lexar = new Lexar();
@@ -110,3 +150,682 @@ TEST_CASE("Parsing successful", "[parser]"){
         REQUIRE(parser.Parse());
     }
 }
+
+TEST_CASE("Syntax only parsing", "[parser]"){
+    Lexar* lexar = new Lexar();
+    SyntaxParser parser = SyntaxParser(lexar);
+    SECTION("Prog1"){
+        lexar->Init("./testPrograms/prog1");
+        REQUIRE(parser.Parse());
+    }
+    SECTION("Prog3"){
+        lexar->Init("./testPrograms/prog3");
+        REQUIRE(!parser.Parse());
+    }
+    SECTION("Prog6"){
+        lexar->Init("./testPrograms/prog6.pas");
+        REQUIRE(parser.Parse());
+    }
+    SECTION("Identifiers aren't copied"){
+        lexar->Init(std::string("program p;"));
+        lexar->NextToken();
+        LexicalToken name = lexar->NextToken();
+        REQUIRE(name.type == IDENTIFIER);
+        REQUIRE(name.identifierName.empty());
+        REQUIRE(name.offset == 8);
+        REQUIRE(name.length == 1);
+    }
+}
+
+TEST_CASE("Identical expressions share a value number", "[parser]"){
+    Lexar lexar = Lexar();
+    lexar.Init(std::string("program p;\nbegin\n  y := x * 2 + (x * 2);\n  z := x * 3;\nend.\n"));
+    ExpressionTable expressions;
+    Parser parser = Parser(&lexar, BuildASTActions(&expressions));
+    REQUIRE(parser.Parse());
+
+    auto program = llvm::cast<ProgramAST>(parser.tree.get());
+    auto &statements = llvm::cast<StatementSequenceAST>(program->GetStatementSequence().get())->GetStatements();
+    auto first = llvm::cast<BinaryOpAST>(statements[0].get());
+    REQUIRE(first->GetValueNumber() == 0);
+    auto sum = llvm::cast<BinaryOpAST>(first->GetRHS().get());
+    REQUIRE(sum->GetLHS()->GetValueNumber() != 0);
+    REQUIRE(sum->GetLHS()->GetValueNumber() == sum->GetRHS()->GetValueNumber());
+
+    auto second = llvm::cast<BinaryOpAST>(statements[1].get());
+    REQUIRE(second->GetRHS()->GetValueNumber() != sum->GetLHS()->GetValueNumber());
+}
+
+TEST_CASE("Symbols are collected with their kind", "[index]"){
+    Lexar lexar = Lexar();
+    lexar.Init(std::string("program p;\nconst c = 1;\nvar x: integer;\n"
+                           "function f(a: integer): integer;\nbegin\n  f := a + c;\nend;\n"
+                           "begin\n  x := f(x);\nend.\n"));
+    Parser parser = Parser(&lexar);
+    REQUIRE(parser.Parse());
+
+    auto symbols = CollectSymbols(parser.tree.get(), lexar.lineTable, 0);
+    auto count = [&](const std::string &name, SymbolKind kind, SymbolRole role){
+        return std::count_if(symbols.begin(), symbols.end(), [&](const std::pair<std::string, SymbolOccurrence> &symbol){
+            return symbol.first == name && symbol.second.kind == kind && symbol.second.role == role;
+        });
+    };
+    REQUIRE(count("c", SYMBOL_KIND_CONSTANT, SYMBOL_ROLE_REFERENCE) == 1);
+    REQUIRE(count("x", SYMBOL_KIND_VARIABLE, SYMBOL_ROLE_DEFINITION) == 1);
+    REQUIRE(count("x", SYMBOL_KIND_VARIABLE, SYMBOL_ROLE_REFERENCE) == 2);
+    REQUIRE(count("f", SYMBOL_KIND_FUNCTION, SYMBOL_ROLE_DEFINITION) == 1);
+    REQUIRE(count("f", SYMBOL_KIND_FUNCTION, SYMBOL_ROLE_REFERENCE) == 2);
+    REQUIRE(count("a", SYMBOL_KIND_VARIABLE, SYMBOL_ROLE_REFERENCE) == 1);
+}
+
+static void WriteSource(const std::string &fileName, const std::string &text){
+    std::error_code error;
+    llvm::raw_fd_ostream out(fileName, error);
+    REQUIRE(!error);
+    out << text;
+}
+
+TEST_CASE("The symbol index only reparses what changed", "[index]"){
+    llvm::SmallString<128> directory;
+    REQUIRE(!llvm::sys::fs::createUniqueDirectory("symbolindex", directory));
+    std::string index = (directory + "/index").str(), one = (directory + "/one.p").str(), two = (directory + "/two.p").str();
+    WriteSource(one, "program one;\nvar alpha, shared: integer;\nbegin\n  shared := alpha;\nend.\n");
+    WriteSource(two, "program two;\nvar beta, shared: integer;\nbegin\n  shared := beta;\nend.\n");
+    REQUIRE(UpdateSymbolIndex(index, {one, two}));
+
+    auto symbols = SymbolIndex::Open(index);
+    REQUIRE(symbols);
+    REQUIRE(symbols->GetFileCount() == 2);
+    auto alpha = symbols->Find("alpha");
+    REQUIRE(alpha.size() == 2);
+    REQUIRE(symbols->GetFilePath(alpha[0].file) == one);
+    REQUIRE(alpha[0].role == SYMBOL_ROLE_DEFINITION);
+    REQUIRE(alpha[0].line == 2);
+    REQUIRE(alpha[0].column == 5);
+    REQUIRE(alpha[1].role == SYMBOL_ROLE_REFERENCE);
+    REQUIRE(alpha[1].line == 4);
+    REQUIRE(alpha[1].column == 13);
+    REQUIRE(symbols->Find("shared").size() == 4);
+    REQUIRE(symbols->Find("missing").empty());
+    symbols.reset();
+
+    SECTION("Unchanged files keep their occurrences"){
+        // alpha becomes gamma, and two.p isn't even passed this time
+        WriteSource(one, "program one;\nvar gamma, shared: integer;\nbegin\n  shared := gamma;\n  shared := gamma;\nend.\n");
+        REQUIRE(UpdateSymbolIndex(index, {one}));
+        symbols = SymbolIndex::Open(index);
+        REQUIRE(symbols);
+        REQUIRE(symbols->GetFileCount() == 2);
+        REQUIRE(symbols->Find("alpha").empty());
+        REQUIRE(symbols->Find("gamma").size() == 3);
+        auto beta = symbols->Find("beta");
+        REQUIRE(beta.size() == 2);
+        REQUIRE(symbols->GetFilePath(beta[1].file) == two);
+        REQUIRE(beta[1].line == 4);
+        REQUIRE(beta[1].column == 13);
+        REQUIRE(symbols->Find("shared").size() == 5);
+    }
+    SECTION("Deleted files are dropped"){
+        REQUIRE(!llvm::sys::fs::remove(two));
+        REQUIRE(UpdateSymbolIndex(index, {one}));
+        symbols = SymbolIndex::Open(index);
+        REQUIRE(symbols);
+        REQUIRE(symbols->GetFileCount() == 1);
+        REQUIRE(symbols->Find("beta").empty());
+        REQUIRE(symbols->Find("alpha").size() == 2);
+        auto shared = symbols->Find("shared");
+        REQUIRE(shared.size() == 2);
+        REQUIRE(symbols->GetFilePath(shared[0].file) == one);
+        REQUIRE(symbols->GetFilePath(shared[1].file) == one);
+    }
+    symbols.reset();
+    llvm::sys::fs::remove_directories(directory);
+}
+
+TEST_CASE("Names resolve to the innermost declaration", "[resolve]"){
+    Lexar lexar = Lexar();
+    lexar.Init(std::string("program p;\nvar x, y: integer;\n"
+                           "procedure f(x: integer);\nbegin\n  y := x;\nend;\n"
+                           "begin\n  x := y;\nend.\n"));
+    Parser parser = Parser(&lexar);
+    REQUIRE(parser.Parse());
+    // x, y, the parameter x and f's result
+    REQUIRE(ResolveNames(parser.tree.get()) == 4);
+
+    auto program = llvm::cast<ProgramAST>(parser.tree.get());
+    auto function = llvm::cast<FunctionAST>(program->GetDeclarations()[1].get());
+    auto body = llvm::cast<MainBlockAST>(function->GetBody().get());
+    auto inner = llvm::cast<BinaryOpAST>(llvm::cast<StatementSequenceAST>(body->GetStatementSequence().get())->GetStatements()[0].get());
+    auto outer = llvm::cast<BinaryOpAST>(llvm::cast<StatementSequenceAST>(program->GetStatementSequence().get())->GetStatements()[0].get());
+
+    REQUIRE(llvm::cast<VariableIdentifierAST>(inner->GetRHS().get())->GetSlot() == function->GetFirstSlot());
+    REQUIRE(llvm::cast<VariableIdentifierAST>(inner->GetLHS().get())->GetSlot() == 2);
+    REQUIRE(llvm::cast<VariableIdentifierAST>(outer->GetLHS().get())->GetSlot() == 1);
+}
+
+TEST_CASE("Constants are folded and dead branches pruned", "[fold]"){
+    Lexar lexar = Lexar();
+    lexar.Init(std::string("program p;\nconst A = 6;\nvar x: integer;\n"
+                           "begin\n  x := A * 7 + 2;\n  if A > 7 then x := 1 else x := 2;\n  while A < 0 do x := 3;\nend.\n"));
+    Parser parser = Parser(&lexar);
+    REQUIRE(parser.Parse());
+    ResolveNames(parser.tree.get());
+    FoldConstants(parser.tree);
+
+    auto program = llvm::cast<ProgramAST>(parser.tree.get());
+    auto &statements = llvm::cast<StatementSequenceAST>(program->GetStatementSequence().get())->GetStatements();
+    auto assign = llvm::cast<BinaryOpAST>(statements[0].get());
+    REQUIRE(llvm::cast<NumberAST>(assign->GetRHS().get())->GetValue() == 44);
+
+    auto elsePart = llvm::cast<BinaryOpAST>(statements[1].get());
+    REQUIRE(llvm::cast<NumberAST>(elsePart->GetRHS().get())->GetValue() == 2);
+
+    auto loop = llvm::cast<StatementSequenceAST>(statements[2].get());
+    REQUIRE(loop->GetStatements().empty());
+}
+
+TEST_CASE("Calls resolve to builtins or declarations", "[resolve]"){
+    Lexar lexar = Lexar();
+    lexar.Init(std::string("program p;\nvar x: integer;\n"
+                           "procedure inc(n: integer);\nbegin\n  writeln(n);\nend;\n"
+                           "begin\n  inc(x);\n  dec(x);\nend.\n"));
+    Parser parser = Parser(&lexar);
+    REQUIRE(parser.Parse());
+    ResolveNames(parser.tree.get());
+
+    auto program = llvm::cast<ProgramAST>(parser.tree.get());
+    auto procedure = llvm::cast<FunctionAST>(program->GetDeclarations()[1].get());
+    auto body = llvm::cast<MainBlockAST>(procedure->GetBody().get());
+    auto writeln = llvm::cast<CallExpessionsAst>(llvm::cast<StatementSequenceAST>(body->GetStatementSequence().get())->GetStatements()[0].get());
+    REQUIRE(writeln->GetBuiltin() == BUILTIN_WRITELN);
+
+    auto &statements = llvm::cast<StatementSequenceAST>(program->GetStatementSequence().get())->GetStatements();
+    auto inc = llvm::cast<CallExpessionsAst>(statements[0].get());
+    REQUIRE(inc->GetBuiltin() == BUILTIN_NONE);
+    REQUIRE(inc->GetDeclaration() == procedure->GetPrototype());
+    REQUIRE(llvm::cast<CallExpessionsAst>(statements[1].get())->GetBuiltin() == BUILTIN_DEC);
+}
+
+TEST_CASE("Only procedures reachable from main are kept", "[callgraph]"){
+    Lexar lexar = Lexar();
+    lexar.Init(std::string("program p;\n"
+                           "function odd(n: integer): integer; forward;\n"
+                           "function even(n: integer): integer;\nbegin\n  even := odd(n);\nend;\n"
+                           "function odd(n: integer): integer;\nbegin\n  odd := even(n);\nend;\n"
+                           "procedure unused;\nbegin\n  unused();\nend;\n"
+                           "begin\n  writeln(even(3));\nend.\n"));
+    Parser parser = Parser(&lexar);
+    REQUIRE(parser.Parse());
+    ResolveNames(parser.tree.get());
+    REQUIRE(MarkReachableProcedures(parser.tree.get()) == 1);
+
+    auto &declarations = llvm::cast<ProgramAST>(parser.tree.get())->GetDeclarations();
+    REQUIRE(llvm::cast<DeclarationAST>(declarations[0].get())->IsReachable());
+    REQUIRE(llvm::cast<DeclarationAST>(declarations[1].get())->IsReachable());
+    REQUIRE(llvm::cast<DeclarationAST>(declarations[2].get())->IsReachable());
+    REQUIRE(!llvm::cast<DeclarationAST>(declarations[3].get())->IsReachable());
+}
+
+TEST_CASE("Pure calls with constant arguments are evaluated", "[evaluation]"){
+    Lexar lexar = Lexar();
+    lexar.Init(std::string("program p;\n"
+                           "function fact(n: integer): integer;\nbegin\n"
+                           "  if (n = 0) then fact := 1 else fact := n * fact(n - 1);\nend;\n"
+                           "function loud(n: integer): integer;\nbegin\n  writeln(n);\n  loud := n;\nend;\n"
+                           "var x: integer;\n"
+                           "begin\n  writeln(fact(5));\n  writeln(loud(1));\n  writeln(fact(x));\nend.\n"));
+    Parser parser = Parser(&lexar);
+    REQUIRE(parser.Parse());
+    ResolveNames(parser.tree.get());
+    REQUIRE(EvaluateConstantCalls(parser.tree) == 1);
+
+    auto &statements = llvm::cast<StatementSequenceAST>(llvm::cast<ProgramAST>(parser.tree.get())->GetStatementSequence().get())->GetStatements();
+    auto folded = llvm::dyn_cast<NumberAST>(llvm::cast<CallExpessionsAst>(statements[0].get())->GetArgs()[0].get());
+    REQUIRE(folded);
+    REQUIRE(folded->GetValue() == 120);
+    REQUIRE(llvm::isa<CallExpessionsAst>(llvm::cast<CallExpessionsAst>(statements[1].get())->GetArgs()[0].get()));
+    REQUIRE(llvm::isa<CallExpessionsAst>(llvm::cast<CallExpessionsAst>(statements[2].get())->GetArgs()[0].get()));
+}
+
+TEST_CASE("For loops take an optional step and may run zero times", "[parser]"){
+    Lexar lexar = Lexar();
+    lexar.Init(std::string("program p;\n"
+                           "function sum(a: integer; b: integer): integer;\nvar s: integer;\nbegin\n"
+                           "  s := 0;\n  for i := a to b step 3 do s := s + i;\n  sum := s;\nend;\n"
+                           "begin\n  writeln(sum(1, 10));\n  writeln(sum(5, 1));\nend.\n"));
+    Parser parser = Parser(&lexar);
+    REQUIRE(parser.Parse());
+    ResolveNames(parser.tree.get());
+
+    auto &declarations = llvm::cast<ProgramAST>(parser.tree.get())->GetDeclarations();
+    auto body = llvm::cast<FunctionAST>(declarations[0].get())->GetBody().get();
+    auto &loop = llvm::cast<StatementSequenceAST>(llvm::cast<MainBlockAST>(body)->GetStatementSequence().get())->GetStatements()[1];
+    auto step = llvm::dyn_cast<NumberAST>(llvm::cast<ForExpressionAST>(loop.get())->GetStep().get());
+    REQUIRE(step);
+    REQUIRE(step->GetValue() == 3);
+
+    REQUIRE(EvaluateConstantCalls(parser.tree) == 2);
+    auto &statements = llvm::cast<StatementSequenceAST>(llvm::cast<ProgramAST>(parser.tree.get())->GetStatementSequence().get())->GetStatements();
+    REQUIRE(llvm::cast<NumberAST>(llvm::cast<CallExpessionsAst>(statements[0].get())->GetArgs()[0].get())->GetValue() == 22);
+    REQUIRE(llvm::cast<NumberAST>(llvm::cast<CallExpessionsAst>(statements[1].get())->GetArgs()[0].get())->GetValue() == 0);
+}
+
+TEST_CASE("For loops stop before stepping past the end", "[evaluation]"){
+    Lexar lexar = Lexar();
+    // Counts the steps from maxint - 5807 to maxint
+    lexar.Init(std::string("program p;\n"
+                           "function count(s: integer): integer;\nvar c: integer; m: integer;\nbegin\n"
+                           "  m := 1073741824 * 1073741824 * 4;\n  m := m - 1 + m;\n"
+                           "  c := 0;\n  for i := m - 5807 to m step s do c := c + 1;\n  count := c;\nend;\n"
+                           "var i: integer;\n"
+                           "begin\n  writeln(count(1000));\n  writeln(count(0));\n"
+                           "  for i := 1 to 10 step count(1000) do writeln(i);\nend.\n"));
+    Parser parser = Parser(&lexar);
+    REQUIRE(parser.Parse());
+    ResolveNames(parser.tree.get());
+
+    REQUIRE(EvaluateConstantCalls(parser.tree) == 3);
+    auto &statements = llvm::cast<StatementSequenceAST>(llvm::cast<ProgramAST>(parser.tree.get())->GetStatementSequence().get())->GetStatements();
+    REQUIRE(llvm::cast<NumberAST>(llvm::cast<CallExpessionsAst>(statements[0].get())->GetArgs()[0].get())->GetValue() == 6);
+    // A step that isn't positive runs the loop zero times
+    REQUIRE(llvm::cast<NumberAST>(llvm::cast<CallExpessionsAst>(statements[1].get())->GetArgs()[0].get())->GetValue() == 0);
+    auto step = llvm::dyn_cast<NumberAST>(llvm::cast<ForExpressionAST>(statements[2].get())->GetStep().get());
+    REQUIRE(step);
+    REQUIRE(step->GetValue() == 6);
+}
+
+TEST_CASE("and/or of comparisons are booleans that short-circuit", "[evaluation]"){
+    Lexar lexar = Lexar();
+    lexar.Init(std::string("program p;\n"
+                           "function safe(n: integer): integer;\nbegin\n"
+                           "  if (n = 0) or (10 div n > 1) then safe := 1 else safe := 2;\nend;\n"
+                           "var x: integer;\n"
+                           "begin\n  writeln(safe(0));\n  writeln(x and 6);\nend.\n"));
+    Parser parser = Parser(&lexar);
+    REQUIRE(parser.Parse());
+    ResolveNames(parser.tree.get());
+
+    auto &statements = llvm::cast<StatementSequenceAST>(llvm::cast<ProgramAST>(parser.tree.get())->GetStatementSequence().get())->GetStatements();
+    REQUIRE_FALSE(IsBoolean(llvm::cast<CallExpessionsAst>(statements[1].get())->GetArgs()[0].get()));
+
+    // 10 div 0 is never evaluated
+    REQUIRE(EvaluateConstantCalls(parser.tree) == 1);
+    REQUIRE(llvm::cast<NumberAST>(llvm::cast<CallExpessionsAst>(statements[0].get())->GetArgs()[0].get())->GetValue() == 1);
+}
+
+TEST_CASE("Signed integers divide toward zero and compare signed", "[fold]"){
+    Lexar lexar = Lexar();
+    lexar.Init(std::string("program p;\nvar x: integer;\n"
+                           "begin\n  x := -7 div 2 + 1;\n  if -1 < 0 then x := 1 else x := 2;\n  x := 12 mod (0 - 5);\nend.\n"));
+    Parser parser = Parser(&lexar);
+    REQUIRE(parser.Parse());
+    ResolveNames(parser.tree.get());
+    SetSignedArithmetic(true);
+    FoldConstants(parser.tree);
+    SetSignedArithmetic(false);
+
+    auto &statements = llvm::cast<StatementSequenceAST>(llvm::cast<ProgramAST>(parser.tree.get())->GetStatementSequence().get())->GetStatements();
+    // The minus belongs to 7 div 2 alone
+    REQUIRE(llvm::cast<NumberAST>(llvm::cast<BinaryOpAST>(statements[0].get())->GetRHS().get())->GetValue() == -2);
+    REQUIRE(llvm::cast<NumberAST>(llvm::cast<BinaryOpAST>(statements[1].get())->GetRHS().get())->GetValue() == 1);
+    REQUIRE(llvm::cast<NumberAST>(llvm::cast<BinaryOpAST>(statements[2].get())->GetRHS().get())->GetValue() == 2);
+}
+
+TEST_CASE("Comparisons can't be used as integers", "[types]"){
+    Lexar lexar = Lexar();
+    lexar.Init(std::string("program p;\nvar x, a, b: integer;\n"
+                           "procedure f(n: integer);\nbegin\n  writeln(n);\nend;\n"
+                           "begin\n  x := a < b;\n  x := (a < b) + 1;\n  f(a = b);\n"
+                           "  if (a < b) and (a > 0) then writeln(a < b);\n  x := (a < b) and 1;\nend.\n"));
+    Parser parser = Parser(&lexar);
+    REQUIRE(parser.Parse());
+    ResolveNames(parser.tree.get());
+    // The two assignments, the argument and the mixed and; the if and writeln are fine
+    REQUIRE(CheckTypes(parser.tree.get()) == 4);
+}
+
+static std::string Frame(const std::string &body){
+    return "Content-Length: " + std::to_string(body.size()) + "\r\n\r\n" + body;
+}
+
+TEST_CASE("The language server rejects requests without an id", "[lsp]"){
+    std::istringstream in(Frame("{\"jsonrpc\":\"2.0\",\"method\":\"shutdown\"}") +
+                          Frame("{\"jsonrpc\":\"2.0\",\"id\":1,\"method\":\"shutdown\"}") +
+                          Frame("{\"jsonrpc\":\"2.0\",\"method\":\"exit\"}"));
+    std::ostringstream out;
+    LanguageServer server(in, out);
+    // Still running after the bad one, and the real shutdown counts
+    REQUIRE(server.Run() == 0);
+    REQUIRE(out.str().find("\"id\":null") != std::string::npos);
+    REQUIRE(out.str().find("-32600") != std::string::npos);
+    REQUIRE(out.str().find("\"id\":1,\"jsonrpc\":\"2.0\",\"result\":null") != std::string::npos);
+}
+
+static std::string Message(llvm::json::Object message){
+    message["jsonrpc"] = "2.0";
+    std::string body;
+    llvm::raw_string_ostream stream(body);
+    stream << llvm::json::Value(std::move(message));
+    return Frame(stream.str());
+}
+
+static llvm::json::Value LSPRange(int startLine, int startCharacter, int endLine, int endCharacter){
+    return llvm::json::Object{
+        {"start", llvm::json::Object{{"line", startLine}, {"character", startCharacter}}},
+        {"end", llvm::json::Object{{"line", endLine}, {"character", endCharacter}}}};
+}
+
+static std::string DidChange(int startLine, int startCharacter, int endLine, int endCharacter, const std::string &text){
+    return Message(llvm::json::Object{{"method", "textDocument/didChange"},
+        {"params", llvm::json::Object{{"textDocument", llvm::json::Object{{"uri", "file:///p.pas"}}},
+            {"contentChanges", llvm::json::Array{llvm::json::Object{
+                {"range", LSPRange(startLine, startCharacter, endLine, endCharacter)}, {"text", text}}}}}}});
+}
+
+static std::string RequestAt(int id, const std::string &method, int line, int character){
+    return Message(llvm::json::Object{{"id", id}, {"method", method},
+        {"params", llvm::json::Object{{"textDocument", llvm::json::Object{{"uri", "file:///p.pas"}}},
+            {"position", llvm::json::Object{{"line", line}, {"character", character}}}}}});
+}
+
+// Everything the server sent, in order
+static std::vector<llvm::json::Value> ServerMessages(const std::string &output){
+    std::vector<llvm::json::Value> messages;
+    size_t at = 0;
+    while((at = output.find("Content-Length: ", at)) != std::string::npos){
+        size_t length = std::stoul(output.substr(at + 16));
+        size_t body = output.find("\r\n\r\n", at) + 4;
+        auto parsed = llvm::json::parse(output.substr(body, length));
+        REQUIRE((bool) parsed);
+        messages.push_back(std::move(*parsed));
+        at = body + length;
+    }
+    return messages;
+}
+
+static const llvm::json::Value *ResultOf(const std::vector<llvm::json::Value> &messages, int id){
+    for(auto &message : messages){
+        auto object = message.getAsObject();
+        if(object && object->getInteger("id") == (int64_t) id)
+            return object->get("result");
+    }
+    return nullptr;
+}
+
+static size_t DiagnosticCount(const llvm::json::Value &message){
+    return message.getAsObject()->getObject("params")->getArray("diagnostics")->size();
+}
+
+static const llvm::json::Object *ChildSymbol(const llvm::json::Object *symbol, const std::string &name){
+    for(auto &child : *symbol->getArray("children")){
+        if(child.getAsObject()->getString("name") == llvm::StringRef(name))
+            return child.getAsObject();
+    }
+    return nullptr;
+}
+
+TEST_CASE("The language server reparses just the edited procedure", "[lsp]"){
+    std::string text = "program p;\n"                        // 0
+                       "var x: integer;\n"                   // 1
+                       "procedure a(n: integer);\n"          // 2
+                       "begin\n"                             // 3
+                       "  writeln(n);\n"                     // 4
+                       "end;\n"                              // 5
+                       "function b(m: integer): integer;\n"  // 6
+                       "var t: integer;\n"                   // 7
+                       "begin\n"                             // 8
+                       "  t := m;\n"                         // 9
+                       "  b := t;\n"                         // 10
+                       "end;\n"                              // 11
+                       "begin\n"                             // 12
+                       "  x := b(1);\n"                      // 13
+                       "  a(x);\n"                           // 14
+                       "end.\n";                             // 15
+    std::string open = Message(llvm::json::Object{{"method", "textDocument/didOpen"},
+        {"params", llvm::json::Object{{"textDocument", llvm::json::Object{
+            {"uri", "file:///p.pas"}, {"languageId", "pascal"}, {"version", 1}, {"text", text}}}}}});
+    std::string symbols = Message(llvm::json::Object{{"id", 1}, {"method", "textDocument/documentSymbol"},
+        {"params", llvm::json::Object{{"textDocument", llvm::json::Object{{"uri", "file:///p.pas"}}}}}});
+    std::string exit = Message(llvm::json::Object{{"id", 9}, {"method", "shutdown"}}) +
+                       Message(llvm::json::Object{{"method", "exit"}});
+
+    SECTION("Declarations after the edit move with it"){
+        // A local in a, which pushes b and the main body a line down
+        std::istringstream in(open + DidChange(3, 0, 3, 0, "var k: integer;\n") + symbols +
+                              RequestAt(2, "textDocument/definition", 10, 2) +
+                              RequestAt(3, "textDocument/definition", 14, 7) + exit);
+        std::ostringstream out;
+        LanguageServer server(in, out);
+        REQUIRE(server.Run() == 0);
+        auto messages = ServerMessages(out.str());
+        REQUIRE(DiagnosticCount(messages[1]) == 0);
+
+        auto program = (*ResultOf(messages, 1)->getAsArray())[0].getAsObject();
+        REQUIRE(*program->get("range") == LSPRange(0, 0, 16, 4));
+        auto a = ChildSymbol(program, "a");
+        REQUIRE(a);
+        REQUIRE(*a->get("range") == LSPRange(2, 0, 6, 4));
+        REQUIRE(a->getArray("children")->size() == 1);
+        REQUIRE(*ChildSymbol(a, "k")->get("range") == LSPRange(3, 4, 3, 5));
+        auto b = ChildSymbol(program, "b");
+        REQUIRE(b);
+        REQUIRE(*b->get("range") == LSPRange(7, 0, 12, 4));
+        REQUIRE(*b->get("selectionRange") == LSPRange(7, 0, 7, 31));
+        REQUIRE(*ChildSymbol(b, "t")->get("range") == LSPRange(8, 4, 8, 5));
+
+        // t in t := m, and the call to b in the main body
+        REQUIRE(*ResultOf(messages, 2)->getAsObject()->get("range") == LSPRange(8, 4, 8, 5));
+        REQUIRE(*ResultOf(messages, 3)->getAsObject()->get("range") == LSPRange(7, 0, 7, 31));
+    }
+    SECTION("A broken procedure keeps its old subtree"){
+        std::istringstream in(open + DidChange(4, 13, 4, 13, "\n  writeln(") + symbols +
+                              RequestAt(2, "textDocument/definition", 10, 2) +
+                              DidChange(5, 10, 5, 10, "n);") + exit);
+        std::ostringstream out;
+        LanguageServer server(in, out);
+        REQUIRE(server.Run() == 0);
+        auto messages = ServerMessages(out.str());
+        REQUIRE(DiagnosticCount(messages[1]) == 1);
+        // A full parse would have failed and dropped the symbols
+        auto program = (*ResultOf(messages, 1)->getAsArray())[0].getAsObject();
+        REQUIRE(*ChildSymbol(program, "a")->get("range") == LSPRange(2, 0, 6, 4));
+        REQUIRE(*ChildSymbol(program, "b")->get("range") == LSPRange(7, 0, 12, 4));
+        REQUIRE(*ResultOf(messages, 2)->getAsObject()->get("range") == LSPRange(8, 4, 8, 5));
+        // Parses again once the call is finished
+        REQUIRE(DiagnosticCount(messages[4]) == 0);
+    }
+}
+
+TEST_CASE("Trees loaded from an AST file are numbered again", "[astfile]"){
+    Lexar lexar = Lexar();
+    lexar.Init(std::string("program p;\nvar x, a, b: integer;\nbegin\n  x := a * b + a * b;\nend.\n"));
+    Parser parser = Parser(&lexar);
+    REQUIRE(parser.Parse());
+    REQUIRE(WriteASTFile(parser.tree.get(), 1, "./numbered.ast"));
+    auto tree = ReadASTFile("./numbered.ast", 1);
+    remove("./numbered.ast");
+    REQUIRE(tree);
+
+    ExpressionTable expressions;
+    NumberExpressions(tree.get(), expressions);
+    auto &statements = llvm::cast<StatementSequenceAST>(llvm::cast<ProgramAST>(tree.get())->GetStatementSequence().get())->GetStatements();
+    auto sum = llvm::cast<BinaryOpAST>(llvm::cast<BinaryOpAST>(statements[0].get())->GetRHS().get());
+    REQUIRE(sum->GetLHS()->GetValueNumber() != 0);
+    REQUIRE(sum->GetLHS()->GetValueNumber() == sum->GetRHS()->GetValueNumber());
+}
+
+// Same kinds, locations, names, values and operators all the way down
+static void RequireSameTree(AST *original, AST *loaded){
+    REQUIRE(loaded->GetKind() == original->GetKind());
+    REQUIRE(loaded->GetOffset() == original->GetOffset());
+    REQUIRE(loaded->GetLength() == original->GetLength());
+    switch(original->GetKind()){
+        case AST_PROGRAM:
+            REQUIRE(llvm::cast<ProgramAST>(loaded)->GetName() == llvm::cast<ProgramAST>(original)->GetName());
+            break;
+        case AST_NUMBER:
+            REQUIRE(llvm::cast<NumberAST>(loaded)->GetValue() == llvm::cast<NumberAST>(original)->GetValue());
+            break;
+        case AST_VARIABLE_IDENTIFIER:
+            REQUIRE(llvm::cast<VariableIdentifierAST>(loaded)->GetName() == llvm::cast<VariableIdentifierAST>(original)->GetName());
+            break;
+        case AST_UNARY_OP:
+            REQUIRE(llvm::cast<UnaryOpAST>(loaded)->GetOp() == llvm::cast<UnaryOpAST>(original)->GetOp());
+            break;
+        case AST_BINARY_OP:
+            REQUIRE(llvm::cast<BinaryOpAST>(loaded)->GetOp() == llvm::cast<BinaryOpAST>(original)->GetOp());
+            break;
+        case AST_COMPARISON_OP:
+            REQUIRE(llvm::cast<ComparisonOpAST>(loaded)->GetOp() == llvm::cast<ComparisonOpAST>(original)->GetOp());
+            break;
+        case AST_EXIT_BREAK:
+            REQUIRE(llvm::cast<ExitBreakStatementAST>(loaded)->GetExitOrBreak() == llvm::cast<ExitBreakStatementAST>(original)->GetExitOrBreak());
+            break;
+        case AST_CALL:
+            REQUIRE(llvm::cast<CallExpessionsAst>(loaded)->GetCallee() == llvm::cast<CallExpessionsAst>(original)->GetCallee());
+            break;
+        case AST_IF:
+            REQUIRE(!llvm::cast<IfExpressionAST>(loaded)->GetElse() == !llvm::cast<IfExpressionAST>(original)->GetElse());
+            break;
+        case AST_FOR:{
+            auto loadedFor = llvm::cast<ForExpressionAST>(loaded), originalFor = llvm::cast<ForExpressionAST>(original);
+            REQUIRE(loadedFor->GetLoopVarName() == originalFor->GetLoopVarName());
+            REQUIRE(loadedFor->GetDirection() == originalFor->GetDirection());
+            REQUIRE(!loadedFor->GetStep() == !originalFor->GetStep());
+            break;
+        }
+        case AST_VARIABLE_DECLARATIONS_OF_TYPE:
+            REQUIRE(llvm::cast<VariableDeclarationsOfTypeAST>(loaded)->GetType() == llvm::cast<VariableDeclarationsOfTypeAST>(original)->GetType());
+            break;
+        case AST_CONSTANT_DECLARATIONS:{
+            auto &loadedConstants = llvm::cast<ConstantDeclarationsAST>(loaded)->GetConstants();
+            auto &originalConstants = llvm::cast<ConstantDeclarationsAST>(original)->GetConstants();
+            REQUIRE(loadedConstants.size() == originalConstants.size());
+            for(size_t i = 0; i<originalConstants.size(); i++){
+                REQUIRE(loadedConstants[i].name == originalConstants[i].name);
+                REQUIRE(loadedConstants[i].value == originalConstants[i].value);
+            }
+            break;
+        }
+        case AST_PROTOTYPE:{
+            auto loadedProto = llvm::cast<PrototypeAST>(loaded), originalProto = llvm::cast<PrototypeAST>(original);
+            REQUIRE(loadedProto->GetName() == originalProto->GetName());
+            REQUIRE(loadedProto->GetReturnType() == originalProto->GetReturnType());
+            REQUIRE(loadedProto->GetArgs().size() == originalProto->GetArgs().size());
+            for(size_t i = 0; i<originalProto->GetArgs().size(); i++){
+                REQUIRE(loadedProto->GetArgs()[i].name == originalProto->GetArgs()[i].name);
+                REQUIRE(loadedProto->GetArgs()[i].type == originalProto->GetArgs()[i].type);
+            }
+            break;
+        }
+        default:
+            break;
+    }
+
+    std::vector<AST*> originalChildren, loadedChildren;
+    ForEachChild(original, [&](AST *child){ originalChildren.push_back(child); });
+    ForEachChild(loaded, [&](AST *child){ loadedChildren.push_back(child); });
+    REQUIRE(loadedChildren.size() == originalChildren.size());
+    for(size_t i = 0; i<originalChildren.size(); i++)
+        RequireSameTree(originalChildren[i], loadedChildren[i]);
+}
+
+TEST_CASE("AST files load back the tree that was written", "[astfile]"){
+    Lexar lexar = Lexar();
+    lexar.Init(std::string("program p;\nconst limit = 10; low = 3;\nvar x, y: integer;\n"
+                           "function f(a: integer; b: integer): integer;\nvar t: integer;\nbegin\n"
+                           "  t := 0;\n  for i := a downto b step 2 do t := t + i * 3;\n  f := t;\nend;\n"
+                           "procedure g(a: integer);\nbegin\n  if (a > limit) or (a = low) then exit;\n  writeln(a);\nend;\n"
+                           "begin\n  x := -5 div 2;\n  y := 0;\n"
+                           "  while y < limit do\n  begin\n    y := y + 1;\n    if y mod 4 = 0 then break else g(f(y, 1));\n  end;\n"
+                           "  for x := 1 to y do writeln(x);\nend.\n"));
+    Parser parser = Parser(&lexar);
+    REQUIRE(parser.Parse());
+    REQUIRE(WriteASTFile(parser.tree.get(), 7, "./roundtrip.ast"));
+    REQUIRE(!ReadASTFile("./roundtrip.ast", 8));
+    auto tree = ReadASTFile("./roundtrip.ast", 7);
+    remove("./roundtrip.ast");
+    REQUIRE(tree);
+    RequireSameTree(parser.tree.get(), tree.get());
+}
+
+// An AST file with the string table {"p"} around the given node stream, for
+// files the writer wouldn't make
+static void WriteRawASTFile(const std::string &fileName, const std::string &nodes){
+    std::error_code error;
+    llvm::raw_fd_ostream out(fileName, error);
+    REQUIRE(!error);
+    llvm::support::endian::Writer header(out, llvm::support::little);
+    out << "PAST";
+    header.write<uint32_t>(AST_FILE_VERSION);
+    header.write<uint64_t>(1);
+    header.write<uint32_t>(1);
+    out << '\x01' << 'p' << nodes;
+}
+
+TEST_CASE("Malformed AST files aren't loaded", "[astfile]"){
+    Lexar lexar = Lexar();
+    lexar.Init(std::string("program p;\nvar x: integer;\nbegin\n  x := 1;\nend.\n"));
+    Parser parser = Parser(&lexar);
+    REQUIRE(parser.Parse());
+    auto &statements = llvm::cast<StatementSequenceAST>(llvm::cast<ProgramAST>(parser.tree.get())->GetStatementSequence().get())->GetStatements();
+    auto &rhs = llvm::cast<BinaryOpAST>(statements[0].get())->GetRHS();
+
+    SECTION("Missing a child codegen needs"){
+        auto value = std::move(rhs);
+        REQUIRE(WriteASTFile(parser.tree.get(), 1, "./malformed.ast"));
+        REQUIRE(!ReadASTFile("./malformed.ast", 1));
+    }
+    SECTION("Not a program"){
+        REQUIRE(WriteASTFile(rhs.get(), 1, "./malformed.ast"));
+        REQUIRE(!ReadASTFile("./malformed.ast", 1));
+    }
+    SECTION("Nested too deep"){
+        // Not written, the reader would only reject it
+        for(int i = 0; i<2000; i++)
+            rhs = std::make_unique<UnaryOpAST>(MINUS, std::move(rhs));
+        REQUIRE(WriteASTFile(parser.tree.get(), 1, "./malformed.ast"));
+        REQUIRE(!llvm::sys::fs::exists("./malformed.ast"));
+
+        std::string nodes;
+        llvm::raw_string_ostream nodesOut(nodes);
+        nodesOut << (char) AST_PROGRAM << '\0' << '\0' << '\0' << '\0' << (char) AST_STATEMENT_SEQUENCE << '\0' << '\0' << '\1';
+        for(int i = 0; i<2000; i++)
+            nodesOut << (char) AST_UNARY_OP << '\0' << '\0' << (char) MINUS;
+        nodesOut << (char) AST_NUMBER << '\0' << '\0' << '\1';
+        WriteRawASTFile("./malformed.ast", nodesOut.str());
+        REQUIRE(!ReadASTFile("./malformed.ast", 1));
+    }
+    SECTION("Numbers out of range"){
+        // program p; begin <value> end.
+        auto program = [](int64_t value){
+            std::string nodes;
+            llvm::raw_string_ostream nodesOut(nodes);
+            nodesOut << (char) AST_PROGRAM << '\0' << '\0' << '\0' << '\0' << (char) AST_STATEMENT_SEQUENCE << '\0' << '\0' << '\1';
+            nodesOut << (char) AST_NUMBER << '\0' << '\0';
+            llvm::encodeSLEB128(value, nodesOut);
+            return nodesOut.str();
+        };
+        WriteRawASTFile("./malformed.ast", program(INT32_MAX));
+        REQUIRE(ReadASTFile("./malformed.ast", 1));
+        WriteRawASTFile("./malformed.ast", program((int64_t) INT32_MAX + 1));
+        REQUIRE(!ReadASTFile("./malformed.ast", 1));
+    }
+    SECTION("Source locations out of range"){
+        std::string nodes;
+        llvm::raw_string_ostream nodesOut(nodes);
+        nodesOut << (char) AST_PROGRAM;
+        llvm::encodeULEB128((uint64_t) UINT32_MAX + 1, nodesOut);
+        nodesOut << '\0' << '\0' << '\0' << (char) AST_STATEMENT_SEQUENCE << '\0' << '\0' << '\0';
+        WriteRawASTFile("./malformed.ast", nodesOut.str());
+        REQUIRE(!ReadASTFile("./malformed.ast", 1));
+    }
+    SECTION("Cut short"){
+        REQUIRE(WriteASTFile(parser.tree.get(), 1, "./malformed.ast"));
+        uint64_t size;
+        REQUIRE(!llvm::sys::fs::file_size("./malformed.ast", size));
+        REQUIRE(truncate("./malformed.ast", size - 2) == 0);
+        REQUIRE(!ReadASTFile("./malformed.ast", 1));
+    }
+    remove("./malformed.ast");
+}